@@ -0,0 +1,747 @@
+//
+//  bench.c
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+//  Benchmark of one transcoding pipeline on synthetic inputs.
+//
+//  The inputs are rendered by the lavfi sources testsrc2 and sine, so
+//  every run sees the same frames. Each case is transcoded runs times,
+//  every time in a fresh child process, and the run with the median wall
+//  time is reported as JSON: frames per second, speed relative to real
+//  time, CPU time, peak RSS and heap allocations per frame.
+//
+//  -check_allocs instead transcodes a 100 and a 1000 frame input and
+//  compares the two runs, so whatever is allocated once cancels out. It
+//  fails when the transcoder sources allocate AVFrames per frame (every
+//  av_frame_alloc() there is counted, see alloc_stats.h), when the heap
+//  left after the run grows with the frame count, or when the heap
+//  allocations per frame exceed -alloc_budget.
+//
+//  -scalers list runs every case once per scaler profile in the comma
+//  separated list, scaling to -scale_to WxH (half the case size by
+//  default), so the cost of each profile shows in the fps and CPU time.
+//
+//  -ladder heights transcodes every case into the ABR ladder twice, once
+//  with every rendition scaled from the input and once cascaded, each
+//  from the next larger rendition, and reports the CPU time per rung.
+//
+//  -soak seconds streams an endless lavfi source through a FIFO into one
+//  long transcode for that long. Every -soak_interval seconds it records
+//  the RSS, the frames per second and the heap allocations per frame, and
+//  it fails when the RSS keeps growing or the frame rate drops over the
+//  run by more than -max_rss_drift and -max_fps_decay percent.
+//
+//  bench/Makefile builds one executable per driver. Each links bench.c
+//  with exactly one of the pipeline drivers:
+//
+//      bench_ffmpeg.c    ffmpeg_opt.c ffmpeg_transcode.c filter.c and
+//                        the modules of ffmpeg_xcode/ it uses
+//      bench_compress.c  ffmpeg_xcode/compress_.c and its modules
+//      bench_xcode.c     ffmpeg_xcode/compress.c open_files.c and their
+//                        modules
+//
+//  and ffmpeg_xcode/mem_stats.c, built with MEM_STATS_INTERPOSE so it
+//  counts every allocation, alloc_stats.c and scaler_profile.c.
+//
+//  plus libavdevice for the lavfi input device.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+#include "mem_stats.h"
+#include "alloc_stats.h"
+#include "scaler_profile.h"
+#include "libavdevice/avdevice.h"
+#include "libavformat/avformat.h"
+#include "libavutil/avstring.h"
+#include "libavutil/parseutils.h"
+#include "libavutil/time.h"
+
+#define BENCH_MAX_RUNS 15
+#define BENCH_MAX_SCALERS 16
+
+/*
+ * Heap bytes per frame the leak check tolerates: muxers may keep index
+ * entries per packet until the output is closed.
+ */
+#define BENCH_LEAK_SLACK 256
+
+/* first soak samples, taken while the encoder fills its lookahead, left out of the trends */
+#define SOAK_WARMUP_SAMPLES 2
+
+typedef struct BenchCase {
+    const char *name;
+    int width;
+    int height;
+    int frame_rate;
+    int duration;           /* seconds */
+} BenchCase;
+
+/* raw inputs, the durations keep each one below ~300 MB */
+static const BenchCase bench_cases[] = {
+    { "240p25",   320,  240, 25, 20 },
+    { "480p30",   640,  480, 30, 10 },
+    { "720p30",  1280,  720, 30,  5 },
+    { "1080p30", 1920, 1080, 30,  3 },
+    { "1080p60", 1920, 1080, 60,  2 },
+};
+
+/* endless input of the soak test, written by a thread of its own */
+typedef struct SoakSource {
+    atomic_int stop;
+    atomic_int_least64_t nb_frames;     /* video frames handed to the pipeline */
+} SoakSource;
+
+typedef struct BenchResult {
+    int ret;
+    int64_t wall;           /* microseconds spent in the pipeline */
+    int64_t nb_allocs;      /* -1 when allocations are not counted */
+    int64_t nb_frame_allocs;    /* AVFrames allocated by the pipeline */
+    int64_t heap_growth;        /* heap left allocated by the run */
+    int64_t cpu;            /* user + system microseconds of the run */
+    long peak_rss_kb;
+} BenchResult;
+
+/*
+ * Render the case with lavfi and store it uncompressed in a NUT file.
+ * With a soak source the lavfi graph never ends, the frames are written
+ * until soak->stop is set.
+ */
+static int generate_input(const BenchCase *c, const char *filename, SoakSource *soak)
+{
+    AVInputFormat *lavfi = av_find_input_format("lavfi");
+    AVFormatContext *ic = NULL, *oc = NULL;
+    AVPacket pkt;
+    char graph[256];
+    int i, ret;
+
+    if (!lavfi) {
+        av_log(NULL, AV_LOG_ERROR, "The lavfi input device is not available.\n");
+        return AVERROR_DEMUXER_NOT_FOUND;
+    }
+    if (soak)
+        snprintf(graph, sizeof(graph),
+                 "testsrc2=size=%dx%d:rate=%d[out0];sine=frequency=440:sample_rate=48000[out1]",
+                 c->width, c->height, c->frame_rate);
+    else
+        snprintf(graph, sizeof(graph),
+                 "testsrc2=size=%dx%d:rate=%d:duration=%d[out0];"
+                 "sine=frequency=440:sample_rate=48000:duration=%d[out1]",
+                 c->width, c->height, c->frame_rate, c->duration, c->duration);
+    if ((ret = avformat_open_input(&ic, graph, lavfi, NULL)) < 0)
+        return ret;
+    if ((ret = avformat_find_stream_info(ic, NULL)) < 0)
+        goto end;
+    if ((ret = avformat_alloc_output_context2(&oc, NULL, "nut", filename)) < 0)
+        goto end;
+    for (i = 0; i < ic->nb_streams; i++) {
+        AVStream *st = avformat_new_stream(oc, NULL);
+
+        if (!st) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        if ((ret = avcodec_copy_context(st->codec, ic->streams[i]->codec)) < 0)
+            goto end;
+        st->codec->codec_tag = 0;
+        st->time_base        = ic->streams[i]->time_base;
+        st->avg_frame_rate   = ic->streams[i]->avg_frame_rate;
+    }
+    if ((ret = avio_open(&oc->pb, filename, AVIO_FLAG_WRITE)) < 0 ||
+        (ret = avformat_write_header(oc, NULL)) < 0)
+        goto end;
+    while ((!soak || !atomic_load(&soak->stop)) && (ret = av_read_frame(ic, &pkt)) >= 0) {
+        if (soak && ic->streams[pkt.stream_index]->codec->codec_type == AVMEDIA_TYPE_VIDEO)
+            atomic_fetch_add(&soak->nb_frames, 1);
+        av_packet_rescale_ts(&pkt, ic->streams[pkt.stream_index]->time_base,
+                             oc->streams[pkt.stream_index]->time_base);
+        pkt.pos = -1;
+        if ((ret = av_interleaved_write_frame(oc, &pkt)) < 0)
+            goto end;
+    }
+    ret = av_write_trailer(oc);
+
+end:
+    avformat_close_input(&ic);
+    if (oc) {
+        avio_closep(&oc->pb);
+        avformat_free_context(oc);
+    }
+    if (ret < 0)
+        av_log(NULL, AV_LOG_ERROR, "Could not generate %s: %s\n", filename, av_err2str(ret));
+    return ret;
+}
+
+/* Transcode once in a child process, so every run starts from a clean heap. */
+static int run_once(const char *input, const char *output, const BenchScale *scale, int verbose,
+                    BenchResult *result)
+{
+    struct rusage usage;
+    int fds[2], status;
+    pid_t pid;
+
+    memset(result, 0, sizeof(*result));
+    if (pipe(fds) < 0)
+        return AVERROR(errno);
+    fflush(stdout);
+    fflush(stderr);
+    if ((pid = fork()) < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return AVERROR(errno);
+    }
+    if (!pid) {
+        BenchResult r = { 0 };
+        int64_t allocs, heap, frames, t0;
+
+        close(fds[0]);
+        if (!verbose) {
+            /* the pipelines log per packet, keep that out of the timing and the JSON */
+            int null_fd = open("/dev/null", O_WRONLY);
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+        }
+        allocs = mem_stats_nb_allocs();
+        heap   = mem_stats_heap_live();
+        frames = alloc_stats_nb_frames();
+        t0     = av_gettime_relative();
+        r.ret  = bench_pipeline.run(input, output, scale);
+        r.wall = av_gettime_relative() - t0;
+        r.nb_allocs       = allocs < 0 ? -1 : mem_stats_nb_allocs() - allocs;
+        r.heap_growth     = heap < 0 ? 0 : mem_stats_heap_live() - heap;
+        r.nb_frame_allocs = alloc_stats_nb_frames() - frames;
+        if (write(fds[1], &r, sizeof(r)) != sizeof(r))
+            _exit(2);
+        _exit(r.ret < 0);
+    }
+
+    close(fds[1]);
+    if (read(fds[0], result, sizeof(*result)) != sizeof(*result))
+        result->ret = AVERROR_EXTERNAL;
+    close(fds[0]);
+    while (wait4(pid, &status, 0, &usage) < 0)
+        if (errno != EINTR)
+            return AVERROR(errno);
+    if (!WIFEXITED(status) && !result->ret)
+        result->ret = AVERROR_EXTERNAL;
+
+    result->cpu = usage.ru_utime.tv_sec * 1000000LL + usage.ru_utime.tv_usec +
+                  usage.ru_stime.tv_sec * 1000000LL + usage.ru_stime.tv_usec;
+#if defined(__APPLE__)
+    result->peak_rss_kb = usage.ru_maxrss / 1024;
+#else
+    result->peak_rss_kb = usage.ru_maxrss;
+#endif
+    return result->ret;
+}
+
+static int compare_wall(const void *a, const void *b)
+{
+    const BenchResult *ra = a, *rb = b;
+
+    return (ra->wall > rb->wall) - (ra->wall < rb->wall);
+}
+
+/*
+ * Count the renditions of ladder, remove the file of each when pattern,
+ * the output name with a %d for the height, is given.
+ */
+static int ladder_rungs(const char *ladder, const char *pattern)
+{
+    const char *height_pos = pattern ? strstr(pattern, "%d") : NULL;
+    int nb = 0;
+
+    for (const char *p = ladder; p; p = strchr(p, ','), p = p ? p + 1 : NULL) {
+        const char *x = strchr(p, 'x');
+        const char *end = strchr(p, ',');
+        int height = atoi(x && (!end || x < end) ? x + 1 : p);
+
+        if (height_pos) {
+            char *name = av_asprintf("%.*s%d%s", (int)(height_pos - pattern), pattern, height,
+                                     height_pos + 2);
+
+            if (name)
+                unlink(name);
+            av_free(name);
+        }
+        nb++;
+    }
+    return nb;
+}
+
+static void print_result(FILE *out, const BenchCase *c, const BenchScale *scale, int nb_runs,
+                         const BenchResult *r, int first)
+{
+    int64_t frames = (int64_t)c->frame_rate * c->duration;
+    double wall = r->wall / 1000000.0;
+
+    fprintf(out, "%s  {\"pipeline\": \"%s\", \"case\": \"%s\", \"width\": %d, \"height\": %d, "
+            "\"frame_rate\": %d, \"duration\": %d, \"frames\": %"PRId64", \"runs\": %d, ",
+            first ? "" : ",\n", bench_pipeline.name, c->name, c->width, c->height,
+            c->frame_rate, c->duration, frames, nb_runs);
+    if (scale->ladder)
+        fprintf(out, "\"ladder\": \"%s\", \"ladder_mode\": \"%s\", ", scale->ladder,
+                scale->ladder_split ? "split" : "cascade");
+    if (scale->scaler) {
+        char flags[64];
+
+        fprintf(out, "\"scaler\": \"%s\", \"scaler_flags\": \"%s\", \"scaled_width\": %d, "
+                "\"scaled_height\": %d, ", scale->scaler,
+                scaler_profile_flags(scale->scaler, c->width, c->height, scale->width, scale->height,
+                                     flags, sizeof(flags)), scale->width, scale->height);
+    }
+    if (r->ret < 0) {
+        fprintf(out, "\"error\": \"%s\"}", av_err2str(r->ret));
+        return;
+    }
+    fprintf(out, "\"wall_s\": %.3f, \"fps\": %.2f, \"realtime\": %.3f, \"cpu_s\": %.3f, "
+            "\"peak_rss_kb\": %ld, ",
+            wall, wall > 0 ? frames / wall : 0.0, wall > 0 ? c->duration / wall : 0.0,
+            r->cpu / 1000000.0, r->peak_rss_kb);
+    if (scale->ladder)
+        fprintf(out, "\"cpu_per_rung_s\": %.3f, ",
+                r->cpu / 1000000.0 / ladder_rungs(scale->ladder, NULL));
+    if (r->nb_allocs < 0)
+        fprintf(out, "\"allocs_per_frame\": null}");
+    else
+        fprintf(out, "\"allocs_per_frame\": %.1f}", frames ? (double)r->nb_allocs / frames : 0.0);
+}
+
+/*
+ * Transcode a short and a long input and check that nothing but the
+ * per-frame budget is allocated for the extra frames. Return 0 on success.
+ */
+static int check_allocs(const char *tmpdir, int verbose, FILE *out, double alloc_budget)
+{
+    static const BenchCase cases[2] = {
+        { "warmup", 320, 240, 25,  4 },     /* 100 frames */
+        { "check",  320, 240, 25, 40 },     /* 1000 frames */
+    };
+    BenchResult r[2];
+    double frames, allocs, frame_allocs, growth;
+    int ret = 0, failed;
+
+    for (int i = 0; i < 2 && ret >= 0; i++) {
+        char *input  = av_asprintf("%s/bench_%s.nut", tmpdir, cases[i].name);
+        char *result = av_asprintf("%s/bench_%s_%s.mp4", tmpdir, cases[i].name, bench_pipeline.name);
+
+        if (!input || !result)
+            ret = AVERROR(ENOMEM);
+        else if ((ret = generate_input(&cases[i], input, NULL)) >= 0)
+            ret = run_once(input, result, &(BenchScale){ 0 }, verbose, &r[i]);
+        if (input)
+            unlink(input);
+        if (result)
+            unlink(result);
+        av_free(input);
+        av_free(result);
+    }
+    if (ret < 0) {
+        fprintf(out, "{\"pipeline\": \"%s\", \"error\": \"%s\"}\n", bench_pipeline.name, av_err2str(ret));
+        return 1;
+    }
+
+    frames       = (cases[1].duration - cases[0].duration) * cases[0].frame_rate;
+    allocs       = (r[1].nb_allocs - r[0].nb_allocs) / frames;
+    frame_allocs = (r[1].nb_frame_allocs - r[0].nb_frame_allocs) / frames;
+    growth       = (r[1].heap_growth - r[0].heap_growth) / frames;
+    failed = frame_allocs > 0 || growth > BENCH_LEAK_SLACK ||
+             (alloc_budget >= 0 && r[0].nb_allocs >= 0 && allocs > alloc_budget);
+
+    fprintf(out, "{\"pipeline\": \"%s\", \"frame_allocs_per_frame\": %.3f, "
+            "\"leaked_bytes_per_frame\": %.1f, ", bench_pipeline.name, frame_allocs, growth);
+    if (r[0].nb_allocs < 0)
+        fprintf(out, "\"allocs_per_frame\": null, ");
+    else
+        fprintf(out, "\"allocs_per_frame\": %.2f, ", allocs);
+    fprintf(out, "\"passed\": %s}\n", failed ? "false" : "true");
+    return failed;
+}
+
+typedef struct SoakSample {
+    double time;            /* seconds since the start */
+    long rss_kb;
+    double fps;             /* over the interval up to time */
+    double allocs_per_frame;
+} SoakSample;
+
+typedef struct SoakJob {
+    const char *fifo;
+    const char *output;
+    SoakSource source;
+    atomic_int done;
+    int ret;
+} SoakJob;
+
+static const BenchCase soak_case = { "soak", 320, 240, 25, 0 };
+
+/* Resident set size now; the peak where the current size is not available. */
+static long current_rss_kb(void)
+{
+#if defined(__linux__)
+    FILE *f = fopen("/proc/self/statm", "r");
+    long pages = 0, rss = 0;
+
+    if (f) {
+        if (fscanf(f, "%ld %ld", &pages, &rss) != 2)
+            rss = 0;
+        fclose(f);
+        return rss * (sysconf(_SC_PAGESIZE) / 1024);
+    }
+#endif
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+static void *soak_source_thread(void *arg)
+{
+    SoakJob *job = arg;
+    int ret = generate_input(&soak_case, job->fifo, &job->source);
+
+    /* a pipeline that stops reading closes the FIFO, the writes then fail */
+    if (ret < 0 && !atomic_load(&job->source.stop))
+        av_log(NULL, AV_LOG_ERROR, "The soak source stopped early: %s\n", av_err2str(ret));
+    return NULL;
+}
+
+static void *soak_pipeline_thread(void *arg)
+{
+    SoakJob *job = arg;
+
+    job->ret = bench_pipeline.run(job->fifo, job->output, &(BenchScale){ 0 });
+    atomic_store(&job->done, 1);
+    return NULL;
+}
+
+/* Least squares slope of the RSS in kB per second over samples. */
+static double rss_slope(const SoakSample *samples, int nb_samples)
+{
+    double mt = 0, mr = 0, num = 0, den = 0;
+
+    for (int i = 0; i < nb_samples; i++) {
+        mt += samples[i].time / nb_samples;
+        mr += (double)samples[i].rss_kb / nb_samples;
+    }
+    for (int i = 0; i < nb_samples; i++) {
+        num += (samples[i].time - mt) * (samples[i].rss_kb - mr);
+        den += (samples[i].time - mt) * (samples[i].time - mt);
+    }
+    return den > 0 ? num / den : 0;
+}
+
+static double mean_fps(const SoakSample *samples, int nb_samples)
+{
+    double sum = 0;
+
+    for (int i = 0; i < nb_samples; i++)
+        sum += samples[i].fps;
+    return nb_samples ? sum / nb_samples : 0;
+}
+
+/*
+ * Transcode the endless source for duration seconds and check that RSS
+ * and frame rate stay flat after the warmup. Return 0 on success.
+ */
+static int soak(const char *tmpdir, int verbose, FILE *out, int duration, int interval,
+                double max_rss_drift, double max_fps_decay)
+{
+    SoakSample *samples;
+    SoakJob job = { 0 };
+    pthread_t source_tid, pipeline_tid;
+    int64_t start, next, prev_frames = 0, prev_allocs = mem_stats_nb_allocs();
+    double prev_time = 0, drift = 0, decay = 0, slope, fps_start, fps_end;
+    int nb_samples = 0, max_samples = duration / interval + 2, nb_trend, third, failed, fd;
+
+    if (!(samples = av_malloc_array(max_samples, sizeof(*samples))))
+        return 1;
+    job.fifo   = av_asprintf("%s/bench_soak_%d.nut", tmpdir, (int)getpid());
+    /* mpegts keeps no index in memory, unlike mp4 */
+    job.output = av_asprintf("%s/bench_soak_%s.ts", tmpdir, bench_pipeline.name);
+    if (!job.fifo || !job.output || mkfifo(job.fifo, 0600) < 0) {
+        fprintf(out, "{\"pipeline\": \"%s\", \"error\": \"Could not create the FIFO\"}\n",
+                bench_pipeline.name);
+        failed = 1;
+        goto end;
+    }
+    /* writes to the FIFO fail instead of killing the benchmark when the pipeline is gone */
+    signal(SIGPIPE, SIG_IGN);
+    if (!verbose) {
+        /* the progress lines of the pipelines would mix with the samples */
+        int null_fd = open("/dev/null", O_WRONLY);
+
+        if (out == stdout && (fd = dup(STDOUT_FILENO)) >= 0)
+            out = fdopen(fd, "w");
+        fflush(stdout);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+    }
+
+    start = next = av_gettime_relative();
+    pthread_create(&source_tid, NULL, soak_source_thread, &job);
+    pthread_create(&pipeline_tid, NULL, soak_pipeline_thread, &job);
+    while (!atomic_load(&job.done)) {
+        int64_t now = av_gettime_relative(), frames, allocs;
+        SoakSample *sample;
+
+        /* past the end only the frames in flight are left, they would read as a decay */
+        if (now >= start + duration * 1000000LL || nb_samples == max_samples) {
+            atomic_store(&job.source.stop, 1);
+            av_usleep(100000);
+            continue;
+        }
+        if (now < next) {
+            av_usleep(FFMIN(next - now, 100000));
+            continue;
+        }
+        next  += interval * 1000000LL;
+        frames = atomic_load(&job.source.nb_frames);
+        allocs = mem_stats_nb_allocs();
+
+        sample = &samples[nb_samples++];
+        sample->time   = (now - start) / 1000000.0;
+        sample->rss_kb = current_rss_kb();
+        sample->fps    = sample->time > prev_time ? (frames - prev_frames) / (sample->time - prev_time) : 0;
+        sample->allocs_per_frame = allocs < 0 || frames == prev_frames ? -1 :
+                                   (double)(allocs - prev_allocs) / (frames - prev_frames);
+        fprintf(out, "{\"pipeline\": \"%s\", \"time_s\": %.1f, \"frames\": %"PRId64", "
+                "\"rss_kb\": %ld, \"fps\": %.2f, ", bench_pipeline.name, sample->time, frames,
+                sample->rss_kb, sample->fps);
+        if (sample->allocs_per_frame < 0)
+            fprintf(out, "\"allocs_per_frame\": null}\n");
+        else
+            fprintf(out, "\"allocs_per_frame\": %.1f}\n", sample->allocs_per_frame);
+        fflush(out);
+        prev_time   = sample->time;
+        prev_frames = frames;
+        prev_allocs = allocs;
+    }
+    atomic_store(&job.source.stop, 1);
+    /* a pipeline that failed before opening its input leaves the source waiting for a reader */
+    if ((fd = open(job.fifo, O_RDONLY | O_NONBLOCK)) >= 0)
+        close(fd);
+    pthread_join(pipeline_tid, NULL);
+    pthread_join(source_tid, NULL);
+
+    if (job.ret < 0) {
+        fprintf(out, "{\"pipeline\": \"%s\", \"error\": \"%s\"}\n", bench_pipeline.name,
+                av_err2str(job.ret));
+        failed = 1;
+        goto end;
+    }
+    nb_trend = nb_samples - SOAK_WARMUP_SAMPLES;
+    if (nb_trend < 3) {
+        fprintf(out, "{\"pipeline\": \"%s\", \"error\": \"%d samples are too few, "
+                "run longer or sample more often\"}\n", bench_pipeline.name, nb_samples);
+        failed = 1;
+        goto end;
+    }
+    slope     = rss_slope(samples + SOAK_WARMUP_SAMPLES, nb_trend);
+    drift     = 100 * slope * (samples[nb_samples - 1].time - samples[SOAK_WARMUP_SAMPLES].time) /
+                samples[SOAK_WARMUP_SAMPLES].rss_kb;
+    third     = FFMAX(nb_trend / 3, 1);
+    fps_start = mean_fps(samples + SOAK_WARMUP_SAMPLES, third);
+    fps_end   = mean_fps(samples + nb_samples - third, third);
+    decay     = fps_start > 0 ? 100 * (1 - fps_end / fps_start) : 0;
+    failed    = drift > max_rss_drift || decay > max_fps_decay;
+
+    fprintf(out, "{\"pipeline\": \"%s\", \"soak_s\": %.1f, \"samples\": %d, "
+            "\"rss_start_kb\": %ld, \"rss_end_kb\": %ld, \"rss_kb_per_hour\": %.0f, "
+            "\"rss_drift_pct\": %.2f, \"fps_start\": %.2f, \"fps_end\": %.2f, "
+            "\"fps_decay_pct\": %.2f, \"passed\": %s}\n", bench_pipeline.name,
+            samples[nb_samples - 1].time, nb_samples, samples[SOAK_WARMUP_SAMPLES].rss_kb,
+            samples[nb_samples - 1].rss_kb, slope * 3600, drift, fps_start, fps_end, decay,
+            failed ? "false" : "true");
+
+end:
+    if (job.fifo)
+        unlink(job.fifo);
+    if (job.output)
+        unlink(job.output);
+    av_free((char *) job.fifo);
+    av_free((char *) job.output);
+    av_free(samples);
+    if (out != stdout)
+        fclose(out);
+    return failed;
+}
+
+static void show_usage(const char *program_name)
+{
+    fprintf(stderr, "usage: %s [-runs n] [-case name] [-tmpdir dir] [-o results.json] [-v]\n"
+                    "       %s -check_allocs [-alloc_budget allocations_per_frame] [-tmpdir dir] [-v]\n"
+                    "       %s -scalers profile,profile,... [-scale_to WxH] [-runs n] [-case name]\n"
+                    "          [-tmpdir dir] [-o results.json] [-v]\n"
+                    "       %s -soak seconds [-soak_interval seconds] [-max_rss_drift percent]\n"
+                    "          [-max_fps_decay percent] [-tmpdir dir] [-o samples.json] [-v]\n"
+                    "       %s -ladder heights [-scalers profile,...] [-runs n] [-case name]\n"
+                    "          [-tmpdir dir] [-o results.json] [-v]\n"
+                    "cases:", program_name, program_name, program_name, program_name, program_name);
+    for (int i = 0; i < FF_ARRAY_ELEMS(bench_cases); i++)
+        fprintf(stderr, " %s", bench_cases[i].name);
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *tmpdir = "/tmp", *only_case = NULL, *output = NULL;
+    int nb_runs = 3, verbose = 0, first = 1, nb_failed = 0, check = 0;
+    int soak_duration = 0, soak_interval = 5;
+    double alloc_budget = -1, max_rss_drift = 10, max_fps_decay = 10;
+    char *scalers[BENCH_MAX_SCALERS] = { NULL }, *scaler_list = NULL, *saveptr = NULL;
+    const char *ladder = NULL;
+    int nb_scalers = 0, scale_width = 0, scale_height = 0;
+    FILE *out = stdout;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-runs") && i + 1 < argc)
+            nb_runs = av_clip(atoi(argv[++i]), 1, BENCH_MAX_RUNS);
+        else if (!strcmp(argv[i], "-case") && i + 1 < argc)
+            only_case = argv[++i];
+        else if (!strcmp(argv[i], "-tmpdir") && i + 1 < argc)
+            tmpdir = argv[++i];
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            output = argv[++i];
+        else if (!strcmp(argv[i], "-v"))
+            verbose = 1;
+        else if (!strcmp(argv[i], "-check_allocs"))
+            check = 1;
+        else if (!strcmp(argv[i], "-alloc_budget") && i + 1 < argc)
+            alloc_budget = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-soak") && i + 1 < argc)
+            soak_duration = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-soak_interval") && i + 1 < argc)
+            soak_interval = FFMAX(atoi(argv[++i]), 1);
+        else if (!strcmp(argv[i], "-max_rss_drift") && i + 1 < argc)
+            max_rss_drift = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-max_fps_decay") && i + 1 < argc)
+            max_fps_decay = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-scalers") && i + 1 < argc)
+            scaler_list = argv[++i];
+        else if (!strcmp(argv[i], "-ladder") && i + 1 < argc)
+            ladder = argv[++i];
+        else if (!strcmp(argv[i], "-scale_to") && i + 1 < argc &&
+                 av_parse_video_size(&scale_width, &scale_height, argv[i + 1]) >= 0)
+            i++;
+        else {
+            show_usage(argv[0]);
+            return 1;
+        }
+    }
+    for (char *p = av_strtok(scaler_list, ",", &saveptr); p && nb_scalers < BENCH_MAX_SCALERS;
+         p = av_strtok(NULL, ",", &saveptr)) {
+        if (scaler_profile_check(p) < 0)
+            return 1;
+        scalers[nb_scalers++] = p;
+    }
+    if (output && !(out = fopen(output, "w"))) {
+        fprintf(stderr, "Could not open %s: %s\n", output, strerror(errno));
+        return 1;
+    }
+
+    av_register_all();
+    avdevice_register_all();
+    avfilter_register_all();
+    av_log_set_level(verbose ? AV_LOG_INFO : AV_LOG_ERROR);
+
+    if (soak_duration > 0)
+        return soak(tmpdir, verbose, out, soak_duration, soak_interval, max_rss_drift, max_fps_decay);
+    if (check) {
+        nb_failed = check_allocs(tmpdir, verbose, out, alloc_budget);
+        if (out != stdout)
+            fclose(out);
+        return nb_failed;
+    }
+
+    fprintf(out, "[\n");
+    for (int i = 0; i < FF_ARRAY_ELEMS(bench_cases); i++) {
+        const BenchCase *c = &bench_cases[i];
+        BenchResult runs[BENCH_MAX_RUNS];
+        char *input, *result;
+        int n;
+
+        if (only_case && strcmp(only_case, c->name))
+            continue;
+        input  = av_asprintf("%s/bench_%s.nut", tmpdir, c->name);
+        /* the ladder names each rendition by its height in place of the %d */
+        result = av_asprintf(ladder ? "%s/bench_%s_%s_%%d.mp4" : "%s/bench_%s_%s.mp4",
+                             tmpdir, c->name, bench_pipeline.name);
+        if (!input || !result || generate_input(c, input, NULL) < 0) {
+            av_free(input);
+            av_free(result);
+            nb_failed++;
+            continue;
+        }
+
+        /*
+         * without -scalers, one pass at the input size with the default
+         * scaler, -ladder doubles the passes for its split and cascade modes
+         */
+        for (int pass = 0; pass < FFMAX(nb_scalers, 1) * (ladder ? 2 : 1); pass++) {
+            BenchScale scale = { 0 };
+            int s = ladder ? pass / 2 : pass;
+
+            if (ladder) {
+                /* the ladder sets the sizes */
+                scale.ladder       = ladder;
+                scale.ladder_split = !(pass & 1);
+                scale.scaler       = scalers[s];
+            } else if (nb_scalers) {
+                scale.scaler = scalers[s];
+                scale.width  = scale_width  > 0 ? scale_width  : c->width  / 4 * 2;
+                scale.height = scale_height > 0 ? scale_height : c->height / 4 * 2;
+            }
+            for (n = 0; n < nb_runs; n++) {
+                fprintf(stderr, "%s %s%s%s%s run %d/%d\n", bench_pipeline.name, c->name,
+                        scale.scaler ? " " : "", scale.scaler ? scale.scaler : "",
+                        !ladder ? "" : scale.ladder_split ? " split" : " cascade", n + 1, nb_runs);
+                if (run_once(input, result, &scale, verbose, &runs[n]) < 0)
+                    break;
+            }
+            if (n < nb_runs) {
+                /* report the failed run */
+                runs[0] = runs[n];
+                nb_failed++;
+            } else {
+                qsort(runs, nb_runs, sizeof(*runs), compare_wall);
+                runs[0] = runs[nb_runs / 2];
+            }
+            print_result(out, c, &scale, nb_runs, &runs[0], first);
+            fflush(out);
+            first = 0;
+        }
+
+        unlink(input);
+        if (ladder)
+            ladder_rungs(ladder, result);
+        else
+            unlink(result);
+        av_free(input);
+        av_free(result);
+    }
+    fprintf(out, "\n]\n");
+    if (out != stdout)
+        fclose(out);
+    return nb_failed != 0;
+}
@@ -0,0 +1,36 @@
+//
+//  bench.h
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#ifndef bench_h
+#define bench_h
+
+#include <stdio.h>
+
+/* Resize done by a benchmark run. */
+typedef struct BenchScale {
+    int width;              /* <= 0 keeps the input size */
+    int height;
+    const char *scaler;     /* scaler profile, NULL for the pipeline's default */
+    const char *ladder;     /* renditions of an ABR ladder instead of one output */
+    int ladder_split;       /* scale every rendition from the input, not cascaded */
+} BenchScale;
+
+/*
+ * One transcoding pipeline under test. The transcoders keep their state
+ * in globals with clashing names, so every pipeline is linked into a
+ * benchmark executable of its own together with bench.c.
+ */
+typedef struct BenchPipeline {
+    const char *name;
+    /* transcode input to output with the pipeline's default settings but scale */
+    int (*run)(const char *input, const char *output, const BenchScale *scale);
+} BenchPipeline;
+
+extern const BenchPipeline bench_pipeline;
+
+#endif /* bench_h */
@@ -0,0 +1,27 @@
+//
+//  bench_compress.c
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#include "bench.h"
+#include "compress_.h"
+
+static int run_compress(const char *input, const char *output, const BenchScale *scale)
+{
+    int ret;
+
+    if (scale->ladder)
+        return AVERROR(ENOSYS);
+    scaler_profile = scale->scaler;
+    /* open_files() releases everything itself when it fails */
+    if ((ret = open_files(input, output, scale->width, scale->height)) < 0)
+        return ret;
+    ret = transcode();
+    release();
+    return ret;
+}
+
+const BenchPipeline bench_pipeline = { "compress", run_compress };
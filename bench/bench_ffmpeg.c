@@ -0,0 +1,32 @@
+//
+//  bench_ffmpeg.c
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#include "bench.h"
+#include "ffmpeg_opt.h"
+
+static int run_ffmpeg_transcode(const char *input, const char *output, const BenchScale *scale)
+{
+    BatchJob job = {
+        .input      = (char *) input,
+        .output     = (char *) output,
+        .width      = scale->width,
+        .height     = scale->height,
+        .scaler     = (char *) scale->scaler,
+        .start_time = AV_NOPTS_VALUE,
+        .stop_time  = AV_NOPTS_VALUE,
+    };
+
+    ladder_opt   = scale->ladder;
+    ladder_split = scale->ladder_split;
+    av_register_all();
+    avcodec_register_all();
+    avfilter_register_all();
+    return ffmpeg_run_job(&job, NULL);
+}
+
+const BenchPipeline bench_pipeline = { "ffmpeg_transcode", run_ffmpeg_transcode };
@@ -0,0 +1,23 @@
+//
+//  bench_xcode.c
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#include "bench.h"
+#include "open_files.h"
+#include "compress.h"
+
+static int run_xcode(const char *input, const char *output, const BenchScale *scale)
+{
+    if (scale->ladder)
+        return AVERROR(ENOSYS);
+    scaler_profile = scale->scaler;
+    if (open_files(input, output, scale->width, scale->height, NULL) != NONE)
+        return AVERROR(EINVAL);
+    return transcode();
+}
+
+const BenchPipeline bench_pipeline = { "compress_xcode", run_xcode };
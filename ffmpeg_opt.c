@@ -0,0 +1,622 @@
+//
+//  ffmpeg_opt.c
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/2/25.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "ffmpeg_opt.h"
+#include "ffmpeg_transcode.h"
+#include "filter.h"
+#include "libavutil/avstring.h"
+#include "progress.h"
+#include "metrics.h"
+#include "scaler_profile.h"
+
+InputStream **input_streams = NULL;
+int        nb_input_streams = 0;
+InputFile   **input_files   = NULL;
+int        nb_input_files   = 0;
+
+OutputStream **output_streams = NULL;
+int         nb_output_streams = 0;
+OutputFile   **output_files   = NULL;
+int         nb_output_files   = 0;
+
+FilterGraph **filtergraphs = NULL;
+int        nb_filtergraphs = 0;
+
+int pipeline_mode = 0;
+int do_pkt_dump = 0;
+int64_t stats_period = PROGRESS_DEFAULT_PERIOD;
+const char *metrics_path = NULL;
+int64_t metrics_period = METRICS_DEFAULT_PERIOD;
+size_t mux_queue_size = MUX_QUEUE_DEFAULT_SIZE;
+int auto_copy = 0;
+const char *audio_codec_opt = NULL;
+const char *scaler_opt = NULL;
+const char *ladder_opt = NULL;
+int ladder_split = 0;
+
+/* settings of the job being opened, "copy" muxes without re-encoding */
+static const char *video_codec_name = "libx264";
+static const char *audio_codec_name = "aac";
+static char video_filter_desc[128] = "null";
+static int video_width, video_height;   /* <= 0 keeps the input size */
+static const char *scaler_profile = SCALER_PROFILE_DEFAULT;
+static int64_t input_start_time = AV_NOPTS_VALUE;
+static int64_t input_stop_time  = AV_NOPTS_VALUE;
+
+void *grow_array(void *array, int elem_size, int *size, int new_size)
+{
+    if (new_size >= INT_MAX / elem_size) {
+        av_log(NULL, AV_LOG_ERROR, "Array too big.\n");
+        return NULL;
+    }
+    if (*size < new_size) {
+        uint8_t *tmp = av_realloc_array(array, new_size, elem_size);
+        if (!tmp) {
+            av_log(NULL, AV_LOG_ERROR, "Could not alloc buffer.\n");
+            return NULL;
+        }
+        memset(tmp + *size*elem_size, 0, (new_size-*size) * elem_size);
+        *size = new_size;
+        return tmp;
+    }
+    return array;
+}
+
+static int add_input_streams(AVFormatContext *ic) {
+    int ret = 0;
+    for (int i =0 ; i < ic->nb_streams; i++) {
+        AVStream *st = ic->streams[i];
+        AVCodecContext *dec = st->codec;
+        InputStream *ist = av_mallocz(sizeof(*ist));
+        if (!ist) {
+            av_log(NULL, AV_LOG_ERROR, "Could not alloc input stream.\n");
+            return AVERROR(ENOMEM);
+        }
+        GROW_ARRAY(input_streams, nb_input_streams);
+        input_streams[nb_input_streams - 1] = ist;
+        ist->st = st;
+        ist->file_index = nb_input_files;
+        ist->dec = avcodec_find_decoder(st->codec->codec_id);
+        ist->dec_ctx = avcodec_alloc_context3(ist->dec);
+        ret = avcodec_copy_context(ist->dec_ctx, dec);
+        if (ret < 0) {
+            av_err2str(ret);
+            return ret;
+        }
+//        ist->user_set_discard = AVDISCARD_NONE;
+        if (!ist->dec_ctx) {
+            av_log(NULL, AV_LOG_ERROR, "Could not alloc input AVCodecContext.\n");
+            av_free(ist);
+            avcodec_close(ist->dec_ctx);
+            return AVERROR(ENOMEM);
+        }
+        switch (dec->codec_type) {
+            case AVMEDIA_TYPE_VIDEO:
+                if (!ist->dec) {
+                    ist->dec = avcodec_find_decoder(dec->codec_id);
+                }
+                ist->resample_height = ist->dec_ctx->height;
+                ist->resample_width= ist->dec_ctx->width;
+                ist->resample_pix_fmt = ist->dec_ctx->pix_fmt;
+                break;
+
+            case AVMEDIA_TYPE_AUDIO:
+                ist->resample_sample_fmt = ist->dec_ctx->sample_fmt;
+                ist->resample_sample_rate = ist->dec_ctx->sample_rate;
+                ist->resample_channels = ist->dec_ctx->channels;
+                guess_input_channel_layout(ist);
+                ist->resample_channel_layout = ist->dec_ctx->channel_layout;
+                break;
+            default:
+                break;
+        }
+    }
+    return ret;
+}
+
+static int decode_interrupt_cb(void *ctx) {
+    return received_nb_signals > transcode_init_done;
+}
+
+const AVIOInterruptCB int_cb_1 = { decode_interrupt_cb, NULL };
+
+static int open_input_file(const char *filename) {
+    int ret;
+    AVInputFormat *file_iformat = NULL;
+    AVFormatContext *ic = avformat_alloc_context();
+    if (!ic) {
+        av_log(NULL, AV_LOG_ERROR, "Could not alloc input format context.\n");
+        return AVERROR(ENOMEM);
+    }
+    ic->flags |= AVFMT_FLAG_NONBLOCK;
+    ic->interrupt_callback = int_cb_1;
+
+    ret = avformat_open_input(&ic, filename, file_iformat, NULL);
+    if (ret < 0) {
+        av_err2str(ret);
+        if (ic->nb_streams == 0) {
+            avformat_close_input(&ic);
+        }
+        avformat_free_context(ic);
+        return ret;
+    }
+
+    ret = avformat_find_stream_info(ic, NULL);
+    if (ret < 0) {
+        av_err2str(ret);
+        if (ic->nb_streams == 0) {
+            avformat_close_input(&ic);
+            avformat_free_context(ic);
+            return ret;
+        }
+    }
+
+    if (input_start_time != AV_NOPTS_VALUE) {
+        /* the start of a segment is a keyframe, the seek lands on it */
+        ret = avformat_seek_file(ic, -1, INT64_MIN, input_start_time, input_start_time, 0);
+        if (ret < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Could not seek %s to %"PRId64".\n", filename, input_start_time);
+            avformat_close_input(&ic);
+            return ret;
+        }
+    }
+
+    add_input_streams(ic);
+
+    av_dump_format(ic, nb_input_files, filename, 0);
+    GROW_ARRAY(input_files, nb_input_files);
+    InputFile *f = av_mallocz(sizeof(*f));
+    if (!f) {
+        av_log(NULL, AV_LOG_ERROR, "Could not alloc InputFile.\n");
+        avformat_close_input(&ic);
+        avformat_free_context(ic);
+        return AVERROR(ENOMEM);
+    }
+    input_files[nb_input_files - 1] = f;
+    f->ctx = ic;
+    f->ist_index = nb_input_streams - ic->nb_streams;
+//    f->ts_offset = 0;
+//    f->duration = 0;
+    f->nb_streams = ic->nb_streams;
+    f->thread_queue_size = 8;
+    f->start_time = input_start_time;
+    f->stop_time = input_stop_time;
+    f->time_base = (AVRational) { 1, 1 };
+    return ret;
+}
+
+static OutputStream *new_output_stream(AVFormatContext *oc, enum AVMediaType type, char *codec_name, int source_index) {
+    OutputStream *ost;
+    AVStream *st = avformat_new_stream(oc, NULL);
+    int idx = oc->nb_streams - 1;
+    if (!st) {
+        av_log(NULL, AV_LOG_ERROR, "Could not new Output Stream.\n");
+        return NULL;
+    }
+    GROW_ARRAY(output_streams, nb_output_streams);
+    if (!(ost = av_mallocz(sizeof(*ost)))) {
+        av_log(NULL, AV_LOG_ERROR, "Could not alloc OutputStream.\n");
+        return NULL;
+    }
+    output_streams[nb_output_streams - 1] = ost;
+    ost->file_index = nb_output_files - 1;
+    ost->index = idx;
+    ost->st = st;
+    st->codec->codec_type = type;
+    ost->stream_copy = !strcmp(codec_name, "copy");
+    if (!ost->stream_copy && !(ost->enc = avcodec_find_encoder_by_name(codec_name))) {
+        av_log(NULL, AV_LOG_ERROR, "Could not find encoder by name %s.\n", codec_name);
+        return NULL;
+    }
+    ost->enc_ctx = avcodec_alloc_context3(ost->enc);
+    if (!ost->enc_ctx) {
+        av_log(NULL, AV_LOG_ERROR, "Could not alloc Output AVCodecContext.\n");
+        return NULL;
+    }
+    ost->enc_ctx->codec_type = type;
+    int ret = av_dict_set(&ost->encoder_opts, "strict", "-2", 0);
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Could not dict set strict value -2.\n");
+        return NULL;
+    }
+    ost->max_frames = INT64_MAX;
+    if (oc->oformat->flags & AVFMT_GLOBALHEADER) {
+        ost->enc_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+    ost->source_index = source_index;
+    if (source_index >= 0) {
+        ost->sync_list = input_streams[source_index];
+        input_streams[source_index]->discard = 0;
+        input_streams[source_index]->st->discard = input_streams[source_index]->user_set_discard;
+    }
+    ost->last_mux_dts = AV_NOPTS_VALUE;
+    return ost;
+}
+
+/**
+ * Bitstream filter the copied packets of the input stream need to fit the
+ * container of oc: "" when they fit as they are, NULL when they cannot be
+ * copied there at all.
+ */
+static const char *copy_bitstream_filter(AVFormatContext *oc, int source_index) {
+    AVCodecContext *par = input_streams[source_index]->st->codec;
+    int global_header = oc->oformat->flags & AVFMT_GLOBALHEADER;
+    int annexb = par->extradata_size >= 4 && !par->extradata[0] && !par->extradata[1] &&
+                 (par->extradata[2] == 1 || (!par->extradata[2] && par->extradata[3] == 1));
+
+    switch (par->codec_id) {
+    case AV_CODEC_ID_AAC:
+        /* ADTS (MPEG-TS, raw .aac) repeats the configuration in every packet instead of extradata */
+        if (global_header && !par->extradata_size)
+            return "aac_adtstoasc";
+        break;
+    case AV_CODEC_ID_H264:
+    case AV_CODEC_ID_HEVC:
+        /* MP4 style length prefixed samples, MPEG-TS wants start codes */
+        if (!strcmp(oc->oformat->name, "mpegts") && par->extradata_size && !annexb)
+            return par->codec_id == AV_CODEC_ID_H264 ? "h264_mp4toannexb" : "hevc_mp4toannexb";
+        /* the MP4 muxers convert Annex B samples themselves, but only with the parameter sets */
+        if (global_header && !par->extradata_size)
+            return NULL;
+        break;
+    default:
+        break;
+    }
+    return "";
+}
+
+/**
+ * Resolve the codec name "auto": copy the stream when the container can
+ * store the input codec, after the bitstream filter put in *bsf if any,
+ * and no filtering was asked for, otherwise encode with the fallback
+ * encoder.
+ */
+static const char *resolve_codec_name(AVFormatContext *oc, const char *codec_name, const char *fallback,
+                                      int source_index, int filtered, const char **bsf) {
+    enum AVCodecID codec_id = input_streams[source_index]->st->codec->codec_id;
+
+    *bsf = NULL;
+    if (!strcmp(codec_name, "copy")) {
+        if (!(*bsf = copy_bitstream_filter(oc, source_index)))
+            av_log(NULL, AV_LOG_WARNING, "The %s packets of stream #%d may not fit %s as they are.\n",
+                   avcodec_get_name(codec_id), source_index, oc->oformat->name);
+        return codec_name;
+    }
+    if (strcmp(codec_name, "auto")) {
+        return codec_name;
+    }
+    if (!filtered && avformat_query_codec(oc->oformat, codec_id, FF_COMPLIANCE_NORMAL) == 1 &&
+        (*bsf = copy_bitstream_filter(oc, source_index))) {
+        av_log(NULL, AV_LOG_VERBOSE, "Copying %s stream #%d%s%s.\n", avcodec_get_name(codec_id),
+               source_index, **bsf ? " through " : "", *bsf);
+        return "copy";
+    }
+    return fallback;
+}
+
+static int init_copy_bitstream_filter(OutputStream *ost, const char *bsf) {
+    if (!ost->stream_copy || !bsf || !*bsf)
+        return 0;
+    if (!(ost->bitstream_filters = av_bitstream_filter_init(bsf))) {
+        av_log(NULL, AV_LOG_ERROR, "Could not open the bitstream filter %s.\n", bsf);
+        return AVERROR(EINVAL);
+    }
+    return 0;
+}
+
+static int new_video_stream(AVFormatContext *oc, int source_index) {
+    int ret = 0;
+    int filtered = video_width > 0 && video_height > 0;
+    const char *bsf;
+    const char *codec_name = resolve_codec_name(oc, video_codec_name, "libx264", source_index, filtered, &bsf);
+    OutputStream *ost = new_output_stream(oc, AVMEDIA_TYPE_VIDEO, (char *) codec_name, source_index);
+    if (ost == NULL) {
+        return AVERROR(ENOMEM);
+    }
+    if ((ret = init_copy_bitstream_filter(ost, bsf)) < 0)
+        return ret;
+
+    AVStream *st = ost->st;
+    AVCodecContext *video_enc = ost->enc_ctx;
+    AVCodecContext *dec = input_streams[source_index]->dec_ctx;
+    char flags[64];
+
+    if (filtered)
+        snprintf(video_filter_desc, sizeof(video_filter_desc), "scale=%d:%d:flags=%s",
+                 video_width, video_height,
+                 scaler_profile_flags(scaler_profile, dec->width, dec->height,
+                                      video_width, video_height, flags, sizeof(flags)));
+    else
+        snprintf(video_filter_desc, sizeof(video_filter_desc), "null");
+//    if (av_parse_video_size(&video_enc->width, &video_enc->height, "640x320") < 0) {
+//        av_log(NULL, AV_LOG_ERROR, "Could not parse video size %s.\n", "640x320");
+//        av_err2str(ret);
+//        return ret;
+//    }
+    st->sample_aspect_ratio = video_enc->sample_aspect_ratio;
+    if (ost->stream_copy) {
+        if (filtered) {
+            av_log(NULL, AV_LOG_WARNING, "Stream copy ignores %s.\n", video_filter_desc);
+        }
+        return ret;
+    }
+    ost->avfilter = video_filter_desc;
+    ost->scaler_profile = scaler_profile;
+    return ret;
+}
+
+static int new_audio_stream(AVFormatContext *oc, int source_index) {
+    int ret = 0;
+    const char *bsf;
+    const char *codec_name = resolve_codec_name(oc, audio_codec_name, "aac", source_index, 0, &bsf);
+    OutputStream *ost = new_output_stream(oc, AVMEDIA_TYPE_AUDIO, (char *) codec_name, source_index);
+    if (ost == NULL) {
+        return AVERROR(ENOMEM);
+    }
+    if ((ret = init_copy_bitstream_filter(ost, bsf)) < 0)
+        return ret;
+    AVStream *st = ost->st;
+    AVCodecContext *audio_enc = ost->enc_ctx;
+    audio_enc->codec_type = AVMEDIA_TYPE_AUDIO;
+    if (ost->stream_copy) {
+        return ret;
+    }
+    ost->avfilter = st->codec->codec_type == AVMEDIA_TYPE_VIDEO ? "null" : "anull";
+    return ret;
+}
+
+static int open_output_file(const char *filename) {
+    int ret;
+    GROW_ARRAY(output_files, nb_output_files);
+    OutputFile *of = av_mallocz(sizeof(*of));
+    if (!of) {
+        av_log(NULL, AV_LOG_ERROR, "Could not alloc OutputFile.\n");
+        return AVERROR(ENOMEM);
+    }
+    of->ost_index = nb_output_streams;
+    of->recording_time = INT64_MAX;
+    of->start_time = INT64_MIN;
+    of->limit_filesize = UINT64_MAX;
+    of->shortest = 0;
+    of->mux_queue_size = mux_queue_size;
+    ret = av_dict_set(&of->opts, "strict", "-2", 0);
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Could not set dict.\n");
+        av_free(of);
+        return AVERROR(ENOMEM);
+    }
+    AVFormatContext *oc = avformat_alloc_context();
+    ret = avformat_alloc_output_context2(&oc, NULL, NULL, filename);
+    if (ret < 0) {
+        av_err2str(ret);
+        avformat_free_context(oc);
+        return ret;
+    }
+    of->ctx = oc;
+    output_files[nb_output_files - 1] = of;
+    InputStream *ist;
+    AVOutputFormat *file_oformat = oc->oformat;
+    if (av_guess_codec(file_oformat, NULL, filename, NULL, AVMEDIA_TYPE_VIDEO) != AV_CODEC_ID_NONE) {
+        int area = 0, idx = -1;
+        int qcr = avformat_query_codec(oc->oformat, oc->oformat->video_codec, 0);
+        for (int i = 0; i < nb_input_streams; i++) {
+            int new_area;
+            ist = input_streams[i];
+            new_area = ist->st->codec->width * ist->st->codec->height + 100000000*!!ist->st->codec_info_nb_frames;
+            if((qcr!=MKTAG('A', 'P', 'I', 'C')) && (ist->st->disposition & AV_DISPOSITION_ATTACHED_PIC))
+                new_area = 1;
+            if (ist->st->codec->codec_type == AVMEDIA_TYPE_VIDEO &&
+                new_area > area) {
+                if((qcr==MKTAG('A', 'P', 'I', 'C')) && !(ist->st->disposition & AV_DISPOSITION_ATTACHED_PIC))
+                    continue;
+                area = new_area;
+                idx = i;
+            }
+        }
+        if (idx >= 0)
+            new_video_stream(oc, idx);
+    }
+    if (av_guess_codec(file_oformat, NULL, filename, NULL, AVMEDIA_TYPE_AUDIO) != AV_CODEC_ID_NONE) {
+        int best_score = 0, idx = -1;
+        for (int i = 0; i < nb_input_streams; i++) {
+            int score;
+            ist = input_streams[i];
+            score = ist->st->codec->channels + 100000000*!!ist->st->codec_info_nb_frames;
+            if (ist->st->codec->codec_type == AVMEDIA_TYPE_AUDIO &&
+                score > best_score) {
+                best_score = score;
+                idx = i;
+            }
+        }
+        if (idx >= 0)
+            new_audio_stream(oc, idx);
+    }
+    for (int i = of->ost_index; i < nb_output_streams; i++) {
+        OutputStream *ost = output_streams[i];
+        if (ost->stream_copy) {
+            continue;
+        }
+        ost->encoding_needed = 1;
+        InputStream *ist = input_streams[ost->source_index];
+        ist->decoding_needed |= DECODING_FOR_OST;
+    }
+    if (!(oc->oformat->flags & AVFMT_NOFILE)) {
+        if ((ret = avio_open2(&oc->pb, filename, AVIO_FLAG_WRITE, &oc->interrupt_callback, &of->opts)) < 0) {
+            av_err2str(ret);
+            return ret;
+        }
+    }
+//    oc->max_delay = (int) (0.7 * AV_TIME_BASE);
+    if (nb_input_files) {
+        av_dict_copy(&oc->metadata, input_files[0]->ctx->metadata, AV_DICT_DONT_OVERWRITE);
+        av_dict_set(&oc->metadata, "creation_time", NULL, 0);
+    }
+
+    for (int i = of->ost_index; i < nb_output_streams; i++) {
+        InputStream *ist;
+        if (output_streams[i]->source_index < 0) {
+            continue;
+        }
+        ist = input_streams[output_streams[i]->source_index];
+        av_dict_copy(&output_streams[i]->st->metadata, ist->st->metadata, AV_DICT_DONT_OVERWRITE);
+        av_dict_set(&output_streams[i]->st->metadata, "encoder", NULL, 0);
+    }
+    return ret;
+}
+
+/* Parse ladder_opt into sizes, return the number of renditions. */
+static int parse_ladder(const char *spec, int in_w, int in_h, int sizes[][2]) {
+    const char *p = spec;
+    int nb = 0;
+
+    while (*p) {
+        size_t len = strcspn(p, ",");
+        char rendition[32];
+
+        if (nb == LADDER_MAX_RENDITIONS || len >= sizeof(rendition) || !len)
+            goto fail;
+        av_strlcpy(rendition, p, len + 1);
+        if (strspn(rendition, "0123456789") == len) {
+            /* keep the aspect ratio, with an even width for 4:2:0 */
+            sizes[nb][1] = atoi(rendition);
+            sizes[nb][0] = ((int)av_rescale(sizes[nb][1], in_w, in_h) + 1) & ~1;
+        } else if (av_parse_video_size(&sizes[nb][0], &sizes[nb][1], rendition) < 0) {
+            goto fail;
+        }
+        if (sizes[nb][0] <= 0 || sizes[nb][1] <= 0)
+            goto fail;
+        nb++;
+        p += len + !!p[len];
+    }
+    if (nb)
+        return nb;
+fail:
+    av_log(NULL, AV_LOG_ERROR, "Invalid ladder '%s', expected up to %d heights or WxH sizes "
+           "separated by commas.\n", spec, LADDER_MAX_RENDITIONS);
+    return AVERROR(EINVAL);
+}
+
+static char *rendition_filename(const char *output, int height) {
+    const char *p = strstr(output, "%d"), *ext;
+
+    if (p)
+        return av_asprintf("%.*s%d%s", (int)(p - output), output, height, p + 2);
+    ext = strrchr(output, '.');
+    if (!ext || strchr(ext, '/'))
+        ext = output + strlen(output);
+    return av_asprintf("%.*s_%dp%s", (int)(ext - output), output, height, ext);
+}
+
+/*
+ * Open one output file per rendition of ladder_opt and feed their video
+ * encoders from a single graph, so the input is decoded once.
+ * Audio is encoded for every file by a graph of its own.
+ */
+static int open_ladder_outputs(const char *output) {
+    OutputStream *osts[LADDER_MAX_RENDITIONS];
+    int sizes[LADDER_MAX_RENDITIONS][2];
+    int nb_renditions, ret, area = 0, idx = -1;
+
+    /* the stream open_output_file() maps */
+    for (int i = 0; i < nb_input_streams; i++) {
+        AVCodecContext *dec = input_streams[i]->dec_ctx;
+        if (dec->codec_type == AVMEDIA_TYPE_VIDEO && dec->width * dec->height > area) {
+            area = dec->width * dec->height;
+            idx = i;
+        }
+    }
+    if (idx < 0) {
+        av_log(NULL, AV_LOG_ERROR, "The ladder needs a video input stream.\n");
+        return AVERROR(EINVAL);
+    }
+    if ((nb_renditions = parse_ladder(ladder_opt, input_streams[idx]->dec_ctx->width,
+                                      input_streams[idx]->dec_ctx->height, sizes)) < 0)
+        return nb_renditions;
+
+    for (int i = 0; i < nb_renditions; i++) {
+        char *filename = rendition_filename(output, sizes[i][1]);
+        OutputFile *of;
+
+        if (!filename)
+            return AVERROR(ENOMEM);
+        video_width  = sizes[i][0];
+        video_height = sizes[i][1];
+        ret = open_output_file(filename);
+        if (ret < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Could not open output file %s.\n", filename);
+            av_free(filename);
+            return ret;
+        }
+        of = output_files[nb_output_files - 1];
+        osts[i] = NULL;
+        for (int j = of->ost_index; j < nb_output_streams; j++)
+            if (output_streams[j]->st->codec->codec_type == AVMEDIA_TYPE_VIDEO)
+                osts[i] = output_streams[j];
+        if (!osts[i] || osts[i]->stream_copy || osts[i]->source_index != idx) {
+            av_log(NULL, AV_LOG_ERROR, "%s has no encoded video stream from input stream #%d.\n",
+                   filename, idx);
+            av_free(filename);
+            return AVERROR(EINVAL);
+        }
+        av_log(NULL, AV_LOG_INFO, "Rendition %dx%d -> %s\n", sizes[i][0], sizes[i][1], filename);
+        av_free(filename);
+        /* the split graph replaces the simple graph of the stream */
+        osts[i]->avfilter        = NULL;
+        osts[i]->enc_ctx->width  = sizes[i][0];
+        osts[i]->enc_ctx->height = sizes[i][1];
+    }
+    if (!init_ladder_filtergraph(input_streams[idx], osts, nb_renditions, !ladder_split))
+        return AVERROR(ENOMEM);
+    return 0;
+}
+
+static int open_files(const char *filename, int (*open_file)(const char*)) {
+    return open_file(filename);
+}
+
+int ffmpeg_run_job(const BatchJob *job, void *opaque) {
+    int ret;
+    video_codec_name = job->video_codec ? job->video_codec : auto_copy ? "auto" : "libx264";
+    audio_codec_name = audio_codec_opt ? audio_codec_opt : auto_copy ? "auto" : "aac";
+    scaler_profile   = job->scaler ? job->scaler : scaler_opt ? scaler_opt : SCALER_PROFILE_DEFAULT;
+    video_width      = job->width;
+    video_height     = job->height;
+    if ((ret = scaler_profile_check(scaler_profile)) < 0)
+        return ret;
+    input_start_time = job->start_time;
+    input_stop_time = job->stop_time;
+
+    ret = open_files(job->input, open_input_file);
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Could not open input file %s.\n", job->input);
+        return ret;
+    }
+    if (ladder_opt) {
+        if (job->width > 0 || job->height > 0)
+            av_log(NULL, AV_LOG_WARNING, "The ladder sets the output sizes, %dx%d is ignored.\n",
+                   job->width, job->height);
+        if ((ret = open_ladder_outputs(job->output)) < 0)
+            return ret;
+    } else {
+        ret = open_files(job->output, open_output_file);
+        if (ret < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Could not open output file %s.\n", job->output);
+            return ret;
+        }
+    }
+    ret = transcode();
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Could not transcode %s.\n", job->input);
+        return ret;
+    }
+    return 0;
+}
@@ -0,0 +1,38 @@
+//
+//  ffmpeg_opt.h
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/2/25.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#ifndef ffmpeg_opt_h
+#define ffmpeg_opt_h
+
+#include <stdio.h>
+#include "ffmpeg.h"
+#include "batch.h"
+
+extern size_t mux_queue_size;
+
+/* copy streams whose codec the output container accepts unchanged */
+extern int auto_copy;
+extern const char *audio_codec_opt;
+extern const char *scaler_opt;      /* scaler profile of jobs that set none */
+
+/*
+ * Renditions of an ABR ladder, "1080,720,480,360" or WxH sizes separated
+ * by commas; a height alone keeps the aspect ratio of the input. Every
+ * rendition goes to a file of its own, named after the job's output with
+ * "%d" or an "_<height>p" suffix before the extension. NULL for a single
+ * output.
+ */
+extern const char *ladder_opt;
+#define LADDER_MAX_RENDITIONS 8
+/* scale every rendition from the input instead of from the next larger one */
+extern int ladder_split;
+
+/* Open the input and output of job and transcode them, see batch_run(). */
+int ffmpeg_run_job(const BatchJob *job, void *opaque);
+
+#endif /* ffmpeg_opt_h */
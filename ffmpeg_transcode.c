@@ -23,11 +23,28 @@
  * multimedia converter based on the FFmpeg libraries
  */
 
+#include <stdatomic.h>
+
 #include "filter.h"
 #include "ffmpeg.h"
+#include "frame_ring.h"
+#include "mux_queue.h"
+#include "alloc_stats.h"
+#include "thread_budget.h"
+#include "output_scheduler.h"
+#include "stage_stats.h"
+#include "stage_probe.h"
+#include "perf_counters.h"
+#include "progress.h"
+#include "metrics.h"
+#include "trace.h"
+#include "mem_stats.h"
 
 #include "libavutil/avassert.h"
 
+/* number of packets/frames buffered between two pipeline stages */
+#define PIPELINE_QUEUE_SIZE 8
+
 const char program_name[] = "ffmpeg";
 const int program_birth_year = 2000;
 
@@ -47,10 +64,24 @@ static int decode_interrupt_cb(void *ctx)
 
 const AVIOInterruptCB int_cb = { decode_interrupt_cb, NULL };
 
+/* output streams by muxed DTS, only used by the sequential loop */
+static OutputScheduler *output_sched;
+
+static Progress progress;
+static Metrics metrics;
+
+static void close_output_stream(OutputStream *ost)
+{
+    ost->finished = ENCODER_FINISHED;
+}
+
 static void write_frame(AVFormatContext *s, AVPacket *pkt, OutputStream *ost)
 {
     AVBitStreamFilterContext *bsfc = ost->bitstream_filters;
     AVCodecContext          *avctx = ost->encoding_needed ? ost->enc_ctx : ost->st->codec;
+    OutputFile                 *of = output_files[ost->file_index];
+    StageProbe probe;
+    int64_t pts;
     int ret;
     
     /*
@@ -62,6 +93,7 @@ static void write_frame(AVFormatContext *s, AVPacket *pkt, OutputStream *ost)
      */
     if (!(avctx->codec_type == AVMEDIA_TYPE_VIDEO && avctx->codec)) {
         if (ost->frame_number >= ost->max_frames) {
+            ost->frames_dropped++;
             av_packet_unref(pkt);
             return;
         }
@@ -74,25 +106,35 @@ static void write_frame(AVFormatContext *s, AVPacket *pkt, OutputStream *ost)
     if ((ret = av_apply_bitstream_filters(avctx, pkt, bsfc)) < 0) {
     }
     ost->last_mux_dts = pkt->dts;
+    ost->data_size += pkt->size;
+    if (output_sched)
+        output_scheduler_update(output_sched, ost);
     
     pkt->stream_index = ost->index;
+    pts = pkt->pts;
+    stage_probe_begin(&probe, MEM_STAGE_MUXER);
+    if (of->mux_queue) {
+        /* the muxer thread owns s, the packet is handed over */
+        if ((ret = mux_queue_send(of->mux_queue, pkt)) < 0)
+            close_output_stream(ost);
+        /* the muxer thread times the write itself */
+        stage_probe_end(&probe, ost->stats, ost->perf, STAGE_MUX_WAIT, "write_frame", ost->index, pts);
+        return;
+    }
     ret = av_interleaved_write_frame(s, pkt);
     if (ret < 0) {
     }
+    stage_probe_end(&probe, ost->stats, ost->perf, STAGE_MUX, "write_frame", ost->index, pts);
     av_packet_unref(pkt);
 }
 
-static void close_output_stream(OutputStream *ost)
-{
-    ost->finished = ENCODER_FINISHED;
-}
-
 static void do_audio_out(AVFormatContext *s, OutputStream *ost,
                          AVFrame *frame)
 {
     AVCodecContext *enc = ost->enc_ctx;
     AVPacket pkt;
     int got_packet = 0;
+    StageProbe probe;
     
     av_init_packet(&pkt);
     pkt.data = NULL;
@@ -100,9 +142,13 @@ static void do_audio_out(AVFormatContext *s, OutputStream *ost,
  
     frame->pts = ost->sync_opts;
     ost->sync_opts = frame->pts + frame->nb_samples;
+    stage_probe_begin(&probe, MEM_STAGE_ENCODER);
     if (avcodec_encode_audio2(enc, &pkt, frame, &got_packet) < 0) {
         av_log(NULL, AV_LOG_FATAL, "Audio encoding failed (avcodec_encode_audio2)\n");
     }
+    thread_share_add_time(ost->thread_share,
+                          stage_probe_end(&probe, ost->stats, ost->perf, STAGE_ENCODE,
+                                          "encode", ost->index, frame->pts));
     
     if (got_packet) {
         av_packet_rescale_ts(&pkt, enc->time_base, ost->st->time_base);
@@ -119,7 +165,7 @@ static void do_video_out(AVFormatContext *s,
     AVPacket pkt;
     AVCodecContext *enc = ost->enc_ctx;
     AVCodecContext *mux_enc = ost->st->codec;
-    int nb_frames,i;
+    int nb_frames = 1, i;
     int frame_size = 0;
     /* duplicates frame if needed */
     for (i = 0; i < nb_frames; i++) {
@@ -148,7 +194,12 @@ static void do_video_out(AVFormatContext *s,
             in_picture->quality = enc->global_quality;
             in_picture->pict_type = 0;
             
+            StageProbe probe;
+            stage_probe_begin(&probe, MEM_STAGE_ENCODER);
             ret = avcodec_encode_video2(enc, &pkt, in_picture, &got_packet);
+            thread_share_add_time(ost->thread_share,
+                                  stage_probe_end(&probe, ost->stats, ost->perf, STAGE_ENCODE,
+                                                  "encode", ost->index, in_picture->pts));
             if (ret < 0) {
                 av_log(NULL, AV_LOG_FATAL, "Video encoding failed\n");
             }
@@ -173,6 +224,30 @@ static void do_video_out(AVFormatContext *s,
     
     av_frame_unref(next_picture);
 }
+/* Encode one frame pulled from the buffersink of ost and unref it. */
+static void encode_filtered_frame(OutputFile *of, OutputStream *ost, AVFrame *filtered_frame)
+{
+    AVCodecContext *enc = ost->enc_ctx;
+
+    switch (ost->filter->filter->inputs[0]->type) {
+        case AVMEDIA_TYPE_VIDEO:
+            enc->sample_aspect_ratio = filtered_frame->sample_aspect_ratio;
+            do_video_out(of->ctx, ost, filtered_frame, AV_NOPTS_VALUE);
+            break;
+        case AVMEDIA_TYPE_AUDIO:
+            if (!(enc->codec->capabilities & AV_CODEC_CAP_PARAM_CHANGE) &&
+                enc->channels != av_frame_get_channels(filtered_frame)) {
+                break;
+            }
+            do_audio_out(of->ctx, ost, filtered_frame);
+            break;
+        default:
+            break;
+    }
+
+    av_frame_unref(filtered_frame);
+}
+
 /**
  * Get and encode new output from any of the filtergraphs, without causing
  * activity.
@@ -187,24 +262,29 @@ static int reap_filters(int flush)
     /* Reap all buffers present in the buffer sinks */
     for (i = 0; i < nb_output_streams; i++) {
         OutputStream *ost = output_streams[i];
-        OutputFile    *of = output_files[0];
+        OutputFile    *of = output_files[ost->file_index];
         AVFilterContext *filter;
-        AVCodecContext *enc = ost->enc_ctx;
         int ret = 0;
         
         if (!ost->filter)
             continue;
         filter = ost->filter->filter;
         
-        if (!ost->filtered_frame && !(ost->filtered_frame = av_frame_alloc())) {
+        if (!ost->filtered_frame && !(ost->filtered_frame = alloc_stats_frame_alloc())) {
             return AVERROR(ENOMEM);
         }
         filtered_frame = ost->filtered_frame;
         
         while (1) {
-            double float_pts = AV_NOPTS_VALUE; // this is identical to filtered_frame.pts but with higher precision
+            StageProbe probe;
+            stage_probe_begin(&probe, MEM_STAGE_FILTER);
             ret = av_buffersink_get_frame_flags(filter, filtered_frame,
                                                 AV_BUFFERSINK_FLAG_NO_REQUEST);
+            if (ret >= 0)
+                stage_probe_end(&probe, ost->stats, ost->perf, STAGE_FILTER_PULL,
+                                "reap_filters", ost->index, filtered_frame->pts);
+            else
+                stage_probe_cancel(&probe);
             if (ret < 0) {
                 if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
                 } else if (flush && ret == AVERROR_EOF) {
@@ -215,99 +295,93 @@ static int reap_filters(int flush)
             }
             if (ost->finished) {
                 av_frame_unref(filtered_frame);
-                continue;c
-            }
-            switch (filter->inputs[0]->type) {
-                case AVMEDIA_TYPE_VIDEO:
-                    enc->sample_aspect_ratio = filtered_frame->sample_aspect_ratio;
-                    do_video_out(of->ctx, ost, filtered_frame, float_pts);
-                    break;
-                case AVMEDIA_TYPE_AUDIO:
-                    if (!(enc->codec->capabilities & AV_CODEC_CAP_PARAM_CHANGE) &&
-                        enc->channels != av_frame_get_channels(filtered_frame)) {
-                        break;
-                    }
-                    do_audio_out(of->ctx, ost, filtered_frame);
-                    break;
-                default:
-                    break;
+                continue;
             }
-            
-            av_frame_unref(filtered_frame);
+            encode_filtered_frame(of, ost, filtered_frame);
         }
     }
     
     return 0;
 }
 
-static void flush_encoders(void)
+/* Drain the delayed packets of one encoder into the muxer. */
+static void flush_encoder(OutputStream *ost)
 {
-    int i, ret;
-    
-    for (i = 0; i < nb_output_streams; i++) {
-        OutputStream   *ost = output_streams[i];
-        AVCodecContext *enc = ost->enc_ctx;
-        AVFormatContext *os = output_files[ost->file_index]->ctx;
-        int stop_encoding = 0;
-        
-        if (!ost->encoding_needed)
-            continue;
-        
-        if (enc->codec_type == AVMEDIA_TYPE_AUDIO && enc->frame_size <= 1)
-            continue;
+    AVCodecContext *enc = ost->enc_ctx;
+    AVFormatContext *os = output_files[ost->file_index]->ctx;
+    int ret, stop_encoding = 0;
+
+    if (!ost->encoding_needed)
+        return;
+
+    if (enc->codec_type == AVMEDIA_TYPE_AUDIO && enc->frame_size <= 1)
+        return;
 #if FF_API_LAVF_FMT_RAWPICTURE
-        if (enc->codec_type == AVMEDIA_TYPE_VIDEO && (os->oformat->flags & AVFMT_RAWPICTURE) && enc->codec->id == AV_CODEC_ID_RAWVIDEO)
-            continue;
+    if (enc->codec_type == AVMEDIA_TYPE_VIDEO && (os->oformat->flags & AVFMT_RAWPICTURE) && enc->codec->id == AV_CODEC_ID_RAWVIDEO)
+        return;
 #endif
+
+    for (;;) {
+        int (*encode)(AVCodecContext*, AVPacket*, const AVFrame*, int*) = NULL;
+        const char *desc;
         
-        for (;;) {
-            int (*encode)(AVCodecContext*, AVPacket*, const AVFrame*, int*) = NULL;
-            const char *desc;
-            
-            switch (enc->codec_type) {
-                case AVMEDIA_TYPE_AUDIO:
-                    encode = avcodec_encode_audio2;
-                    desc   = "audio";
-                    break;
-                case AVMEDIA_TYPE_VIDEO:
-                    encode = avcodec_encode_video2;
-                    desc   = "video";
-                    break;
-                default:
-                    stop_encoding = 1;
-            }
+        switch (enc->codec_type) {
+            case AVMEDIA_TYPE_AUDIO:
+                encode = avcodec_encode_audio2;
+                desc   = "audio";
+                break;
+            case AVMEDIA_TYPE_VIDEO:
+                encode = avcodec_encode_video2;
+                desc   = "video";
+                break;
+            default:
+                stop_encoding = 1;
+        }
+        
+        if (encode) {
+            AVPacket pkt;
+            int pkt_size;
+            int got_packet;
+            StageProbe probe;
+            av_init_packet(&pkt);
+            pkt.data = NULL;
+            pkt.size = 0;
             
-            if (encode) {
-                AVPacket pkt;
-                int pkt_size;
-                int got_packet;
-                av_init_packet(&pkt);
-                pkt.data = NULL;
-                pkt.size = 0;
-                
-                ret = encode(enc, &pkt, NULL, &got_packet);
-                if (ret < 0) {
-                    av_log(NULL, AV_LOG_FATAL, "%s encoding failed: %s\n",
-                           desc,
-                           av_err2str(ret));
-                }
-                if (!got_packet) {
-                    stop_encoding = 1;
-                    break;
-                }
-                if (ost->finished & MUXER_FINISHED) {
-                    av_packet_unref(&pkt);
-                    continue;
-                }
-                av_packet_rescale_ts(&pkt, enc->time_base, ost->st->time_base);
-                pkt_size = pkt.size;
-                write_frame(os, &pkt, ost);
+            stage_probe_begin(&probe, MEM_STAGE_ENCODER);
+            ret = encode(enc, &pkt, NULL, &got_packet);
+            stage_probe_end(&probe, ost->stats, ost->perf, STAGE_ENCODE,
+                            "encode", ost->index, AV_NOPTS_VALUE);
+            if (ret < 0) {
+                av_log(NULL, AV_LOG_FATAL, "%s encoding failed: %s\n",
+                       desc,
+                       av_err2str(ret));
             }
-            
-            if (stop_encoding)
+            if (!got_packet) {
+                stop_encoding = 1;
                 break;
+            }
+            if (ost->finished & MUXER_FINISHED) {
+                av_packet_unref(&pkt);
+                continue;
+            }
+            av_packet_rescale_ts(&pkt, enc->time_base, ost->st->time_base);
+            pkt_size = pkt.size;
+            write_frame(os, &pkt, ost);
         }
+        
+        if (stop_encoding)
+            break;
     }
+    /* the encoder is drained, its cores go to whatever opens next */
+    thread_budget_release(&ost->thread_share);
+}
+
+static void flush_encoders(void)
+{
+    int i;
+
+    for (i = 0; i < nb_output_streams; i++)
+        flush_encoder(output_streams[i]);
 }
 
 int guess_input_channel_layout(InputStream *ist)
@@ -326,22 +400,108 @@ int guess_input_channel_layout(InputStream *ist)
     return 1;
 }
 
+static int ifilter_send_frame(InputFilter *ifilter, AVFrame *frame)
+{
+    if (ifilter->frame_ring)
+        return frame_ring_send_frame(ifilter->frame_ring, frame);
+    return ifilter_push_frame(ifilter, frame);
+}
+
+static int ifilter_send_eof(InputFilter *ifilter)
+{
+    if (ifilter->frame_ring) {
+        frame_ring_set_eof(ifilter->frame_ring);
+        return 0;
+    }
+    return ifilter_push_eof(ifilter);
+}
+
+/* Hand a decoded frame to every filter graph fed by ist; the reference is moved. */
+static int send_frame_to_filters(InputStream *ist, AVFrame *decoded_frame)
+{
+    int i, ret = 0;
+    int64_t t, pts;
+    StageProbe probe;
+
+    for (i = 0; i < ist->nb_filters; i++) {
+        AVFrame *f;
+
+        if (i < ist->nb_filters - 1) {
+            if (!ist->filter_frame && !(ist->filter_frame = alloc_stats_frame_alloc()))
+                return AVERROR(ENOMEM);
+            f = ist->filter_frame;
+            if ((ret = av_frame_ref(f, decoded_frame)) < 0)
+                break;
+        } else
+            f = decoded_frame;
+        /* in pipeline mode the filter thread decides, it feeds the encoder ring */
+        if (!ist->filters[i]->frame_ring && ifilter_bypass(ist->filters[i], f)) {
+            OutputStream *ost = ist->filters[i]->graph->outputs[0]->ost;
+
+            if (ost->finished)
+                av_frame_unref(f);
+            else
+                encode_filtered_frame(output_files[ost->file_index], ost, f);
+            continue;
+        }
+        pts = f->pts;
+        stage_probe_begin(&probe, MEM_STAGE_FILTER);
+        ret = ifilter_send_frame(ist->filters[i], f);
+        /*
+         * in pipeline mode this is the wait for a free slot in the frame
+         * ring, the filter thread times the push
+         */
+        if (ist->filters[i]->frame_ring)
+            t = stage_probe_end(&probe, NULL, NULL, STAGE_FILTER_PUSH,
+                                "frame_ring_send", ist->st->index, pts);
+        else
+            t = stage_probe_end(&probe, ist->stats, ist->perf, STAGE_FILTER_PUSH,
+                                "ifilter_push_frame", ist->st->index, pts);
+        thread_share_add_time(ist->filters[i]->graph->thread_share, t);
+        if (ret == AVERROR_EOF)
+            ret = 0; /* ignore */
+        if (ret < 0) {
+            av_log(NULL, AV_LOG_FATAL,
+                   "Failed to inject frame into filter network: %s\n", av_err2str(ret));
+            break;
+        }
+    }
+    return ret;
+}
+
 static int decode_audio(InputStream *ist, AVPacket *pkt, int *got_output)
 {
     AVFrame *decoded_frame;
     AVCodecContext *avctx = ist->dec_ctx;
-    int i, ret, err = 0;
+    int ret, err = 0;
+    StageProbe probe;
     AVRational decoded_frame_tb;
-    decoded_frame = av_frame_alloc();
-    
+
+    if (!ist->decoded_frame && !(ist->decoded_frame = alloc_stats_frame_alloc()))
+        return AVERROR(ENOMEM);
+    decoded_frame = ist->decoded_frame;
+
+    stage_probe_begin(&probe, MEM_STAGE_DECODER);
     ret = avcodec_decode_audio4(avctx, decoded_frame, got_output, pkt);
+    thread_share_add_time(ist->thread_share,
+                          stage_probe_end(&probe, ist->stats, ist->perf, STAGE_DECODE,
+                                          "decode", ist->st->index, pkt->pts));
     
     if (ret >= 0 && avctx->sample_rate <= 0) {
         ret = AVERROR_INVALIDDATA;
     }
     
-    if (!*got_output || ret < 0)
+    if (!*got_output || ret < 0) {
+        av_frame_unref(decoded_frame);
         return ret;
+    }
+    ist->frames_decoded++;
+
+    /* compare and configure the graphs with the same layout the stream got */
+    if (!decoded_frame->channel_layout &&
+        av_frame_get_channels(decoded_frame) == avctx->channels &&
+        guess_input_channel_layout(ist))
+        decoded_frame->channel_layout = avctx->channel_layout;
 
     /* if the decoder provides a pts, use it instead of the last packet pts.
      the decoder could be delaying output by a packet or more. */
@@ -359,9 +519,7 @@ static int decode_audio(InputStream *ist, AVPacket *pkt, int *got_output)
         decoded_frame_tb   = AV_TIME_BASE_Q;
     }
     pkt->pts           = AV_NOPTS_VALUE;
-    err = av_buffersrc_add_frame_flags(ist->filters[i]->filter, decoded_frame, AV_BUFFERSRC_FLAG_PUSH);
-    if (err == AVERROR_EOF)
-        err = 0; /* ignore */
+    err = send_frame_to_filters(ist, decoded_frame);
     decoded_frame->pts = AV_NOPTS_VALUE;
     
     av_frame_unref(decoded_frame);
@@ -372,35 +530,79 @@ static int decode_video(InputStream *ist, AVPacket *pkt, int *got_output)
 {
     AVFrame *decoded_frame;
     int ret = 0, err = 0;
-    decoded_frame = av_frame_alloc();
+    StageProbe probe;
+
+    if (!ist->decoded_frame && !(ist->decoded_frame = alloc_stats_frame_alloc()))
+        return AVERROR(ENOMEM);
+    decoded_frame = ist->decoded_frame;
     pkt->dts  = av_rescale_q(ist->dts, AV_TIME_BASE_Q, ist->st->time_base);
     
+    stage_probe_begin(&probe, MEM_STAGE_DECODER);
     ret = avcodec_decode_video2(ist->dec_ctx, decoded_frame, got_output, pkt);
-    if (!*got_output || ret < 0)
+    thread_share_add_time(ist->thread_share,
+                          stage_probe_end(&probe, ist->stats, ist->perf, STAGE_DECODE,
+                                          "decode", ist->st->index, pkt->pts));
+    if (!*got_output || ret < 0) {
+        av_frame_unref(decoded_frame);
         return ret;
+    }
+    ist->frames_decoded++;
     pkt->size = 0;
     if (ist->st->sample_aspect_ratio.num)
         decoded_frame->sample_aspect_ratio = ist->st->sample_aspect_ratio;
-    ret = av_buffersrc_add_frame_flags(ist->filters[0]->filter, decoded_frame, AV_BUFFERSRC_FLAG_PUSH);
-    if (ret == AVERROR_EOF) {
-        ret = 0; /* ignore */
-    } else if (ret < 0) {
-        av_log(NULL, AV_LOG_FATAL,
-               "Failed to inject frame into filter network: %s\n", av_err2str(ret));
-    }
+    err = send_frame_to_filters(ist, decoded_frame);
     
 fail:
     av_frame_unref(decoded_frame);
     return err < 0 ? err : ret;
 }
 
+static InputStream *get_input_stream(OutputStream *ost)
+{
+    if (ost->source_index >= 0)
+        return input_streams[ost->source_index];
+    return NULL;
+}
+
+/* Send a demuxed packet to a stream copy output, only rescaling its timestamps. */
+static void do_streamcopy(InputStream *ist, OutputStream *ost, const AVPacket *pkt)
+{
+    OutputFile *of = output_files[ost->file_index];
+    AVPacket opkt;
+
+    /* start at a keyframe, the decoder of the output needs a reference */
+    if (!ost->frame_number && !(pkt->flags & AV_PKT_FLAG_KEY))
+        return;
+
+    av_init_packet(&opkt);
+    if (av_packet_ref(&opkt, pkt) < 0)
+        return;
+    av_packet_rescale_ts(&opkt, ist->st->time_base, ost->st->time_base);
+    write_frame(of->ctx, &opkt, ost);
+}
+
 /* pkt = NULL means EOF (needed to flush decoder buffers) */
-static int process_input_packet(InputStream *ist, const AVPacket *pkt, int no_eof)
+static int decode_input_packet(InputStream *ist, const AVPacket *pkt, int no_eof)
 {
     int ret = 0;
     int got_output = 0;
     
     AVPacket avpkt;
+
+    for (int i = 0; i < nb_output_streams; i++) {
+        OutputStream *ost = output_streams[i];
+
+        if (!ost->stream_copy || ost->finished ||
+            get_input_stream(ost) != ist)
+            continue;
+        if (pkt)
+            do_streamcopy(ist, ost, pkt);
+        else if (!no_eof)
+            close_output_stream(ost);
+    }
+    if (!ist->decoding_needed)
+        return 0;
+
     if (!pkt) {
         /* EOF handling */
         av_init_packet(&avpkt);
@@ -460,14 +662,28 @@ static int process_input_packet(InputStream *ist, const AVPacket *pkt, int no_eo
     /* after flushing, send an EOF on all the filter inputs attached to the stream */
     /* except when looping we need to flush but not to send an EOF */
     if (!pkt && !got_output && !no_eof) {
-        av_buffersrc_add_frame(ist->filters[0]->filter, NULL);
+        for (int i = 0; i < ist->nb_filters; i++)
+            ifilter_send_eof(ist->filters[i]);
+        /* the decoder is done, its cores go to whatever opens next */
+        thread_budget_release(&ist->thread_share);
     }
     return got_output;
 }
 
+static int process_input_packet(InputStream *ist, const AVPacket *pkt, int no_eof)
+{
+    int64_t trace_start = trace_begin();
+    int ret = decode_input_packet(ist, pkt, no_eof);
+
+    trace_end("process_input_packet", ist->st->index, trace_start, pkt ? pkt->pts : AV_NOPTS_VALUE);
+    return ret;
+}
+
 static int get_buffer(AVCodecContext *s, AVFrame *frame, int flags)
 {
-    return avcodec_default_get_buffer2(s, frame, flags);
+    InputStream *ist = s->opaque;
+
+    return frame_pool_get_buffer(ist->frame_pool, s, frame, flags);
 }
 
 static int init_input_stream(int ist_index, char *error, int error_len)
@@ -481,6 +697,9 @@ static int init_input_stream(int ist_index, char *error, int error_len)
             return AVERROR(EINVAL);
         }
         
+        if ((ret = frame_pool_alloc(&ist->frame_pool)) < 0)
+            return ret;
+
         ist->dec_ctx->opaque                = ist;
         ist->dec_ctx->get_buffer2           = get_buffer;
         ist->dec_ctx->thread_safe_callbacks = 1;
@@ -492,7 +711,7 @@ static int init_input_stream(int ist_index, char *error, int error_len)
         }
         
         if (!av_dict_get(ist->decoder_opts, "threads", NULL, 0))
-            av_dict_set(&ist->decoder_opts, "threads", "auto", 0);
+            av_dict_set_int(&ist->decoder_opts, "threads", thread_share_count(ist->thread_share), 0);
         if ((ret = avcodec_open2(ist->dec_ctx, codec, &ist->decoder_opts)) < 0) {
             return ret;
         }
@@ -504,11 +723,46 @@ static int init_input_stream(int ist_index, char *error, int error_len)
     return 0;
 }
 
-static InputStream *get_input_stream(OutputStream *ost)
+/* Take the codec parameters of a stream copy output from its input stream. */
+static int init_output_stream_streamcopy(OutputStream *ost)
 {
-    if (ost->source_index >= 0)
-        return input_streams[ost->source_index];
-    return NULL;
+    OutputFile *of = output_files[ost->file_index];
+    InputStream *ist = get_input_stream(ost);
+    AVCodecContext *enc_ctx = ost->st->codec;
+    AVCodecContext *dec_ctx;
+    unsigned int codec_tag, codec_tag_tmp;
+    int i, ret;
+
+    if (!ist)
+        return AVERROR(EINVAL);
+    dec_ctx = ist->st->codec;
+
+    /* keep the tag only if the container maps it to the same codec */
+    codec_tag = 0;
+    if (!of->ctx->oformat->codec_tag ||
+        av_codec_get_id(of->ctx->oformat->codec_tag, dec_ctx->codec_tag) == dec_ctx->codec_id ||
+        !av_codec_get_tag2(of->ctx->oformat->codec_tag, dec_ctx->codec_id, &codec_tag_tmp))
+        codec_tag = dec_ctx->codec_tag;
+
+    if ((ret = avcodec_copy_context(enc_ctx, dec_ctx)) < 0)
+        return ret;
+    enc_ctx->codec_tag = codec_tag;
+    enc_ctx->time_base = ist->st->time_base;
+
+    ost->st->time_base           = ist->st->time_base;
+    ost->st->avg_frame_rate      = ist->st->avg_frame_rate;
+    ost->st->r_frame_rate        = ist->st->r_frame_rate;
+    ost->st->sample_aspect_ratio = ist->st->sample_aspect_ratio;
+
+    for (i = 0; i < ist->st->nb_side_data; i++) {
+        const AVPacketSideData *sd_src = &ist->st->side_data[i];
+        uint8_t *dst_data = av_stream_new_side_data(ost->st, sd_src->type, sd_src->size);
+
+        if (!dst_data)
+            return AVERROR(ENOMEM);
+        memcpy(dst_data, sd_src->data, sd_src->size);
+    }
+    return 0;
 }
 
 static int init_output_stream(OutputStream *ost, char *error, int error_len)
@@ -531,7 +785,7 @@ static int init_output_stream(OutputStream *ost, char *error, int error_len)
             ost->enc_ctx->subtitle_header_size = dec->subtitle_header_size;
         }
         if (!av_dict_get(ost->encoder_opts, "threads", NULL, 0))
-            av_dict_set(&ost->encoder_opts, "threads", "auto", 0);
+            av_dict_set_int(&ost->encoder_opts, "threads", thread_share_count(ost->thread_share), 0);
         if (ost->enc->type == AVMEDIA_TYPE_AUDIO &&
             !codec->defaults &&
             !av_dict_get(ost->encoder_opts, "b", NULL, 0) &&
@@ -581,6 +835,12 @@ static int init_output_stream(OutputStream *ost, char *error, int error_len)
         // copy timebase while removing common factors
         ost->st->time_base = av_add_q(ost->enc_ctx->time_base, (AVRational){0, 1});
         ost->st->codec->codec= ost->enc_ctx->codec;
+    } else if (ost->stream_copy) {
+        if ((ret = init_output_stream_streamcopy(ost)) < 0) {
+            snprintf(error, error_len, "Could not copy the parameters of output stream #%d:%d",
+                     ost->file_index, ost->index);
+            return ret;
+        }
     } else {
         ret = av_opt_set_dict(ost->enc_ctx, &ost->encoder_opts);
         if (ret < 0) {
@@ -593,6 +853,45 @@ static int init_output_stream(OutputStream *ost, char *error, int error_len)
     return ret;
 }
 
+/**
+ * Register every decoder and encoder with the thread budget before the
+ * first of them is opened, so the first one does not get all the cores.
+ */
+static int acquire_thread_shares(void)
+{
+    char name[32];
+    int i;
+
+    for (i = 0; i < nb_input_streams; i++) {
+        InputStream *ist = input_streams[i];
+        int64_t cost = ist->dec_ctx->codec_type == AVMEDIA_TYPE_VIDEO ?
+                       thread_budget_video_cost(ist->dec_ctx->width, ist->dec_ctx->height,
+                                                THREAD_BUDGET_DECODER_WEIGHT) :
+                       THREAD_BUDGET_AUDIO_COST;
+
+        if (!ist->decoding_needed || ist->thread_share)
+            continue;
+        snprintf(name, sizeof(name), "decoder #%d:%d", ist->file_index, ist->st->index);
+        if (!(ist->thread_share = thread_budget_acquire(name, cost)))
+            return AVERROR(ENOMEM);
+    }
+    for (i = 0; i < nb_output_streams; i++) {
+        OutputStream *ost = output_streams[i];
+        InputStream *ist = get_input_stream(ost);
+        int64_t cost = ost->enc_ctx->codec_type == AVMEDIA_TYPE_VIDEO && ist ?
+                       thread_budget_video_cost(ist->dec_ctx->width, ist->dec_ctx->height,
+                                                THREAD_BUDGET_ENCODER_WEIGHT) :
+                       THREAD_BUDGET_AUDIO_COST;
+
+        if (!ost->encoding_needed || ost->thread_share)
+            continue;
+        snprintf(name, sizeof(name), "encoder #%d:%d", ost->file_index, ost->index);
+        if (!(ost->thread_share = thread_budget_acquire(name, cost)))
+            return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
 static int transcode_init(void)
 {
     int ret = 0, i;
@@ -600,6 +899,22 @@ static int transcode_init(void)
     OutputStream *ost = NULL;
     InputStream *ist;
     char error[1024] = {0};
+
+    if ((ret = acquire_thread_shares()) < 0)
+        return ret;
+
+    for (i = 0; i < nb_input_streams; i++)
+        if (!input_streams[i]->stats && !(input_streams[i]->stats = stage_stats_alloc()))
+            return AVERROR(ENOMEM);
+    for (i = 0; i < nb_output_streams; i++)
+        if (!output_streams[i]->stats && !(output_streams[i]->stats = stage_stats_alloc()))
+            return AVERROR(ENOMEM);
+    for (i = 0; i < nb_input_streams; i++)
+        if (!input_streams[i]->perf)
+            input_streams[i]->perf = perf_stats_alloc();
+    for (i = 0; i < nb_output_streams; i++)
+        if (!output_streams[i]->perf)
+            output_streams[i]->perf = perf_stats_alloc();
     
     /* for each output stream, we compute the right encoding parameters */
     for (i = 0; i < nb_output_streams; i++) {
@@ -616,6 +931,10 @@ static int transcode_init(void)
             enc_ctx->bits_per_raw_sample    = dec_ctx->bits_per_raw_sample;
             enc_ctx->chroma_sample_location = dec_ctx->chroma_sample_location;
         }
+
+        /* parameters come from the input stream in init_output_stream() */
+        if (ost->stream_copy)
+            continue;
         
         if (!ost->filter &&
             (enc_ctx->codec_type == AVMEDIA_TYPE_VIDEO ||
@@ -625,6 +944,12 @@ static int transcode_init(void)
                 if (configure_filtergraph(fg)) {
                     av_log(NULL, AV_LOG_FATAL, "Error opening filters!\n");
                 }
+            } else if (ost->filter && !ost->filter->graph->graph) {
+                /* a graph shared by several outputs is configured for the first of them */
+                if ((ret = configure_filtergraph(ost->filter->graph)) < 0) {
+                    av_log(NULL, AV_LOG_FATAL, "Error opening filters: %s\n", av_err2str(ret));
+                    return ret;
+                }
             }
         
         if (enc_ctx->codec_type == AVMEDIA_TYPE_VIDEO) {
@@ -691,19 +1016,295 @@ static int transcode_init(void)
     return 0;
 }
 
-/* Return 1 if there remain streams where more output is wanted, 0 otherwise. */
-static int need_output(void)
+static void *input_thread(void *arg)
 {
-    for (int i = 0; i < nb_output_streams; i++) {
-        OutputStream *ost    = output_streams[i];
-        if (ost->finished)
+    InputFile *f = arg;
+    int ret = 0;
+
+    trace_thread_name("demuxer %s", f->ctx->filename);
+    while (1) {
+        AVPacket pkt;
+        ret = av_read_frame(f->ctx, &pkt);
+
+        if (ret == AVERROR(EAGAIN)) {
+            av_usleep(10000);
             continue;
+        }
+        if (ret < 0) {
+            av_thread_message_queue_set_err_recv(f->in_thread_queue, ret);
+            break;
+        }
+        ret = av_thread_message_queue_send(f->in_thread_queue, &pkt, 0);
+        if (ret < 0) {
+            if (ret != AVERROR_EOF)
+                av_log(f->ctx, AV_LOG_ERROR,
+                       "Unable to send packet to main thread: %s\n",
+                       av_err2str(ret));
+            av_packet_unref(&pkt);
+            av_thread_message_queue_set_err_recv(f->in_thread_queue, ret);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static void free_input_threads(void)
+{
+    int i;
+
+    for (i = 0; i < nb_input_files; i++) {
+        InputFile *f = input_files[i];
+        AVPacket pkt;
+
+        if (!f || !f->in_thread_queue)
+            continue;
+        av_thread_message_queue_set_err_send(f->in_thread_queue, AVERROR_EOF);
+        while (av_thread_message_queue_recv(f->in_thread_queue, &pkt, 0) >= 0)
+            av_packet_unref(&pkt);
+
+        pthread_join(f->thread, NULL);
+        /* a NULL queue tells the next call the thread is already joined */
+        av_thread_message_queue_free(&f->in_thread_queue);
+    }
+}
+
+/**
+ * Start one demuxer thread per input file. Each thread feeds a bounded
+ * queue of thread_queue_size packets, so a stalled read only blocks the
+ * reader while the main thread keeps decoding, filtering and encoding
+ * what is already queued.
+ */
+static int init_input_threads(void)
+{
+    int i, ret;
+
+    for (i = 0; i < nb_input_files; i++) {
+        InputFile *f = input_files[i];
+
+        ret = av_thread_message_queue_alloc(&f->in_thread_queue,
+                                            FFMAX(f->thread_queue_size, 1), sizeof(AVPacket));
+        if (ret < 0)
+            return ret;
+
+        if ((ret = pthread_create(&f->thread, NULL, input_thread, f))) {
+            av_log(NULL, AV_LOG_ERROR, "pthread_create failed: %s. Try to increase `ulimit -v` or decrease `ulimit -s`.\n", strerror(ret));
+            av_thread_message_queue_free(&f->in_thread_queue);
+            return AVERROR(ret);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Start one muxer thread per output file, so a slow write or flush only
+ * stalls the encoders once mux_queue_size bytes of packets are queued.
+ */
+static int init_mux_queues(void)
+{
+    int i, ret;
+
+    for (i = 0; i < nb_output_files; i++) {
+        OutputFile *of = output_files[i];
+
+        ret = mux_queue_alloc(&of->mux_queue, of->ctx,
+                              of->mux_queue_size ? of->mux_queue_size : MUX_QUEUE_DEFAULT_SIZE);
+        if (ret < 0)
+            return ret;
+    }
+    for (i = 0; i < nb_output_streams; i++) {
+        OutputStream *ost = output_streams[i];
+
+        mux_queue_set_stats(output_files[ost->file_index]->mux_queue, ost->index,
+                            ost->stats, ost->perf);
+    }
+    /* sample_memory() counts what lavf holds for interleaving as muxer */
+    for (i = 0; i < nb_output_files; i++)
+        mux_queue_track_interleaved(output_files[i]->mux_queue);
+    return 0;
+}
+
+static void free_mux_queues(void)
+{
+    int i;
+
+    for (i = 0; i < nb_output_files; i++)
+        if (output_files[i])
+            mux_queue_free(&output_files[i]->mux_queue);
+}
+
+/* Return 1 if the packets of ist are decoded or stream copied. */
+static int input_stream_used(InputStream *ist)
+{
+    if (ist->decoding_needed)
+        return 1;
+    for (int i = 0; i < nb_output_streams; i++)
+        if (output_streams[i]->stream_copy && get_input_stream(output_streams[i]) == ist)
+            return 1;
+    return 0;
+}
+
+/**
+ * Keep only the packets inside [start_time, stop_time) of their file.
+ * Return 1 to keep pkt, 0 to drop it and AVERROR_EOF once every stream
+ * in use went past stop_time.
+ */
+static int check_input_range(InputFile *f, InputStream *ist, const AVPacket *pkt)
+{
+    int64_t ts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+
+    if (ist->past_stop)
+        return 0;
+    if (ts == AV_NOPTS_VALUE)
+        return 1;
+    ts = av_rescale_q(ts, ist->st->time_base, AV_TIME_BASE_Q);
+    if (f->start_time != AV_NOPTS_VALUE && ts < f->start_time)
+        return 0;
+    if (f->stop_time == AV_NOPTS_VALUE || ts < f->stop_time)
         return 1;
+
+    ist->past_stop = 1;
+    for (int i = 0; i < f->nb_streams; i++) {
+        InputStream *s = input_streams[f->ist_index + i];
+        if (!s->past_stop && input_stream_used(s))
+            return 0;
+    }
+    f->past_stop = 1;
+    return AVERROR_EOF;
+}
+
+static int read_input_packet(InputFile *f, AVPacket *pkt)
+{
+    int64_t trace_start = trace_begin();
+    int64_t t0 = av_gettime_relative();
+    int ret;
+
+    if (f->in_thread_queue)
+        ret = av_thread_message_queue_recv(f->in_thread_queue, pkt, 0);
+    else
+        ret = av_read_frame(f->ctx, pkt);
+    if (ret >= 0) {
+        stage_stats_add(input_streams[f->ist_index + pkt->stream_index]->stats,
+                        STAGE_DEMUX, av_gettime_relative() - t0);
+        trace_end("read_input_packet", pkt->stream_index, trace_start, pkt->pts);
+    }
+    return ret;
+}
+
+static int get_input_packet(InputFile *f, AVPacket *pkt)
+{
+    int ranged = f->start_time != AV_NOPTS_VALUE || f->stop_time != AV_NOPTS_VALUE;
+    InputStream *ist;
+    int ret;
+
+    do {
+        if (f->past_stop)
+            return AVERROR_EOF;
+        if ((ret = read_input_packet(f, pkt)) < 0)
+            return ret;
+        ist = input_streams[f->ist_index + pkt->stream_index];
+        if (!ranged)
+            ret = 1;
+        else if ((ret = check_input_range(f, ist, pkt)) <= 0)
+            av_packet_unref(pkt);
+    } while (!ret);
+    if (ret < 0)
+        return ret;
+    /* counted here so the sequential and the pipelined loop both report them */
+    if (!ist->discard) {
+        ist->data_size += pkt->size;
+        ist->nb_packets++;
     }
-    
     return 0;
 }
 
+/* Media duration the job will transcode, AV_NOPTS_VALUE if unknown. */
+static int64_t expected_duration(void)
+{
+    InputFile *f;
+    int64_t file_start, start;
+
+    if (!nb_input_files)
+        return AV_NOPTS_VALUE;
+    f = input_files[0];
+    file_start = f->ctx->start_time != AV_NOPTS_VALUE ? f->ctx->start_time : 0;
+    start      = f->start_time != AV_NOPTS_VALUE ? f->start_time : file_start;
+    if (f->stop_time != AV_NOPTS_VALUE)
+        return f->stop_time - start;
+    if (f->ctx->duration == AV_NOPTS_VALUE)
+        return AV_NOPTS_VALUE;
+    return f->ctx->duration - (start - file_start);
+}
+
+/*
+ * In pipeline mode the counters are read while the encoder threads
+ * update them, so the report is approximate.
+ */
+static void print_report(int is_last)
+{
+    uint64_t frames = 0, bytes = 0;
+    int64_t media_time = AV_NOPTS_VALUE;
+
+    for (int i = 0; i < nb_output_streams; i++) {
+        OutputStream *ost = output_streams[i];
+
+        if (ost->st->codec->codec_type == AVMEDIA_TYPE_VIDEO)
+            frames += ost->frame_number;
+        bytes += ost->data_size;
+        if (ost->last_mux_dts != AV_NOPTS_VALUE)
+            media_time = FFMAX(media_time, av_rescale_q(ost->last_mux_dts, ost->st->time_base,
+                                                        AV_TIME_BASE_Q));
+    }
+    progress_print(&progress, frames, bytes, media_time, is_last);
+}
+
+/*
+ * Sample the frames, packets and buffers queued in front of each stage
+ * right now; mem_stats adds the heap each stage allocated.
+ */
+static void sample_memory(void)
+{
+    int64_t bytes[NB_MEM_STAGES] = { 0 }, items[NB_MEM_STAGES] = { 0 };
+
+    bytes[MEM_STAGE_DECODER] = frame_pool_total_bytes();
+    for (int i = 0; i < nb_input_streams; i++) {
+        InputStream *ist = input_streams[i];
+
+        if (ist->pkt_ring) {
+            bytes[MEM_STAGE_DECODER] += frame_ring_bytes(ist->pkt_ring);
+            items[MEM_STAGE_DECODER] += frame_ring_occupancy(ist->pkt_ring);
+        }
+        for (int j = 0; j < ist->nb_filters; j++) {
+            FrameRing *ring = ist->filters[j]->frame_ring;
+
+            if (ring) {
+                bytes[MEM_STAGE_FILTER] += frame_ring_bytes(ring);
+                items[MEM_STAGE_FILTER] += frame_ring_occupancy(ring);
+            }
+        }
+    }
+    for (int i = 0; i < nb_output_streams; i++) {
+        FrameRing *ring = output_streams[i]->frame_ring;
+
+        if (ring) {
+            bytes[MEM_STAGE_ENCODER] += frame_ring_bytes(ring);
+            items[MEM_STAGE_ENCODER] += frame_ring_occupancy(ring);
+        }
+    }
+    for (int i = 0; i < nb_output_files; i++) {
+        size_t queued = 0, interleaved = 0;
+        unsigned nb_queued = 0, nb_interleaved = 0;
+
+        if (output_files[i]->mux_queue) {
+            mux_queue_occupancy(output_files[i]->mux_queue, &queued, &nb_queued, NULL);
+            mux_queue_interleaved(output_files[i]->mux_queue, &interleaved, &nb_interleaved);
+        }
+        bytes[MEM_STAGE_MUXER] += queued + interleaved;
+        items[MEM_STAGE_MUXER] += nb_queued + nb_interleaved;
+    }
+    mem_stats_sample(bytes, items);
+}
+
 /**
  * Perform a step of transcoding for the specified filter graph.
  *
@@ -746,28 +1347,407 @@ static int transcode_from_filter(FilterGraph *graph, InputStream **best_ist)
     return 0;
 }
 
+/*
+ * Pipelined transcoding: the demuxer threads, one decoder thread per input
+ * stream, one filter thread per filter graph and one encoder thread per
+ * output stream are connected by bounded single-producer/single-consumer
+ * frame rings, so every stage works on a different frame at the same time.
+ */
+static atomic_int pipeline_error;
+static pthread_t *pipeline_threads;
+static int nb_pipeline_threads;
+
+static void pipeline_abort(int err)
+{
+    int i, j;
+
+    atomic_compare_exchange_strong(&pipeline_error, &(int){ 0 }, err);
+    for (i = 0; i < nb_input_streams; i++)
+        if (input_streams[i]->pkt_ring)
+            frame_ring_abort(input_streams[i]->pkt_ring);
+    for (i = 0; i < nb_filtergraphs; i++)
+        for (j = 0; j < filtergraphs[i]->nb_inputs; j++)
+            if (filtergraphs[i]->inputs[j]->frame_ring)
+                frame_ring_abort(filtergraphs[i]->inputs[j]->frame_ring);
+    for (i = 0; i < nb_output_streams; i++)
+        if (output_streams[i]->frame_ring)
+            frame_ring_abort(output_streams[i]->frame_ring);
+}
+
+static void *decoder_thread(void *arg)
+{
+    InputStream *ist = arg;
+    AVPacket pkt;
+    int ret;
+
+    trace_thread_name("decoder #%d:%d", ist->file_index, ist->st->index);
+    mem_stats_enter(MEM_STAGE_DECODER);
+    av_init_packet(&pkt);
+    while ((ret = frame_ring_recv_packet(ist->pkt_ring, &pkt)) >= 0) {
+        ret = process_input_packet(ist, &pkt, 0);
+        av_packet_unref(&pkt);
+        if (ret < 0 && ret != AVERROR_EOF && ret != AVERROR_INVALIDDATA)
+            goto fail;
+    }
+    if (ret != AVERROR_EOF)
+        goto fail;
+
+    /* drain the decoder, the last call sends EOF to the filters */
+    while (process_input_packet(ist, NULL, 0) > 0)
+        ;
+    return NULL;
+
+fail:
+    if (ret != AVERROR_EXIT) {
+        av_log(NULL, AV_LOG_ERROR, "Decoding stream #%d:%d failed: %s\n",
+               ist->file_index, ist->st->index, av_err2str(ret));
+        pipeline_abort(ret);
+    }
+    return NULL;
+}
+
+/* Move every frame available in the buffersinks of fg to the encoder rings. */
+static int reap_filter_graph(FilterGraph *fg)
+{
+    int64_t pts;
+    int i, ret;
+
+    for (i = 0; i < fg->nb_outputs; i++) {
+        OutputStream *ost = fg->outputs[i]->ost;
+        StageProbe probe;
+        int64_t trace_start;
+
+        if (!ost->filtered_frame && !(ost->filtered_frame = alloc_stats_frame_alloc()))
+            return AVERROR(ENOMEM);
+        stage_probe_begin(&probe, MEM_STAGE_FILTER);
+        while ((ret = av_buffersink_get_frame_flags(fg->outputs[i]->filter, ost->filtered_frame,
+                                                    AV_BUFFERSINK_FLAG_NO_REQUEST)) >= 0) {
+            pts = ost->filtered_frame->pts;
+            stage_probe_end(&probe, ost->stats, ost->perf, STAGE_FILTER_PULL,
+                            "reap_filters", ost->index, pts);
+            trace_start = trace_begin();
+            if ((ret = frame_ring_send_frame(ost->frame_ring, ost->filtered_frame)) < 0) {
+                av_frame_unref(ost->filtered_frame);
+                return ret;
+            }
+            trace_end("frame_ring_send", ost->index, trace_start, pts);
+            stage_probe_begin(&probe, MEM_STAGE_FILTER);
+        }
+        stage_probe_cancel(&probe);
+        if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF)
+            return ret;
+    }
+    return 0;
+}
+
+static void *filter_thread(void *arg)
+{
+    FilterGraph *fg = arg;
+    AVFrame *frame = alloc_stats_frame_alloc();
+    uint8_t *eof = av_mallocz(fg->nb_inputs);
+    int i, ret = AVERROR(ENOMEM), nb_eof = 0;
+
+    if (!frame || !eof)
+        goto fail;
+
+    trace_thread_name("filter graph #%d", fg->index);
+    mem_stats_enter(MEM_STAGE_FILTER);
+    while (nb_eof < fg->nb_inputs) {
+        int got_frame = 0;
+
+        for (i = 0; i < fg->nb_inputs; i++) {
+            InputFilter *ifilter = fg->inputs[i];
+
+            if (eof[i])
+                continue;
+            /* with several inputs, poll so one starving input cannot stall the others */
+            if (fg->nb_inputs == 1)
+                ret = frame_ring_recv_frame(ifilter->frame_ring, frame);
+            else
+                ret = frame_ring_try_recv_frame(ifilter->frame_ring, frame);
+            if (ret == AVERROR(EAGAIN))
+                continue;
+            if (ret == AVERROR_EOF) {
+                eof[i] = 1;
+                nb_eof++;
+                ret = ifilter_push_eof(ifilter);
+            } else if (ret >= 0 && ifilter_bypass(ifilter, frame)) {
+                OutputStream *ost = fg->outputs[0]->ost;
+                int64_t trace_start = trace_begin();
+                int64_t pts = frame->pts;
+
+                got_frame = 1;
+                if ((ret = frame_ring_send_frame(ost->frame_ring, frame)) < 0) {
+                    av_frame_unref(frame);
+                    goto fail;
+                }
+                trace_end("frame_ring_send", ost->index, trace_start, pts);
+                continue;
+            } else if (ret >= 0) {
+                StageProbe probe;
+                int64_t pts = frame->pts;
+
+                got_frame = 1;
+                stage_probe_begin(&probe, MEM_STAGE_FILTER);
+                ret = ifilter_push_frame(ifilter, frame);
+                av_frame_unref(frame);
+                thread_share_add_time(fg->thread_share,
+                                      stage_probe_end(&probe, ifilter->ist->stats, ifilter->ist->perf,
+                                                      STAGE_FILTER_PUSH, "ifilter_push_frame",
+                                                      ifilter->ist->st->index, pts));
+            }
+            if (ret < 0 && ret != AVERROR_EOF)
+                goto fail;
+            if ((ret = reap_filter_graph(fg)) < 0)
+                goto fail;
+        }
+        if (!got_frame && nb_eof < fg->nb_inputs && fg->nb_inputs > 1)
+            av_usleep(100);
+    }
+
+    /* everything was sent, drain the graph */
+    while ((ret = avfilter_graph_request_oldest(fg->graph)) >= 0)
+        if ((ret = reap_filter_graph(fg)) < 0)
+            goto fail;
+    if (ret != AVERROR_EOF)
+        goto fail;
+    if ((ret = reap_filter_graph(fg)) < 0)
+        goto fail;
+
+    for (i = 0; i < fg->nb_outputs; i++)
+        frame_ring_set_eof(fg->outputs[i]->ost->frame_ring);
+    av_frame_free(&frame);
+    av_free(eof);
+    return NULL;
+
+fail:
+    if (ret != AVERROR_EXIT) {
+        av_log(NULL, AV_LOG_ERROR, "Filtering graph #%d failed: %s\n",
+               fg->index, av_err2str(ret));
+        pipeline_abort(ret);
+    }
+    av_frame_free(&frame);
+    av_free(eof);
+    return NULL;
+}
+
+static void *encoder_thread(void *arg)
+{
+    OutputStream *ost = arg;
+    OutputFile *of = output_files[ost->file_index];
+    AVFrame *frame = alloc_stats_frame_alloc();
+    int ret = AVERROR(ENOMEM);
+
+    if (!frame)
+        goto fail;
+
+    trace_thread_name("encoder #%d:%d", ost->file_index, ost->index);
+    mem_stats_enter(MEM_STAGE_ENCODER);
+    while ((ret = frame_ring_recv_frame(ost->frame_ring, frame)) >= 0) {
+        if (ost->finished) {
+            av_frame_unref(frame);
+            continue;
+        }
+        encode_filtered_frame(of, ost, frame);
+    }
+    if (ret != AVERROR_EOF)
+        goto fail;
+
+    flush_encoder(ost);
+    close_output_stream(ost);
+    av_frame_free(&frame);
+    return NULL;
+
+fail:
+    if (ret != AVERROR_EXIT) {
+        av_log(NULL, AV_LOG_ERROR, "Encoding stream #%d:%d failed: %s\n",
+               ost->file_index, ost->index, av_err2str(ret));
+        pipeline_abort(ret);
+    }
+    av_frame_free(&frame);
+    return NULL;
+}
+
+static int start_pipeline_thread(void *(*func)(void *), void *arg)
+{
+    int ret;
+
+    GROW_ARRAY(pipeline_threads, nb_pipeline_threads);
+    if ((ret = pthread_create(&pipeline_threads[nb_pipeline_threads - 1], NULL, func, arg))) {
+        nb_pipeline_threads--;
+        av_log(NULL, AV_LOG_ERROR, "pthread_create failed: %s\n", strerror(ret));
+        return AVERROR(ret);
+    }
+    return 0;
+}
+
+static void free_pipeline(void)
+{
+    int i, j;
+
+    for (i = 0; i < nb_pipeline_threads; i++)
+        pthread_join(pipeline_threads[i], NULL);
+    av_freep(&pipeline_threads);
+    nb_pipeline_threads = 0;
+
+    for (i = 0; i < nb_input_streams; i++)
+        frame_ring_free(&input_streams[i]->pkt_ring);
+    for (i = 0; i < nb_filtergraphs; i++)
+        for (j = 0; j < filtergraphs[i]->nb_inputs; j++)
+            frame_ring_free(&filtergraphs[i]->inputs[j]->frame_ring);
+    for (i = 0; i < nb_output_streams; i++)
+        frame_ring_free(&output_streams[i]->frame_ring);
+}
+
+static int init_pipeline(void)
+{
+    int i, j, ret;
+
+    atomic_store(&pipeline_error, 0);
+
+    for (i = 0; i < nb_output_streams; i++) {
+        OutputStream *ost = output_streams[i];
+        if (!ost->filter)
+            continue;
+        if ((ret = frame_ring_alloc(&ost->frame_ring, PIPELINE_QUEUE_SIZE, FRAME_RING_FRAME)) < 0)
+            return ret;
+    }
+    for (i = 0; i < nb_filtergraphs; i++) {
+        for (j = 0; j < filtergraphs[i]->nb_inputs; j++) {
+            ret = frame_ring_alloc(&filtergraphs[i]->inputs[j]->frame_ring,
+                                   PIPELINE_QUEUE_SIZE, FRAME_RING_FRAME);
+            if (ret < 0)
+                return ret;
+        }
+    }
+    for (i = 0; i < nb_input_streams; i++) {
+        InputStream *ist = input_streams[i];
+        if (!ist->decoding_needed)
+            continue;
+        if ((ret = frame_ring_alloc(&ist->pkt_ring, PIPELINE_QUEUE_SIZE, FRAME_RING_PACKET)) < 0)
+            return ret;
+    }
+
+    /* start the consumers first, so no ring fills up with nobody to drain it */
+    for (i = 0; i < nb_output_streams; i++)
+        if (output_streams[i]->frame_ring &&
+            (ret = start_pipeline_thread(encoder_thread, output_streams[i])) < 0)
+            return ret;
+    for (i = 0; i < nb_filtergraphs; i++)
+        if ((ret = start_pipeline_thread(filter_thread, filtergraphs[i])) < 0)
+            return ret;
+    for (i = 0; i < nb_input_streams; i++)
+        if (input_streams[i]->pkt_ring &&
+            (ret = start_pipeline_thread(decoder_thread, input_streams[i])) < 0)
+            return ret;
+    return 0;
+}
+
+/* Demux every input on the calling thread and dispatch to the decoder rings. */
+static int transcode_pipelined(void)
+{
+    int i, ret, nb_eof = 0;
+
+    if ((ret = init_pipeline()) < 0) {
+        pipeline_abort(ret);
+        goto end;
+    }
+
+    while (nb_eof < nb_input_files && !atomic_load(&pipeline_error)) {
+        if (progress_due(&progress))
+            print_report(0);
+        if (metrics_due(&metrics))
+            metrics_write(&metrics, 0);
+        if (mem_stats_due())
+            sample_memory();
+        for (i = 0; i < nb_input_files; i++) {
+            InputFile *ifile = input_files[i];
+            InputStream *ist;
+            AVPacket pkt;
+
+            if (ifile->eof_reached)
+                continue;
+            ret = get_input_packet(ifile, &pkt);
+            if (ret == AVERROR(EAGAIN))
+                continue;
+            if (ret < 0) {
+                ifile->eof_reached = 1;
+                nb_eof++;
+                continue;
+            }
+            if (do_pkt_dump)
+                av_pkt_dump_log2(NULL, AV_LOG_INFO, &pkt, 0, ifile->ctx->streams[pkt.stream_index]);
+            ist = input_streams[ifile->ist_index + pkt.stream_index];
+            if (ist->discard) {
+                av_packet_unref(&pkt);
+                continue;
+            }
+            if (!ist->pkt_ring) {
+                /* nothing to decode, stream copy is cheap enough to do here */
+                process_input_packet(ist, &pkt, 0);
+                av_packet_unref(&pkt);
+                continue;
+            }
+            if ((ret = frame_ring_send_packet(ist->pkt_ring, &pkt)) < 0) {
+                av_packet_unref(&pkt);
+                break;
+            }
+        }
+    }
+    for (i = 0; i < nb_input_streams; i++) {
+        if (input_streams[i]->pkt_ring)
+            frame_ring_set_eof(input_streams[i]->pkt_ring);
+        else
+            process_input_packet(input_streams[i], NULL, 0);
+    }
+
+end:
+    free_pipeline();
+    return atomic_load(&pipeline_error);
+}
+
 /*
  * The following code is the main loop of the file converter
  */
 int transcode(void)
 {
-    int ret, i;
+    int ret, i, err = 0;
     AVFormatContext *os;
     OutputStream *ost;
     InputStream *ist;
     
+    trace_thread_name("main");
     ret = transcode_init();
     if (ret < 0)
         goto fail;
-    while (need_output()) {
-        OutputStream *ost = NULL;
+
+    if ((ret = init_input_threads()) < 0)
+        goto fail;
+    if ((ret = init_mux_queues()) < 0)
+        goto fail;
+    progress_init(&progress, expected_duration(), stats_period);
+    mem_stats_reset();
+    metrics_init(&metrics, metrics_path, metrics_period);
+
+    if (pipeline_mode) {
+        if ((ret = transcode_pipelined()) < 0)
+            goto fail;
+        free_input_threads();
+        goto write_trailer;
+    }
+
+    if ((ret = output_scheduler_alloc(&output_sched, output_streams, nb_output_streams)) < 0)
+        goto fail;
+
+    /* always feed the output stream that is furthest behind in the muxer */
+    while ((ost = output_scheduler_next(output_sched))) {
         InputStream *ist = NULL;
-        for (int i = 0; i < nb_output_streams; i++) {
-            if (!output_streams[i]->finished) {
-                ost = output_streams[i];
-                break;
-            }
-        }
+        if (progress_due(&progress))
+            print_report(0);
+        if (metrics_due(&metrics))
+            metrics_write(&metrics, 0);
+        if (mem_stats_due())
+            sample_memory();
         if (ost->filter) {
             ret = avfilter_graph_request_oldest(ost->filter->graph->graph);
             if (ret >= 0) {
@@ -778,7 +1758,7 @@ int transcode(void)
             } else {
                 if (ret == AVERROR_EOF) {
                     for (int i = 0; i < ost->filter->graph->nb_outputs; i++) {
-                        ost->finished = ENCODER_FINISHED;
+                        close_output_stream(ost->filter->graph->outputs[i]->ost);
                     }
                     continue;
                 }
@@ -794,17 +1774,22 @@ int transcode(void)
                         ist = ifilter->ist;
                     }
                 }
+                if (!ist && ost->filter->graph->nb_inputs)
+                    ist = ost->filter->graph->inputs[0]->ist;
             }
+        } else {
+            ist = input_streams[ost->source_index];
         }
-        InputFile *ifile = input_files[0];
+        InputFile *ifile = input_files[ist ? ist->file_index : 0];
         AVPacket pkt;
-        ret = av_read_frame(ifile->ctx, &pkt);
+        ret = get_input_packet(ifile, &pkt);
         if (ret == AVERROR(EAGAIN)) {
             continue;
         }
         if (ret < 0) {
+            ifile->eof_reached = 1;
             for (int i = 0; i < ifile->nb_streams; i++) {
-                ist = input_streams[i];
+                ist = input_streams[ifile->ist_index + i];
                 ret = process_input_packet(ist, NULL, 0);
                 if (ret > 0) {
                     reap_filters(0);
@@ -813,8 +1798,9 @@ int transcode(void)
             }
             continue;
         }
-        av_pkt_dump_log2(NULL, AV_LOG_INFO, &pkt, 0, ifile->ctx->streams[pkt.stream_index]);
-        ist = input_streams[pkt.stream_index];
+        if (do_pkt_dump)
+            av_pkt_dump_log2(NULL, AV_LOG_INFO, &pkt, 0, ifile->ctx->streams[pkt.stream_index]);
+        ist = input_streams[ifile->ist_index + pkt.stream_index];
         process_input_packet(ist, &pkt, 0);
         av_packet_unref(&pkt);
         ret = reap_filters(0);
@@ -823,6 +1809,8 @@ int transcode(void)
         }
     }
     
+    free_input_threads();
+
     /* at the end of stream, we must flush the decoder buffers */
     for (i = 0; i < nb_input_streams; i++) {
         ist = input_streams[i];
@@ -831,13 +1819,24 @@ int transcode(void)
         }
     }
     flush_encoders();
+
+write_trailer:
     /* write the trailer if needed and close file */
     for (i = 0; i < nb_output_files; i++) {
         os = output_files[i]->ctx;
+        if ((ret = mux_queue_finish(output_files[i]->mux_queue)) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Error muxing %s: %s\n", os->filename, av_err2str(ret));
+            if (!err)
+                err = ret;
+        }
         if ((ret = av_write_trailer(os)) < 0) {
-            av_log(NULL, AV_LOG_ERROR, "Error writing trailer of %s: %s", os->filename, av_err2str(ret));
+            av_log(NULL, AV_LOG_ERROR, "Error writing trailer of %s: %s\n", os->filename, av_err2str(ret));
+            if (!err)
+                err = ret;
         }
     }
+    print_report(1);
+    metrics_write(&metrics, 1);
     
     /* close each encoder */
     for (i = 0; i < nb_output_streams; i++) {
@@ -854,20 +1853,67 @@ int transcode(void)
             avcodec_close(ist->dec_ctx);
         }
     }
+
+    {
+        uint64_t nb_decoded = 0;
+        for (i = 0; i < nb_input_streams; i++)
+            nb_decoded += input_streams[i]->frames_decoded;
+        alloc_stats_log(AV_LOG_DEBUG, nb_decoded);
+    }
+    mem_stats_log(AV_LOG_INFO);
+
+    for (i = 0; i < nb_input_streams; i++) {
+        char name[32];
+        ist = input_streams[i];
+        snprintf(name, sizeof(name), "input #%d:%d", ist->file_index, ist->st->index);
+        stage_stats_log(ist->stats, name, AV_LOG_INFO);
+        perf_stats_log(ist->perf, name, AV_LOG_INFO);
+    }
+    for (i = 0; i < nb_output_streams; i++) {
+        char name[32];
+        ost = output_streams[i];
+        snprintf(name, sizeof(name), "output #%d:%d", ost->file_index, ost->index);
+        stage_stats_log(ost->stats, name, AV_LOG_INFO);
+        perf_stats_log(ost->perf, name, AV_LOG_INFO);
+    }
     
-    /* finished ! */
-    ret = 0;
+    /* finished ! an output with a muxing error is not a success */
+    ret = err;
     
 fail:
-    
+    free_input_threads();
+    free_mux_queues();
+    output_scheduler_free(&output_sched);
+
     if (output_streams) {
         for (i = 0; i < nb_output_streams; i++) {
             ost = output_streams[i];
             if (ost) {
+                av_frame_free(&ost->filtered_frame);
                 av_dict_free(&ost->encoder_opts);
+                if (ost->bitstream_filters)
+                    av_bitstream_filter_close(ost->bitstream_filters);
+                ost->bitstream_filters = NULL;
+                stage_stats_free(&ost->stats);
+                perf_stats_free(&ost->perf);
             }
         }
     }
+    for (i = 0; i < nb_input_streams; i++) {
+        ist = input_streams[i];
+        av_frame_free(&ist->decoded_frame);
+        av_frame_free(&ist->filter_frame);
+        frame_pool_free(&ist->frame_pool);
+        stage_stats_free(&ist->stats);
+        perf_stats_free(&ist->perf);
+    }
+    thread_budget_log(AV_LOG_VERBOSE);
+    for (i = 0; i < nb_input_streams; i++)
+        thread_budget_release(&input_streams[i]->thread_share);
+    for (i = 0; i < nb_output_streams; i++)
+        thread_budget_release(&output_streams[i]->thread_share);
+    for (i = 0; i < nb_filtergraphs; i++)
+        thread_budget_release(&filtergraphs[i]->thread_share);
     return ret;
 }
 
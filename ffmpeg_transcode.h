@@ -13,4 +13,7 @@
 #include "ffmpeg.h"
 
 int transcode(void);
+
+/* fill in the default layout for the channel count if the decoder has none */
+int guess_input_channel_layout(InputStream *ist);
 #endif /* ffmpeg_transcode_h */
@@ -0,0 +1,39 @@
+//
+//  alloc_stats.c
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#include <inttypes.h>
+#include <stdatomic.h>
+
+#define ALLOC_STATS_NO_WRAP
+#include "alloc_stats.h"
+#include "libavutil/log.h"
+
+static atomic_uint nb_frame_allocs;
+
+AVFrame *alloc_stats_frame_alloc(void)
+{
+    atomic_fetch_add_explicit(&nb_frame_allocs, 1, memory_order_relaxed);
+    return av_frame_alloc();
+}
+
+AVFrame *alloc_stats_frame_clone(const AVFrame *src)
+{
+    atomic_fetch_add_explicit(&nb_frame_allocs, 1, memory_order_relaxed);
+    return av_frame_clone(src);
+}
+
+unsigned alloc_stats_nb_frames(void)
+{
+    return atomic_load_explicit(&nb_frame_allocs, memory_order_relaxed);
+}
+
+void alloc_stats_log(int level, uint64_t nb_decoded)
+{
+    av_log(NULL, level, "%u AVFrames allocated for %"PRIu64" decoded frames\n",
+           alloc_stats_nb_frames(), nb_decoded);
+}
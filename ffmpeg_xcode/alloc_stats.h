@@ -0,0 +1,45 @@
+//
+//  alloc_stats.h
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#ifndef alloc_stats_h
+#define alloc_stats_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include "libavutil/frame.h"
+
+/**
+ * av_frame_alloc() for frames the transcode loop keeps on its streams.
+ * Every call is counted, so once all streams are set up the count must
+ * stay constant however many frames go through; a count that grows with
+ * the frame count means something allocates per frame.
+ */
+AVFrame *alloc_stats_frame_alloc(void);
+
+/* av_frame_clone(), counted the same way */
+AVFrame *alloc_stats_frame_clone(const AVFrame *src);
+
+/* number of AVFrames the transcoder sources allocated so far */
+unsigned alloc_stats_nb_frames(void);
+
+/* log the allocation count against the number of frames decoded */
+void alloc_stats_log(int level, uint64_t nb_decoded);
+
+/*
+ * Every source including this header gets its av_frame_alloc() and
+ * av_frame_clone() calls counted, so a per-frame allocation added to
+ * the transcode loop shows up without anyone remembering to use the
+ * wrappers. Frames allocated inside libavcodec/libavfilter are not
+ * counted; those are theirs to recycle.
+ */
+#ifndef ALLOC_STATS_NO_WRAP
+#define av_frame_alloc()    alloc_stats_frame_alloc()
+#define av_frame_clone(src) alloc_stats_frame_clone(src)
+#endif
+
+#endif /* alloc_stats_h */
@@ -0,0 +1,297 @@
+//
+//  async_log.c
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "async_log.h"
+#include "libavutil/avstring.h"
+#include "libavutil/avutil.h"
+#include "libavutil/log.h"
+#include "libavutil/mem.h"
+#include "libavutil/time.h"
+
+#define RATE_TABLE_SIZE 64
+#define RATE_WINDOW     1000000
+
+typedef struct LogSlot {
+    atomic_size_t seq;      /* == position + 1 once filled, position + nb_slots once free */
+    int64_t time;
+    char line[ASYNC_LOG_LINE_SIZE];
+} LogSlot;
+
+/* budget of one repeated line, entries may be shared by colliding lines */
+typedef struct RateEntry {
+    pthread_mutex_t lock;
+    uint64_t hash;          /* of the level and the formatted line */
+    int64_t window_start;
+    int count;
+    int suppressed;
+    char sample[48];        /* start of the line, for the report */
+} RateEntry;
+
+static LogSlot *slots;
+static size_t mask;
+static atomic_size_t tail;          /* next position claimed by a producer */
+static atomic_size_t head;          /* next position read by the writer */
+static atomic_uint nb_dropped;
+static atomic_int stop_request;
+static atomic_int running;
+static pthread_t writer;
+static int64_t start_time;
+static int log_flags;
+static RateEntry rate_table[RATE_TABLE_SIZE];
+static _Thread_local int print_prefix = 1;
+
+static void reset_ring(void)
+{
+    for (size_t i = 0; i <= mask; i++)
+        atomic_init(&slots[i].seq, i);
+    atomic_init(&tail, 0);
+    atomic_init(&head, 0);
+    atomic_init(&nb_dropped, 0);
+    atomic_init(&stop_request, 0);
+}
+
+static void init_rate_table(void)
+{
+    memset(rate_table, 0, sizeof(rate_table));
+    for (int i = 0; i < RATE_TABLE_SIZE; i++)
+        pthread_mutex_init(&rate_table[i].lock, NULL);
+}
+
+static void push_line(const char *line);
+
+/* report what the line of e had suppressed in the window that just ended, e->lock held */
+static void report_suppressed(RateEntry *e)
+{
+    char line[128];
+
+    if (!e->suppressed)
+        return;
+    snprintf(line, sizeof(line), "    (%d more lines like \"%s\" suppressed)\n",
+             e->suppressed, e->sample);
+    e->suppressed = 0;
+    push_line(line);
+}
+
+/* only the entries whose window ended, unless all */
+static void report_all_suppressed(int all)
+{
+    int64_t now = av_gettime_relative();
+
+    for (int i = 0; i < RATE_TABLE_SIZE; i++) {
+        RateEntry *e = &rate_table[i];
+
+        pthread_mutex_lock(&e->lock);
+        if (all || now - e->window_start >= RATE_WINDOW)
+            report_suppressed(e);
+        pthread_mutex_unlock(&e->lock);
+    }
+}
+
+static void push_line(const char *line)
+{
+    size_t pos = atomic_load_explicit(&tail, memory_order_relaxed);
+    LogSlot *slot;
+
+    while (1) {
+        intptr_t diff;
+
+        slot = &slots[pos & mask];
+        diff = (intptr_t) atomic_load_explicit(&slot->seq, memory_order_acquire) - (intptr_t) pos;
+        if (!diff) {
+            if (atomic_compare_exchange_weak_explicit(&tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            /* the writer is a whole ring behind */
+            atomic_fetch_add_explicit(&nb_dropped, 1, memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&tail, memory_order_relaxed);
+        }
+    }
+    slot->time = av_gettime_relative() - start_time;
+    av_strlcpy(slot->line, line, sizeof(slot->line));
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+}
+
+/* FNV-1a */
+static uint64_t hash_line(int level, const char *line)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL ^ (unsigned) level;
+
+    for (; *line; line++)
+        hash = (hash ^ (uint8_t) *line) * 0x100000001b3ULL;
+    return hash;
+}
+
+/* Return 1 if line is still within its budget for the current window. */
+static int rate_check(int level, const char *line)
+{
+    uint64_t hash = hash_line(level, line);
+    RateEntry *e = &rate_table[hash % RATE_TABLE_SIZE];
+    int64_t now = av_gettime_relative();
+    int ret = 1;
+
+    pthread_mutex_lock(&e->lock);
+    if (e->hash != hash || now - e->window_start >= RATE_WINDOW) {
+        report_suppressed(e);
+        e->hash         = hash;
+        e->window_start = now;
+        e->count        = 1;
+        av_strlcpy(e->sample, line, FFMIN(sizeof(e->sample), strcspn(line, "\n") + 1));
+    } else if (e->count++ >= ASYNC_LOG_BURST) {
+        e->suppressed++;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&e->lock);
+    return ret;
+}
+
+static void log_callback(void *avcl, int level, const char *fmt, va_list vl)
+{
+    char line[ASYNC_LOG_LINE_SIZE];
+    int line_start = print_prefix;
+
+    if (level > av_log_get_level())
+        return;
+    av_log_format_line(avcl, level, fmt, vl, line, sizeof(line), &print_prefix);
+    /*
+     * warnings and errors always go through, and so do the pieces of a
+     * line built by several calls, e.g. by av_dump_format()
+     */
+    if (level > AV_LOG_WARNING && line_start && print_prefix && !rate_check(level, line))
+        return;
+    push_line(line);
+}
+
+static void write_slot(LogSlot *slot, int *line_start)
+{
+    size_t len = strlen(slot->line);
+
+    if (log_flags & ASYNC_LOG_TIMESTAMPS && *line_start)
+        fprintf(stderr, "[%10.6f] ", slot->time / 1000000.0);
+    fputs(slot->line, stderr);
+    *line_start = len && slot->line[len - 1] == '\n';
+}
+
+static void *writer_thread(void *arg)
+{
+    int line_start = 1, idle = 0;
+
+    while (1) {
+        size_t pos = atomic_load_explicit(&head, memory_order_relaxed);
+        LogSlot *slot = &slots[pos & mask];
+        unsigned dropped;
+
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + 1) {
+            if (atomic_load(&stop_request))
+                break;
+            if ((dropped = atomic_exchange(&nb_dropped, 0)))
+                fprintf(stderr, "%u log lines dropped, the log ring was full\n", dropped);
+            /* lines that went quiet would never report their suppressed repeats */
+            report_all_suppressed(0);
+            if (!idle++)
+                fflush(stderr);
+            av_usleep(idle < 16 ? 100 : 2000);
+            continue;
+        }
+        idle = 0;
+        write_slot(slot, &line_start);
+        atomic_store_explicit(&slot->seq, pos + mask + 1, memory_order_release);
+        atomic_store_explicit(&head, pos + 1, memory_order_release);
+    }
+    fflush(stderr);
+    return NULL;
+}
+
+static int start_writer(void)
+{
+    int ret;
+
+    if ((ret = pthread_create(&writer, NULL, writer_thread, NULL))) {
+        av_log_set_callback(av_log_default_callback);
+        av_log(NULL, AV_LOG_ERROR, "Could not start the log writer: %s\n", strerror(ret));
+        return AVERROR(ret);
+    }
+    atomic_store(&running, 1);
+    return 0;
+}
+
+/* only the forking thread survives: no line is half pushed, drop what the parent writes */
+static void atfork_child(void)
+{
+    if (!atomic_load(&running))
+        return;
+    atomic_store(&running, 0);
+    reset_ring();
+    /* a thread that is gone may have held an entry */
+    init_rate_table();
+    start_writer();
+}
+
+static void atfork_prepare(void)
+{
+    async_log_flush();
+}
+
+int async_log_start(unsigned nb_slots, int flags)
+{
+    static int registered;
+    size_t size = 1;
+
+    if (atomic_load(&running))
+        return 0;
+    while (size < nb_slots)
+        size <<= 1;
+    /* kept after async_log_stop(), a late caller may still be pushing */
+    if (!slots) {
+        if (!(slots = av_malloc_array(size, sizeof(*slots))))
+            return AVERROR(ENOMEM);
+        mask = size - 1;
+    }
+    log_flags  = flags;
+    start_time = av_gettime_relative();
+    reset_ring();
+    if (!registered) {
+        init_rate_table();
+        pthread_atfork(atfork_prepare, NULL, atfork_child);
+        atexit(async_log_stop);
+        registered = 1;
+    }
+    av_log_set_callback(log_callback);
+    return start_writer();
+}
+
+void async_log_flush(void)
+{
+    size_t target = atomic_load(&tail);
+
+    if (!atomic_load(&running))
+        return;
+    while (atomic_load_explicit(&head, memory_order_acquire) < target)
+        av_usleep(100);
+    fflush(stderr);
+}
+
+void async_log_stop(void)
+{
+    if (!atomic_load(&running))
+        return;
+    report_all_suppressed(1);
+    async_log_flush();
+    av_log_set_callback(av_log_default_callback);
+    atomic_store(&stop_request, 1);
+    pthread_join(writer, NULL);
+    atomic_store(&running, 0);
+}
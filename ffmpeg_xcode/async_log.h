@@ -0,0 +1,43 @@
+//
+//  async_log.h
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#ifndef async_log_h
+#define async_log_h
+
+#include <stdio.h>
+
+#define ASYNC_LOG_DEFAULT_SLOTS 1024    /* lines the ring holds, a power of two */
+#define ASYNC_LOG_LINE_SIZE     1024    /* longer lines are truncated */
+#define ASYNC_LOG_BURST         20      /* repeats of one line per second */
+
+/* prefix every line with the seconds since async_log_start() */
+#define ASYNC_LOG_TIMESTAMPS 1
+
+/**
+ * av_log() callback that formats the line on the calling thread and hands
+ * it to a writer thread through a bounded lock-free multi-producer ring,
+ * so codec and pipeline threads never wait for stderr or for each other.
+ *
+ * When the ring is full the line is dropped and counted rather than
+ * blocking the caller. The same line, at the same level and from the same
+ * context, may repeat ASYNC_LOG_BURST times per second; the rest are
+ * counted and reported as suppressed. Warnings and errors are never
+ * suppressed.
+ *
+ * The ring is drained at exit. A forked child starts with an empty ring
+ * and its own writer; call async_log_flush() before _exit().
+ */
+int async_log_start(unsigned nb_slots, int flags);
+
+/* Wait until every line logged so far has been written. */
+void async_log_flush(void);
+
+/* Flush, stop the writer and restore the default av_log() callback. */
+void async_log_stop(void);
+
+#endif /* async_log_h */
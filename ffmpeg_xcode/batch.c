@@ -0,0 +1,192 @@
+//
+//  batch.c
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "batch.h"
+#include "thread_budget.h"
+#include "async_log.h"
+#include "scaler_profile.h"
+#include "libavutil/avstring.h"
+#include "libavutil/avutil.h"
+#include "libavutil/common.h"
+#include "libavutil/cpu.h"
+#include "libavutil/error.h"
+#include "libavutil/log.h"
+#include "libavutil/mem.h"
+
+#define MANIFEST_SEPARATORS " \t\r\n"
+
+static int parse_job(BatchJob *job, char *line, const char *filename, int line_no)
+{
+    char *saveptr = NULL;
+    char *fields[6] = { NULL };
+    int nb_fields = 0;
+    char *tok;
+
+    /* the caller frees whatever the job holds, even when parsing fails */
+    memset(job, 0, sizeof(*job));
+    job->start_time = AV_NOPTS_VALUE;
+    job->stop_time  = AV_NOPTS_VALUE;
+    for (tok = av_strtok(line, MANIFEST_SEPARATORS, &saveptr); tok && nb_fields < 6;
+         tok = av_strtok(NULL, MANIFEST_SEPARATORS, &saveptr))
+        fields[nb_fields++] = tok;
+    if (nb_fields < 2 || nb_fields == 3) {
+        av_log(NULL, AV_LOG_ERROR, "%s:%d: expected 'input output [width height [codec [scaler]]]'\n",
+               filename, line_no);
+        return AVERROR(EINVAL);
+    }
+
+    job->input  = av_strdup(fields[0]);
+    job->output = av_strdup(fields[1]);
+    if (nb_fields > 3) {
+        job->width  = strtol(fields[2], NULL, 10);
+        job->height = strtol(fields[3], NULL, 10);
+    }
+    if (nb_fields > 4 && strcmp(fields[4], "-"))
+        job->video_codec = av_strdup(fields[4]);
+    if (nb_fields > 5 && strcmp(fields[5], "-")) {
+        if (scaler_profile_check(fields[5]) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "%s:%d: invalid scaler\n", filename, line_no);
+            return AVERROR(EINVAL);
+        }
+        if (!(job->scaler = av_strdup(fields[5])))
+            return AVERROR(ENOMEM);
+    }
+    if (!job->input || !job->output || (nb_fields > 4 && strcmp(fields[4], "-") && !job->video_codec))
+        return AVERROR(ENOMEM);
+    return 0;
+}
+
+int batch_read_manifest(const char *filename, BatchJob **jobs, int *nb_jobs)
+{
+    FILE *f = fopen(filename, "r");
+    char line[4096];
+    int line_no = 0, ret = 0;
+
+    *jobs = NULL;
+    *nb_jobs = 0;
+    if (!f) {
+        ret = AVERROR(errno);
+        av_log(NULL, AV_LOG_ERROR, "Could not open manifest %s: %s\n", filename, av_err2str(ret));
+        return ret;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        const char *p = line + strspn(line, MANIFEST_SEPARATORS);
+        BatchJob *tmp;
+
+        line_no++;
+        if (!*p || *p == '#')
+            continue;
+        if (!(tmp = av_realloc_array(*jobs, *nb_jobs + 1, sizeof(**jobs)))) {
+            ret = AVERROR(ENOMEM);
+            break;
+        }
+        *jobs = tmp;
+        ret = parse_job(&(*jobs)[*nb_jobs], line, filename, line_no);
+        (*nb_jobs)++;
+        if (ret < 0)
+            break;
+    }
+    fclose(f);
+
+    if (ret < 0)
+        batch_free_jobs(jobs, nb_jobs);
+    return ret;
+}
+
+void batch_free_jobs(BatchJob **jobs, int *nb_jobs)
+{
+    for (int i = 0; i < *nb_jobs; i++) {
+        av_freep(&(*jobs)[i].input);
+        av_freep(&(*jobs)[i].output);
+        av_freep(&(*jobs)[i].video_codec);
+        av_freep(&(*jobs)[i].scaler);
+    }
+    av_freep(jobs);
+    *nb_jobs = 0;
+}
+
+/* wait for one worker, return 1 if its job failed */
+static int reap_worker(pid_t *pids, const BatchJob *jobs, int nb_jobs)
+{
+    int status;
+    pid_t pid;
+
+    while ((pid = waitpid(-1, &status, 0)) < 0 && errno == EINTR)
+        ;
+    if (pid < 0)
+        return 0;
+    for (int i = 0; i < nb_jobs; i++) {
+        if (pids[i] != pid)
+            continue;
+        pids[i] = 0;
+        if (WIFEXITED(status) && !WEXITSTATUS(status)) {
+            av_log(NULL, AV_LOG_INFO, "[%d/%d] %s -> %s done\n", i + 1, nb_jobs,
+                   jobs[i].input, jobs[i].output);
+            return 0;
+        }
+        av_log(NULL, AV_LOG_ERROR, "[%d/%d] %s -> %s failed (%s %d)\n", i + 1, nb_jobs,
+               jobs[i].input, jobs[i].output,
+               WIFEXITED(status) ? "exit status" : "signal",
+               WIFEXITED(status) ? WEXITSTATUS(status) : WTERMSIG(status));
+        return 1;
+    }
+    return 0;
+}
+
+int batch_run(const BatchJob *jobs, int nb_jobs, int max_workers,
+              int (*run_job)(const BatchJob *job, void *opaque), void *opaque)
+{
+    pid_t *pids;
+    int i, nb_running = 0, nb_failed = 0, nb_cores = thread_budget_cores();
+
+    if (max_workers <= 0)
+        max_workers = av_cpu_count();
+    if (!(pids = av_mallocz_array(FFMAX(nb_jobs, 1), sizeof(*pids))))
+        return AVERROR(ENOMEM);
+
+    av_log(NULL, AV_LOG_INFO, "Running %d jobs, %d at a time\n", nb_jobs, max_workers);
+    fflush(stdout);
+    fflush(stderr);
+
+    for (i = 0; i < nb_jobs; i++) {
+        pid_t pid;
+
+        if (nb_running >= max_workers) {
+            nb_failed += reap_worker(pids, jobs, nb_jobs);
+            nb_running--;
+        }
+        if ((pid = fork()) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "fork failed: %s\n", strerror(errno));
+            nb_failed++;
+            continue;
+        }
+        if (!pid) {
+            /* every worker gets an equal slice of the cores, -threads included */
+            thread_budget_set_cores(FFMAX(nb_cores / max_workers, 1));
+            int ret = run_job(&jobs[i], opaque);
+            /* _exit() skips the atexit handlers */
+            async_log_flush();
+            _exit(ret < 0);
+        }
+        pids[i] = pid;
+        nb_running++;
+    }
+    while (nb_running-- > 0)
+        nb_failed += reap_worker(pids, jobs, nb_jobs);
+
+    av_free(pids);
+    return nb_failed;
+}
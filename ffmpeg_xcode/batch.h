@@ -0,0 +1,52 @@
+//
+//  batch.h
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#ifndef batch_h
+#define batch_h
+
+#include <stdio.h>
+#include <stdint.h>
+
+typedef struct BatchJob {
+    char *input;
+    char *output;
+    int width;              /* <= 0 keeps the input size */
+    int height;
+    char *video_codec;      /* NULL for the program's default encoder */
+    char *scaler;           /* scaler profile, NULL for the program's default */
+    int64_t start_time;     /* AV_TIME_BASE units, AV_NOPTS_VALUE for the whole input */
+    int64_t stop_time;
+} BatchJob;
+
+/**
+ * Read a job manifest, one job per line:
+ *
+ *     input output [width height [video_codec [scaler]]]
+ *
+ * Fields are separated by blanks, a width or height of 0 and a codec or
+ * scaler of "-" keep the defaults, see scaler_profile.h for the scaler.
+ * Empty lines and lines starting with '#' are skipped.
+ */
+int batch_read_manifest(const char *filename, BatchJob **jobs, int *nb_jobs);
+void batch_free_jobs(BatchJob **jobs, int *nb_jobs);
+
+/**
+ * Run every job, at most max_workers at the same time.
+ *
+ * The transcoders keep their state in globals, so each job runs in a
+ * child process of its own; run_job is called in the child and its
+ * return value decides the exit status. max_workers <= 0 uses one
+ * worker per CPU. Each worker's thread budget is an equal slice of the
+ * CPUs.
+ *
+ * @return the number of failed jobs, or a negative error code
+ */
+int batch_run(const BatchJob *jobs, int nb_jobs, int max_workers,
+              int (*run_job)(const BatchJob *job, void *opaque), void *opaque);
+
+#endif /* batch_h */
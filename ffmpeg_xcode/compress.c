@@ -7,9 +7,11 @@
 //
 
 #include "compress.h"
+#include "alloc_stats.h"
 
 int get_buffer(AVCodecContext *s, AVFrame *frame, int flags) {
-    return avcodec_default_get_buffer2(s, frame, flags);
+    InputStream *ist = s->opaque;
+    return frame_pool_get_buffer(ist->frame_pool, s, frame, flags);
 }
 
 int transcode_init(void) {
@@ -56,8 +58,12 @@ int transcode_init(void) {
     }
     for (int i = 0; i < nb_input_streams; i++) {
         InputStream *ist = input_streams[i];
+        if ((ret = frame_pool_alloc(&ist->frame_pool)) < 0) {
+            return ret;
+        }
         ist->dec_ctx->opaque = ist;
         ist->dec_ctx->get_buffer2 = get_buffer;
+        ist->dec_ctx->thread_safe_callbacks = 1;
         if ((ret = avcodec_open2(ist->dec_ctx, ist->dec, NULL)) < 0) {
             return ret;
         }
@@ -147,12 +153,12 @@ int do_audio_out(AVFormatContext *oc, OutputStream *ost, AVFrame *next_picture)
 int reap_filters() {
     int ret = 0;
     for (int i = 0; i < nb_output_streams; i++) {
-        AVFrame *frame = av_frame_alloc();
         OutputStream *ost = output_streams[i];
-        if (!ost->filtered_frame && !(ost->filtered_frame = av_frame_alloc())) {
+        AVFrame *frame;
+        if (!ost->filtered_frame && !(ost->filtered_frame = alloc_stats_frame_alloc())) {
             return AVERROR(ENOMEM);
         }
-//        frame = ost->filtered_frame;
+        frame = ost->filtered_frame;
         while (1) {
             ret = av_buffersink_get_frame_flags(ost->filter->filter, frame, AV_BUFFERSINK_FLAG_NO_REQUEST);
             if (ret < 0) {
@@ -186,9 +192,14 @@ int reap_filters() {
 
 int decode_video(InputStream *ist, AVPacket *pkt, int *got_output) {
     int ret = 0;
-    AVFrame *frame = av_frame_alloc();
+    AVFrame *frame;
+    if (!ist->decoded_frame && !(ist->decoded_frame = alloc_stats_frame_alloc())) {
+        return AVERROR(ENOMEM);
+    }
+    frame = ist->decoded_frame;
     ret = avcodec_decode_video2(ist->dec_ctx, frame, got_output, pkt);
     if (!*got_output || ret < 0) {
+        av_frame_unref(frame);
         return ret;
     }
     pkt->size = 0;
@@ -196,27 +207,29 @@ int decode_video(InputStream *ist, AVPacket *pkt, int *got_output) {
         frame->sample_aspect_ratio = ist->st->sample_aspect_ratio;
     }
     ret = av_buffersrc_add_frame_flags(ist->filter->filter, frame, AV_BUFFERSRC_FLAG_PUSH);
-    if (ret != AVERROR_EOF && ret < 0) {
-        return ret;
-    }
     av_frame_unref(frame);
     return ret;
 }
 
 int decode_audio(InputStream *ist, AVPacket *pkt, int *got_output) {
     int ret = 0;
-    AVFrame *frame = av_frame_alloc();
+    AVFrame *frame;
+    if (!ist->decoded_frame && !(ist->decoded_frame = alloc_stats_frame_alloc())) {
+        return AVERROR(ENOMEM);
+    }
+    frame = ist->decoded_frame;
     ret = avcodec_decode_audio4(ist->dec_ctx, frame, got_output, pkt);
     if (!*got_output || ret < 0) {
+        av_frame_unref(frame);
         return ret;
     }
     ret = av_buffersrc_add_frame_flags(ist->filter->filter, frame, AV_BUFFERSRC_FLAG_PUSH);
+    av_frame_unref(frame);
     if (ret == AVERROR_EOF) {
         ret = 0;
     } else if (ret < 0) {
         return ret;
     }
-    av_frame_unref(frame);
     return ret;
 }
 
@@ -371,6 +384,11 @@ int transcode(void) {
     }
     for (int i = 0; i < nb_input_streams; i++) {
         avcodec_close(input_streams[i]->dec_ctx);
+        frame_pool_free(&input_streams[i]->frame_pool);
+        av_frame_free(&input_streams[i]->decoded_frame);
+    }
+    for (int i = 0; i < nb_output_streams; i++) {
+        av_frame_free(&output_streams[i]->filtered_frame);
     }
     avformat_close_input(&input_file->ic);
     avformat_free_context(input_file->ic);
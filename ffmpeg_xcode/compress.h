@@ -13,6 +13,7 @@
 #include "libavfilter/buffersink.h"
 #include "libavfilter/buffersrc.h"
 #include "video_filter.h"
+#include "alloc_stats.h"
 
 int transcode();
 #endif /* compress_h */
@@ -3,6 +3,9 @@
 //
 
 #include "compress_.h"
+#include "alloc_stats.h"
+#include "async_log.h"
+#include "scaler_profile.h"
 
 InputFile *input_file = NULL;
 InputStream **input_streams = NULL;
@@ -10,6 +13,8 @@ int nb_input_streams = 0;
 OutputFile *output_file = NULL;
 OutputStream **output_streams = NULL;
 int nb_output_streams = 0;
+int do_pkt_dump = 0;
+const char *scaler_profile = NULL;
 
 void *grow_array(void *array, int elem_size, int *size, int new_size) {
     if (new_size > INT_MAX / elem_size) {
@@ -237,9 +242,14 @@ int configure_output_video_filter(FilterGraph *graph, AVFilterInOut *out) {
     AVFilterContext *scale_context = NULL;
     if (graph->output->ost->enc_ctx->width || graph->output->ost->enc_ctx->height) {
         AVFilter *scale_filter = avfilter_get_by_name("scale");
+        AVCodecContext *dec_ctx = graph->input->ist->dec_ctx;
+        AVCodecContext *enc_ctx = graph->output->ost->enc_ctx;
+        char flags[64];
         AVBPrint args;
         av_bprint_init(&args, 0, AV_BPRINT_SIZE_AUTOMATIC);
-        av_bprintf(&args, "%d:%d", graph->output->ost->enc_ctx->width, graph->output->ost->enc_ctx->height);
+        av_bprintf(&args, "%d:%d:flags=%s", enc_ctx->width, enc_ctx->height,
+                   scaler_profile_flags(scaler_profile, dec_ctx->width, dec_ctx->height,
+                                        enc_ctx->width, enc_ctx->height, flags, sizeof(flags)));
         ret = avfilter_graph_create_filter(&scale_context, scale_filter, "scale", args.str, NULL, graph->graph);
         if (ret < 0) {
             av_err2str(ret);
@@ -423,12 +433,9 @@ FilterGraph* init_filtergraph(InputStream *ist, OutputStream *ost) {
     return graph;
 }
 
-void log_callback(void *ptr, int level, const char *fmt, va_list vl) {
-    printf("fmt %s", fmt);
-}
-
 int get_buffer(AVCodecContext *s, AVFrame *frame, int flags) {
-    return avcodec_default_get_buffer2(s, frame, flags);
+    InputStream *ist = s->opaque;
+    return frame_pool_get_buffer(ist->frame_pool, s, frame, flags);
 }
 
 int transcode_init() {
@@ -473,8 +480,13 @@ int transcode_init() {
     }
     for (int i = 0; i < nb_input_streams; ++i) {
         InputStream *ist = input_streams[i];
+        if ((ret = frame_pool_alloc(&ist->frame_pool)) < 0) {
+            av_err2str(ret);
+            return ret;
+        }
         ist->dec_ctx->opaque = ist;
         ist->dec_ctx->get_buffer2 = get_buffer;
+        ist->dec_ctx->thread_safe_callbacks = 1;
         if ((ret = avcodec_open2(ist->dec_ctx, ist->dec, NULL)) < 0) {
             av_err2str(ret);
             return ret;
@@ -497,6 +509,11 @@ int transcode_init() {
         av_err2str(ret);
         return ret;
     }
+    size_t mux_queue_size = output_file->mux_queue_size ? output_file->mux_queue_size : MUX_QUEUE_DEFAULT_SIZE;
+    if ((ret = mux_queue_alloc(&output_file->mux_queue, output_file->oc, mux_queue_size)) < 0) {
+        av_err2str(ret);
+        return ret;
+    }
     return ret;
 }
 
@@ -513,37 +530,47 @@ int need_output() {
 
 int decode_video(InputStream *ist, AVPacket *pkt, int *got_output) {
     int ret = 0;
-    AVFrame *frame = av_frame_alloc();
+    if (!ist->decoded_frame && !(ist->decoded_frame = alloc_stats_frame_alloc())) {
+        return AVERROR(ENOMEM);
+    }
+    AVFrame *frame = ist->decoded_frame;
     ret = avcodec_decode_video2(ist->dec_ctx, frame, got_output, pkt);
     if (!*got_output || ret < 0) {
+        av_frame_unref(frame);
         return ret;
     }
+    ist->frames_decoded++;
     pkt->size = 0;
     if (ist->st->sample_aspect_ratio.num) {
         frame->sample_aspect_ratio = ist->st->sample_aspect_ratio;
     }
     ret = av_buffersrc_add_frame_flags(ist->filter->filter, frame, AV_BUFFERSRC_FLAG_PUSH);
+    av_frame_unref(frame);
     if (ret != AVERROR_EOF && ret < 0) {
         return ret;
     }
-    av_frame_unref(frame);
     return ret;
 }
 
 int decode_audio(InputStream *ist, AVPacket *pkt, int *got_output) {
     int ret = 0;
-    AVFrame *frame = av_frame_alloc();
+    if (!ist->decoded_frame && !(ist->decoded_frame = alloc_stats_frame_alloc())) {
+        return AVERROR(ENOMEM);
+    }
+    AVFrame *frame = ist->decoded_frame;
     ret = avcodec_decode_audio4(ist->dec_ctx, frame, got_output, pkt);
     if (!*got_output || ret < 0) {
+        av_frame_unref(frame);
         return ret;
     }
+    ist->frames_decoded++;
     ret = av_buffersrc_add_frame_flags(ist->filter->filter, frame, AV_BUFFERSRC_FLAG_PUSH);
+    av_frame_unref(frame);
     if (ret == AVERROR_EOF) {
         ret = 0;
     } else if (ret < 0) {
         return ret;
     }
-    av_frame_unref(frame);
     return ret;
 }
 
@@ -559,7 +586,6 @@ int process_input_packet(InputStream *ist, AVPacket *pkt) {
         avpkt = *pkt;
     }
     int got_output = 0;
-    AVFrame *frame = av_frame_alloc();
     switch (ist->dec_ctx->codec_type) {
         case AVMEDIA_TYPE_VIDEO:
             ret = decode_video(ist, &avpkt, &got_output);
@@ -570,7 +596,6 @@ int process_input_packet(InputStream *ist, AVPacket *pkt) {
         default:
             break;
     }
-    av_frame_unref(frame);
     if (ret < 0) {
         av_err2str(ret);
         return ret;
@@ -588,6 +613,13 @@ int process_input_packet(InputStream *ist, AVPacket *pkt) {
     return got_output;
 }
 
+int write_frame(OutputStream *ost, AVPacket *pkt) {
+    if (output_file->mux_queue) {
+        return mux_queue_send(output_file->mux_queue, pkt);
+    }
+    return av_interleaved_write_frame(output_file->oc, pkt);
+}
+
 int do_video_out(OutputStream *ost, AVFrame *next_picture) {
     int ret = 0;
     AVPacket pkt;
@@ -610,7 +642,7 @@ int do_video_out(OutputStream *ost, AVFrame *next_picture) {
         }
         av_packet_rescale_ts(&pkt, ost->enc_ctx->time_base, ost->st->time_base);
         pkt.stream_index = ost->source_index;
-        ret = av_interleaved_write_frame(output_file->oc, &pkt);
+        ret = write_frame(ost, &pkt);
         if (ret < 0) {
             av_packet_unref(&pkt);
             av_frame_unref(next_picture);
@@ -643,7 +675,7 @@ int do_audio_out(OutputStream *ost, AVFrame *next_picture) {
     if (got_output) {
         av_packet_rescale_ts(&pkt, ost->enc_ctx->time_base, ost->st->time_base);
         pkt.stream_index = ost->source_index;
-        ret = av_interleaved_write_frame(output_file->oc, &pkt);
+        ret = write_frame(ost, &pkt);
         if (ret < 0) {
             av_err2str(ret);
             av_packet_unref(&pkt);
@@ -659,7 +691,10 @@ int reap_filters() {
     int ret = 0;
     for (int i = 0; i < nb_output_streams; ++i) {
         OutputStream *ost = output_streams[i];
-        AVFrame *frame = av_frame_alloc();
+        if (!ost->filtered_frame && !(ost->filtered_frame = alloc_stats_frame_alloc())) {
+            return AVERROR(ENOMEM);
+        }
+        AVFrame *frame = ost->filtered_frame;
         while (1) {
             ret = av_buffersink_get_frame_flags(ost->filter->filter, frame, AV_BUFFERSINK_FLAG_NO_REQUEST);
             if (ret < 0) {
@@ -738,7 +773,7 @@ int flush_encoders() {
                 }
                 av_packet_rescale_ts(&pkt, ost->enc_ctx->time_base, ost->st->time_base);
                 pkt.stream_index = ost->source_index;
-                ret = av_interleaved_write_frame(output_file->oc, &pkt);
+                ret = write_frame(ost, &pkt);
                 if (ret < 0) {
                     av_err2str(ret);
                     av_packet_unref(&pkt);
@@ -792,7 +827,9 @@ int transcode() {
             }
             continue;
         }
-        av_pkt_dump_log2(NULL, AV_LOG_ERROR, &pkt, 0, input_file->ic->streams[pkt.stream_index]);
+        if (do_pkt_dump) {
+            av_pkt_dump_log2(NULL, AV_LOG_INFO, &pkt, 0, input_file->ic->streams[pkt.stream_index]);
+        }
         process_input_packet(input_streams[pkt.stream_index], &pkt);
         av_packet_unref(&pkt);
         reap_filters();
@@ -801,6 +838,10 @@ int transcode() {
         process_input_packet(input_streams[i], NULL);
     }
     flush_encoders();
+    if ((ret = mux_queue_finish(output_file->mux_queue)) < 0) {
+        av_err2str(ret);
+        return ret;
+    }
     ret = av_write_trailer(output_file->oc);
     if (ret < 0) {
         av_err2str(ret);
@@ -816,18 +857,25 @@ void release() {
         av_free(input_file);
     }
     if (output_file) {
+        mux_queue_free(&output_file->mux_queue);
         avformat_free_context(output_file->oc);
         av_free(output_file);
     }
 
+    uint64_t nb_decoded = 0;
     for (int i = 0; i < nb_input_streams; ++i) {
         InputStream *ist = input_streams[i];
+        nb_decoded += ist->frames_decoded;
+        av_frame_free(&ist->decoded_frame);
         avcodec_close(ist->dec_ctx);
         avcodec_free_context(&ist->dec_ctx);
+        frame_pool_free(&ist->frame_pool);
     }
+    alloc_stats_log(AV_LOG_DEBUG, nb_decoded);
 
     for (int i = 0; i < nb_output_streams; ++i) {
         OutputStream *ost = output_streams[i];
+        av_frame_free(&ost->filtered_frame);
         avcodec_close(ost->enc_ctx);
         avcodec_free_context(&ost->enc_ctx);
         av_free(ost->avfilter);
@@ -840,7 +888,7 @@ int open_files(const char *input_path, const char *output_path, int new_width, i
     avcodec_register_all();
     avfilter_register_all();
     av_log_set_level(AV_LOG_ERROR);
-    av_log_set_callback(log_callback);
+    async_log_start(ASYNC_LOG_DEFAULT_SLOTS, 0);
     ret = open_input_file(input_path);
     if (ret < 0) {
         release();
@@ -13,6 +13,9 @@
 #include "libavutil/pixdesc.h"
 #include "libavfilter/buffersrc.h"
 #include "libavfilter/buffersink.h"
+#include "alloc_stats.h"
+#include "mux_queue.h"
+#include "frame_pool.h"
 
 typedef struct InputFile {
     AVFormatContext *ic;
@@ -23,10 +26,15 @@ typedef struct InputStream {
     AVCodecContext *dec_ctx;
     struct AVCodec *dec;
     struct InputFilter *filter;
+    AVFrame *decoded_frame;
+    uint64_t frames_decoded;
+    FramePool *frame_pool;
 } InputStream;
 
 typedef struct OutputFile {
     AVFormatContext *oc;
+    MuxQueue *mux_queue;
+    size_t mux_queue_size;
 } OutputFile;
 
 typedef struct OutputStream {
@@ -38,6 +46,7 @@ typedef struct OutputStream {
     struct OutputFilter *filter;
     int finished;
     uint64_t sync_opts;
+    AVFrame *filtered_frame;
 } OutputStream;
 
 typedef struct InputFilter {
@@ -64,6 +73,8 @@ extern int nb_input_streams;
 extern OutputFile *output_file;
 extern OutputStream **output_streams;
 extern int nb_output_streams;
+extern int do_pkt_dump;  /* log every demuxed packet */
+extern const char *scaler_profile;  /* see scaler_profile.h, NULL for the default */
 
 int open_files(const char *input_file, const char *output_file, int new_width, int new_height);
 int transcode();
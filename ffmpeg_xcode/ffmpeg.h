@@ -9,6 +9,8 @@
 #ifndef ffmpeg_h
 #define ffmpeg_h
 
+#include <pthread.h>
+
 #include "libavcodec/avcodec.h"
 #include "libavutil/opt.h"
 #include "libavutil/channel_layout.h"
@@ -28,6 +30,13 @@
 #include "libavfilter/buffersink.h"
 #include "libavfilter/buffersrc.h"
 #include "libavcodec/mathops.h"
+#include "alloc_stats.h"
+#include "frame_ring.h"
+#include "mux_queue.h"
+#include "frame_pool.h"
+#include "thread_budget.h"
+#include "stage_stats.h"
+#include "perf_counters.h"
 
 typedef enum {
     ENCODER_FINISHED = 1,
@@ -39,6 +48,24 @@ typedef struct InputFilter {
     struct InputStream *ist;
     struct FilterGraph *graph;
     uint8_t            *name;
+
+    /* decoded frames waiting for the filter thread (pipeline mode) */
+    FrameRing          *frame_ring;
+
+    /*
+     * converts frames that changed format mid-stream back to the resample_*
+     * format of ist the graph was configured with, see ifilter_push_frame()
+     */
+    AVFilterGraph      *adapter;
+    AVFilterContext    *adapter_src;
+    AVFilterContext    *adapter_sink;
+    AVFrame            *adapter_frame;
+    int                 adapter_format;     /* input of the adapter */
+    int                 adapter_width;
+    int                 adapter_height;
+    int                 adapter_sample_rate;
+    int                 adapter_channels;
+    uint64_t            adapter_channel_layout;
 } InputFilter;
 
 typedef struct OutputFilter {
@@ -60,6 +87,9 @@ typedef struct FilterGraph {
     OutputFilter **outputs;
     int nb_outputs;
     AVFilterGraph *graph;
+
+    ThreadShare *thread_share;  /* cores the filter graph threads may use */
+    int bypass;                 /* frames go straight to the encoder, see ifilter_bypass() */
 } FilterGraph;
 
 typedef struct InputFiles {
@@ -69,7 +99,16 @@ typedef struct InputFiles {
     AVRational time_base;
     int duration;
     int ts_offset;
-    int thread_queue_size;
+    int eof_reached;
+
+    /* only [start_time, stop_time) is transcoded, AV_TIME_BASE units */
+    int64_t start_time;         /* AV_NOPTS_VALUE from the beginning */
+    int64_t stop_time;          /* AV_NOPTS_VALUE up to the end */
+    int past_stop;              /* every stream in use went past stop_time */
+
+    AVThreadMessageQueue *in_thread_queue;
+    pthread_t thread;           /* thread reading from this file */
+    int thread_queue_size;      /* maximum number of queued packets */
 } InputFile;
 
 typedef struct InputStream {
@@ -103,8 +142,20 @@ typedef struct InputStream {
     int64_t pts;
     uint64_t data_size;
     uint64_t nb_packets;
-    AVFrame *decoded_frame;
-    AVFrame *filter_frame;
+    uint64_t frames_decoded;
+    int past_stop;              /* packets reached the stop_time of the file */
+    AVFrame *decoded_frame;     /* reused for every decoded frame */
+    AVFrame *filter_frame;      /* extra reference for all but the last filter */
+
+    /* demuxed packets waiting for the decoder thread (pipeline mode) */
+    FrameRing *pkt_ring;
+
+    /* recycled decoder output buffers, see get_buffer() */
+    FramePool *frame_pool;
+
+    ThreadShare *thread_share;  /* cores the decoder threads may use */
+    StageStats *stats;          /* demux, decode and filter push timings */
+    PerfStats *perf;            /* decode and filter push counters, -perf only */
 } InputStream;
 
 typedef struct OutputFiles {
@@ -115,6 +166,10 @@ typedef struct OutputFiles {
     uint64_t limit_filesize;
     int shortest;
     AVDictionary *opts;
+
+    /* packets waiting for the muxer thread of ctx */
+    MuxQueue *mux_queue;
+    size_t mux_queue_size;      /* byte cap of mux_queue */
 } OutputFile;
 
 typedef struct OutputStream {
@@ -132,6 +187,7 @@ typedef struct OutputStream {
     char *avfilter;
     OutputFilter *filter;
     int encoding_needed;
+    int stream_copy;            /* packets are muxed without decoding */
     AVRational frame_rate;
     
     int finished;
@@ -144,6 +200,18 @@ typedef struct OutputStream {
         int last_nb0_frames[3];
         int is_cfr;
         int last_dropped;
+
+    /* filtered frames waiting for the encoder thread (pipeline mode) */
+    FrameRing *frame_ring;
+
+    ThreadShare *thread_share;  /* cores the encoder threads may use */
+    StageStats *stats;          /* filter pull, encode and mux timings */
+    PerfStats *perf;            /* filter pull, encode and mux counters, -perf only */
+    int sched_index;            /* slot in the output scheduler */
+    uint64_t frames_dropped;    /* past max_frames */
+    uint64_t frames_duplicated; /* encoded again to keep the frame rate */
+    const char *scaler_profile; /* flags of the scalers feeding the encoder */
+    int filter_index;           /* output of the graph shared with other streams */
 } OutputStream;
 
 static volatile int received_sigterm = 0;
@@ -163,6 +231,17 @@ extern int nb_output_files;
 extern FilterGraph **filtergraphs;
 extern int nb_filtergraphs;
 
+/* run decoders, filter graphs and encoders on their own threads */
+extern int pipeline_mode;
+
+/* log every demuxed packet */
+extern int do_pkt_dump;
+/* microseconds between progress reports, <= 0 for none */
+extern int64_t stats_period;
+/* Prometheus text file written every metrics_period microseconds, NULL for none */
+extern const char *metrics_path;
+extern int64_t metrics_period;
+
 void *grow_array(void *array, int elem_size, int *size, int new_size);
 
 #define GROW_ARRAY(array, nb_elems)\
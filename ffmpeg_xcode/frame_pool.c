@@ -0,0 +1,253 @@
+//
+//  frame_pool.c
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "frame_pool.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/pixdesc.h"
+#include "libavutil/samplefmt.h"
+
+/* number of formats kept alive at once, the least recently used is dropped */
+#define FRAME_POOL_MAX_ENTRIES 4
+
+typedef struct FramePoolEntry {
+    enum AVMediaType type;
+    int width, height;      /* video */
+    int channels;           /* audio */
+    int nb_samples;         /* audio, largest frame the planes can hold */
+    int format;
+
+    AVBufferPool *pools[AV_NUM_DATA_POINTERS];
+    int linesize[AV_NUM_DATA_POINTERS];
+    int nb_planes;
+    unsigned last_used;
+} FramePoolEntry;
+
+struct FramePool {
+    FramePoolEntry entries[FRAME_POOL_MAX_ENTRIES];
+    int nb_entries;
+    unsigned clock;
+    pthread_mutex_t lock;
+};
+
+/* planes allocated by all the pools, shared or not */
+static atomic_llong pool_bytes;
+
+static void aligned_buffer_free(void *opaque, uint8_t *data)
+{
+    atomic_fetch_sub_explicit(&pool_bytes, (intptr_t) opaque, memory_order_relaxed);
+    free(data);
+}
+
+static AVBufferRef *aligned_buffer_alloc(int size)
+{
+    AVBufferRef *buf;
+    void *data;
+
+    if (posix_memalign(&data, FRAME_POOL_ALIGN, size))
+        return NULL;
+    if (!(buf = av_buffer_create(data, size, aligned_buffer_free, (void *) (intptr_t) size, 0))) {
+        free(data);
+        return NULL;
+    }
+    atomic_fetch_add_explicit(&pool_bytes, size, memory_order_relaxed);
+    return buf;
+}
+
+static void entry_uninit(FramePoolEntry *e)
+{
+    for (int i = 0; i < AV_NUM_DATA_POINTERS; i++)
+        av_buffer_pool_uninit(&e->pools[i]);
+    memset(e, 0, sizeof(*e));
+}
+
+static int entry_init_video(FramePoolEntry *e, AVCodecContext *s, AVFrame *frame)
+{
+    int linesize_align[AV_NUM_DATA_POINTERS];
+    uint8_t *data[4];
+    int linesize[4];
+    int w = frame->width, h = frame->height;
+    int i, size, unaligned;
+
+    avcodec_align_dimensions2(s, &w, &h, linesize_align);
+    /* widen until every plane's stride is aligned as the codec asks */
+    do {
+        if ((size = av_image_fill_linesizes(linesize, frame->format, w)) < 0)
+            return size;
+        w += w & ~(w - 1);
+        unaligned = 0;
+        for (i = 0; i < 4; i++)
+            unaligned |= linesize[i] % linesize_align[i] |
+                         linesize[i] % FRAME_POOL_ALIGN;
+    } while (unaligned);
+
+    if ((size = av_image_fill_pointers(data, frame->format, h, NULL, linesize)) < 0)
+        return size;
+
+    for (i = 0; i < 4 && data[i]; i++) {
+        /* data[] holds offsets from NULL, the last plane ends at size */
+        int plane_size = i < 3 && data[i + 1] ? data[i + 1] - data[i] :
+                                                size - (data[i] - data[0]);
+        e->linesize[i] = linesize[i];
+        /* codecs may read or write up to 16 bytes past the end of a plane */
+        if (!(e->pools[i] = av_buffer_pool_init(plane_size + 16, aligned_buffer_alloc)))
+            return AVERROR(ENOMEM);
+    }
+    e->nb_planes  = i;
+    e->type       = AVMEDIA_TYPE_VIDEO;
+    e->width      = frame->width;
+    e->height     = frame->height;
+    e->format     = frame->format;
+    return 0;
+}
+
+static int entry_init_audio(FramePoolEntry *e, AVFrame *frame, int channels)
+{
+    int planar = av_sample_fmt_is_planar(frame->format);
+    int nb_planes = planar ? channels : 1;
+    int i, linesize, ret;
+
+    if ((ret = av_samples_get_buffer_size(&linesize, channels, frame->nb_samples,
+                                          frame->format, 0)) < 0)
+        return ret;
+    for (i = 0; i < nb_planes; i++)
+        if (!(e->pools[i] = av_buffer_pool_init(linesize, aligned_buffer_alloc)))
+            return AVERROR(ENOMEM);
+    e->linesize[0] = linesize;
+    e->nb_planes   = nb_planes;
+    e->type        = AVMEDIA_TYPE_AUDIO;
+    e->channels    = channels;
+    e->nb_samples  = frame->nb_samples;
+    e->format      = frame->format;
+    return 0;
+}
+
+static int entry_matches(const FramePoolEntry *e, enum AVMediaType type,
+                         const AVFrame *frame, int channels)
+{
+    if (e->type != type || e->format != frame->format || !e->nb_planes)
+        return 0;
+    if (type == AVMEDIA_TYPE_VIDEO)
+        return e->width == frame->width && e->height == frame->height;
+    return e->channels == channels && e->nb_samples >= frame->nb_samples;
+}
+
+/* find or create the entry for frame, called with the lock held */
+static FramePoolEntry *get_entry(FramePool *pool, AVCodecContext *s, AVFrame *frame,
+                                 int channels, int *err)
+{
+    FramePoolEntry *e = NULL;
+    int i;
+
+    for (i = 0; i < pool->nb_entries; i++) {
+        if (entry_matches(&pool->entries[i], s->codec_type, frame, channels)) {
+            e = &pool->entries[i];
+            e->last_used = ++pool->clock;
+            return e;
+        }
+    }
+
+    if (pool->nb_entries < FRAME_POOL_MAX_ENTRIES) {
+        e = &pool->entries[pool->nb_entries++];
+    } else {
+        e = &pool->entries[0];
+        for (i = 1; i < pool->nb_entries; i++)
+            if (pool->entries[i].last_used < e->last_used)
+                e = &pool->entries[i];
+        entry_uninit(e);
+    }
+
+    *err = s->codec_type == AVMEDIA_TYPE_VIDEO ? entry_init_video(e, s, frame) :
+                                                 entry_init_audio(e, frame, channels);
+    if (*err < 0) {
+        entry_uninit(e);
+        return NULL;
+    }
+    e->last_used = ++pool->clock;
+    return e;
+}
+
+int frame_pool_alloc(FramePool **ppool)
+{
+    FramePool *pool = av_mallocz(sizeof(*pool));
+
+    if (!pool)
+        return AVERROR(ENOMEM);
+    pthread_mutex_init(&pool->lock, NULL);
+    *ppool = pool;
+    return 0;
+}
+
+void frame_pool_free(FramePool **ppool)
+{
+    FramePool *pool = *ppool;
+
+    if (!pool)
+        return;
+    for (int i = 0; i < pool->nb_entries; i++)
+        entry_uninit(&pool->entries[i]);
+    pthread_mutex_destroy(&pool->lock);
+    av_freep(ppool);
+}
+
+static int use_default_get_buffer(AVCodecContext *s, AVFrame *frame, int channels)
+{
+    if (!(s->codec->capabilities & AV_CODEC_CAP_DR1))
+        return 1;
+    if (s->codec_type == AVMEDIA_TYPE_VIDEO) {
+        const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+        return !desc || desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_PAL |
+                                       AV_PIX_FMT_FLAG_PSEUDOPAL);
+    }
+    if (s->codec_type == AVMEDIA_TYPE_AUDIO)
+        return av_sample_fmt_is_planar(frame->format) && channels > AV_NUM_DATA_POINTERS;
+    return 1;
+}
+
+int frame_pool_get_buffer(FramePool *pool, AVCodecContext *s, AVFrame *frame, int flags)
+{
+    FramePoolEntry *e;
+    int channels = av_frame_get_channels(frame);
+    int i, ret = 0;
+
+    if (!pool || use_default_get_buffer(s, frame, channels))
+        return avcodec_default_get_buffer2(s, frame, flags);
+
+    pthread_mutex_lock(&pool->lock);
+    if (!(e = get_entry(pool, s, frame, channels, &ret))) {
+        pthread_mutex_unlock(&pool->lock);
+        return ret;
+    }
+    for (i = 0; i < e->nb_planes; i++) {
+        if (!(frame->buf[i] = av_buffer_pool_get(e->pools[i]))) {
+            pthread_mutex_unlock(&pool->lock);
+            av_frame_unref(frame);
+            return AVERROR(ENOMEM);
+        }
+        frame->data[i] = frame->buf[i]->data;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (s->codec_type == AVMEDIA_TYPE_VIDEO) {
+        for (i = 0; i < 4; i++)
+            frame->linesize[i] = e->linesize[i];
+    } else {
+        frame->linesize[0] = e->linesize[0];
+    }
+    frame->extended_data = frame->data;
+    return 0;
+}
+
+int64_t frame_pool_total_bytes(void)
+{
+    return atomic_load_explicit(&pool_bytes, memory_order_relaxed);
+}
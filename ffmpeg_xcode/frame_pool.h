@@ -0,0 +1,45 @@
+//
+//  frame_pool.h
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#ifndef frame_pool_h
+#define frame_pool_h
+
+#include <stdio.h>
+#include "libavcodec/avcodec.h"
+#include "libavutil/frame.h"
+
+/* alignment of every plane handed out by a FramePool */
+#define FRAME_POOL_ALIGN 64
+
+/**
+ * Decoder frame buffers recycled through AVBufferPools.
+ *
+ * One set of per-plane pools is kept for each (width, height, pix_fmt) of
+ * video or (sample_fmt, channels) of audio seen recently. Planes are
+ * FRAME_POOL_ALIGN aligned and reference counted; when the last reference
+ * is dropped, e.g. by the filter graph, the plane goes back to its pool
+ * instead of being freed. Safe to use from frame-threaded decoders.
+ */
+typedef struct FramePool FramePool;
+
+int frame_pool_alloc(FramePool **pool);
+
+/* outstanding buffers stay valid, they are freed when released */
+void frame_pool_free(FramePool **pool);
+
+/**
+ * get_buffer2() implementation. Falls back to avcodec_default_get_buffer2()
+ * for codecs without AV_CODEC_CAP_DR1, hardware and paletted formats and
+ * audio with more planes than AVFrame.buf can hold.
+ */
+int frame_pool_get_buffer(FramePool *pool, AVCodecContext *s, AVFrame *frame, int flags);
+
+/* bytes of the planes allocated by every FramePool, in use or pooled */
+int64_t frame_pool_total_bytes(void);
+
+#endif /* frame_pool_h */
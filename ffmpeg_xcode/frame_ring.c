@@ -0,0 +1,252 @@
+//
+//  frame_ring.c
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "frame_ring.h"
+#include "alloc_stats.h"
+#include "libavutil/time.h"
+
+#define CACHE_LINE_SIZE 64
+
+struct FrameRing {
+    void **slots;
+    unsigned mask;
+    enum FrameRingType type;
+
+    /* written by the consumer only */
+    atomic_uint head;
+    char pad0[CACHE_LINE_SIZE - sizeof(atomic_uint)];
+    /* written by the producer only */
+    atomic_uint tail;
+    char pad1[CACHE_LINE_SIZE - sizeof(atomic_uint)];
+
+    atomic_int eof;
+    atomic_int abort_request;
+    atomic_llong bytes;         /* payload referenced by the queued elements */
+};
+
+int frame_ring_alloc(FrameRing **pring, unsigned nb_elems, enum FrameRingType type)
+{
+    FrameRing *ring;
+    unsigned size = 1;
+
+    while (size < nb_elems)
+        size <<= 1;
+
+    if (!(ring = av_mallocz(sizeof(*ring))))
+        return AVERROR(ENOMEM);
+    ring->type = type;
+    ring->mask = size - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->eof, 0);
+    atomic_init(&ring->abort_request, 0);
+    atomic_init(&ring->bytes, 0);
+
+    if (!(ring->slots = av_mallocz_array(size, sizeof(*ring->slots)))) {
+        av_free(ring);
+        return AVERROR(ENOMEM);
+    }
+    for (unsigned i = 0; i < size; i++) {
+        ring->slots[i] = type == FRAME_RING_FRAME ? (void *) av_frame_alloc() :
+                                                    (void *) av_packet_alloc();
+        if (!ring->slots[i]) {
+            frame_ring_free(&ring);
+            return AVERROR(ENOMEM);
+        }
+    }
+    *pring = ring;
+    return 0;
+}
+
+void frame_ring_free(FrameRing **pring)
+{
+    FrameRing *ring = *pring;
+
+    if (!ring)
+        return;
+    if (ring->slots) {
+        for (unsigned i = 0; i <= ring->mask; i++) {
+            if (ring->type == FRAME_RING_FRAME) {
+                AVFrame *frame = ring->slots[i];
+                av_frame_free(&frame);
+            } else {
+                AVPacket *pkt = ring->slots[i];
+                av_packet_free(&pkt);
+            }
+        }
+        av_freep(&ring->slots);
+    }
+    av_freep(pring);
+}
+
+static void backoff(int *spins)
+{
+    if (*spins < 64) {
+        (*spins)++;
+    } else if (*spins < 128) {
+        (*spins)++;
+        sched_yield();
+    } else {
+        av_usleep(100);
+    }
+}
+
+/* return the slot the producer may fill, or NULL with *err set */
+static void *producer_slot(FrameRing *ring, int *err)
+{
+    int spins = 0;
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    while (1) {
+        if (atomic_load_explicit(&ring->abort_request, memory_order_relaxed)) {
+            *err = AVERROR_EXIT;
+            return NULL;
+        }
+        if (tail - atomic_load_explicit(&ring->head, memory_order_acquire) <= ring->mask)
+            return ring->slots[tail & ring->mask];
+        backoff(&spins);
+    }
+}
+
+static void producer_publish(FrameRing *ring)
+{
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+/* return the oldest filled slot, or NULL with *err set */
+static void *consumer_slot(FrameRing *ring, int block, int *err)
+{
+    int spins = 0;
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    while (1) {
+        int eof;
+
+        if (atomic_load_explicit(&ring->abort_request, memory_order_relaxed)) {
+            *err = AVERROR_EXIT;
+            return NULL;
+        }
+        /* read eof before tail: an element published before EOF is never missed */
+        eof = atomic_load_explicit(&ring->eof, memory_order_acquire);
+        if (atomic_load_explicit(&ring->tail, memory_order_acquire) != head)
+            return ring->slots[head & ring->mask];
+        if (eof) {
+            *err = AVERROR_EOF;
+            return NULL;
+        }
+        if (!block) {
+            *err = AVERROR(EAGAIN);
+            return NULL;
+        }
+        backoff(&spins);
+    }
+}
+
+static void consumer_release(FrameRing *ring)
+{
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+static int64_t frame_bytes(const AVFrame *frame)
+{
+    int64_t size = 0;
+
+    for (int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++)
+        size += frame->buf[i]->size;
+    for (int i = 0; i < frame->nb_extended_buf; i++)
+        size += frame->extended_buf[i]->size;
+    return size;
+}
+
+int frame_ring_send_frame(FrameRing *ring, AVFrame *frame)
+{
+    int err = 0;
+    AVFrame *slot = producer_slot(ring, &err);
+
+    if (!slot)
+        return err;
+    atomic_fetch_add_explicit(&ring->bytes, frame_bytes(frame), memory_order_relaxed);
+    av_frame_move_ref(slot, frame);
+    producer_publish(ring);
+    return 0;
+}
+
+int frame_ring_send_packet(FrameRing *ring, AVPacket *pkt)
+{
+    int err = 0;
+    AVPacket *slot = producer_slot(ring, &err);
+
+    if (!slot)
+        return err;
+    atomic_fetch_add_explicit(&ring->bytes, pkt->size, memory_order_relaxed);
+    av_packet_move_ref(slot, pkt);
+    producer_publish(ring);
+    return 0;
+}
+
+static int recv_frame(FrameRing *ring, AVFrame *frame, int block)
+{
+    int err = 0;
+    AVFrame *slot = consumer_slot(ring, block, &err);
+
+    if (!slot)
+        return err;
+    av_frame_move_ref(frame, slot);
+    atomic_fetch_sub_explicit(&ring->bytes, frame_bytes(frame), memory_order_relaxed);
+    consumer_release(ring);
+    return 0;
+}
+
+int frame_ring_recv_frame(FrameRing *ring, AVFrame *frame)
+{
+    return recv_frame(ring, frame, 1);
+}
+
+int frame_ring_try_recv_frame(FrameRing *ring, AVFrame *frame)
+{
+    return recv_frame(ring, frame, 0);
+}
+
+int frame_ring_recv_packet(FrameRing *ring, AVPacket *pkt)
+{
+    int err = 0;
+    AVPacket *slot = consumer_slot(ring, 1, &err);
+
+    if (!slot)
+        return err;
+    av_packet_move_ref(pkt, slot);
+    atomic_fetch_sub_explicit(&ring->bytes, pkt->size, memory_order_relaxed);
+    consumer_release(ring);
+    return 0;
+}
+
+void frame_ring_set_eof(FrameRing *ring)
+{
+    atomic_store_explicit(&ring->eof, 1, memory_order_release);
+}
+
+void frame_ring_abort(FrameRing *ring)
+{
+    atomic_store_explicit(&ring->abort_request, 1, memory_order_relaxed);
+}
+
+int64_t frame_ring_bytes(FrameRing *ring)
+{
+    return atomic_load_explicit(&ring->bytes, memory_order_relaxed);
+}
+
+unsigned frame_ring_occupancy(FrameRing *ring)
+{
+    return atomic_load_explicit(&ring->tail, memory_order_relaxed) -
+           atomic_load_explicit(&ring->head, memory_order_relaxed);
+}
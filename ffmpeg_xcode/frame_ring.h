@@ -0,0 +1,57 @@
+//
+//  frame_ring.h
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#ifndef frame_ring_h
+#define frame_ring_h
+
+#include <stdio.h>
+#include "libavcodec/avcodec.h"
+#include "libavutil/frame.h"
+
+/**
+ * Bounded single-producer/single-consumer queue of AVFrames or AVPackets.
+ *
+ * Every slot owns a preallocated AVFrame/AVPacket shell, references are
+ * moved in and out of the shells, so passing elements through the ring
+ * never allocates. Only one thread may send and only one thread may
+ * receive; the indices are published with acquire/release atomics, no
+ * lock is taken. The blocking calls back off by yielding and sleeping.
+ */
+typedef struct FrameRing FrameRing;
+
+enum FrameRingType {
+    FRAME_RING_FRAME,
+    FRAME_RING_PACKET,
+};
+
+int frame_ring_alloc(FrameRing **ring, unsigned nb_elems, enum FrameRingType type);
+void frame_ring_free(FrameRing **ring);
+
+/* move the reference out of frame/pkt, block while the ring is full */
+int frame_ring_send_frame(FrameRing *ring, AVFrame *frame);
+int frame_ring_send_packet(FrameRing *ring, AVPacket *pkt);
+
+/* move the oldest element into frame/pkt, block while the ring is empty,
+ * return AVERROR_EOF once the producer signalled EOF and the ring is drained */
+int frame_ring_recv_frame(FrameRing *ring, AVFrame *frame);
+int frame_ring_recv_packet(FrameRing *ring, AVPacket *pkt);
+
+/* non-blocking receive, AVERROR(EAGAIN) when empty */
+int frame_ring_try_recv_frame(FrameRing *ring, AVFrame *frame);
+
+/* producer side: no more elements will be sent */
+void frame_ring_set_eof(FrameRing *ring);
+
+/* either side: make every pending and future send/recv fail with AVERROR_EXIT */
+void frame_ring_abort(FrameRing *ring);
+
+unsigned frame_ring_occupancy(FrameRing *ring);
+
+/* payload bytes of the queued frames or packets */
+int64_t frame_ring_bytes(FrameRing *ring);
+#endif /* frame_ring_h */
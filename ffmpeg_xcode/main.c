@@ -7,11 +7,51 @@
 //
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "open_files.h"
 #include "compress.h"
+#include "batch.h"
+#include "scaler_profile.h"
+
+static int run_job(const BatchJob *job, void *opaque) {
+    scaler_profile = job->scaler;
+    if (open_files(job->input, job->output, job->width, job->height, job->video_codec) != NONE) {
+        av_log(NULL, AV_LOG_ERROR, "Could not open %s -> %s.\n", job->input, job->output);
+        return AVERROR(EINVAL);
+    }
+    return transcode();
+}
 
 int main(int argc, char **args) {
-    open_files("/Users/wlanjie/Desktop/sintel.mp4", "/Users/wlanjie/Desktop/compress.mp4", 260, 260);
-    transcode();
-    return 0;
+    if (argc >= 3 && !strcmp(args[1], "-batch")) {
+        BatchJob *jobs;
+        int nb_jobs, ret;
+        int max_jobs = argc >= 4 ? atoi(args[3]) : 0;
+        if (batch_read_manifest(args[2], &jobs, &nb_jobs) < 0) {
+            return 1;
+        }
+        ret = batch_run(jobs, nb_jobs, max_jobs, run_job, NULL);
+        batch_free_jobs(&jobs, &nb_jobs);
+        return ret != 0;
+    }
+    if (argc > 6 && strcmp(args[6], "-") && scaler_profile_check(args[6]) < 0) {
+        return 1;
+    }
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s input output [width height [codec [scaler]]]\n"
+                        "       %s -batch manifest [max_jobs]\n", args[0], args[0]);
+        return 1;
+    }
+    BatchJob job = {
+        .input = args[1],
+        .output = args[2],
+        .width = argc > 4 ? atoi(args[3]) : 0,
+        .height = argc > 4 ? atoi(args[4]) : 0,
+        .video_codec = argc > 5 && strcmp(args[5], "-") ? args[5] : NULL,
+        .scaler = argc > 6 && strcmp(args[6], "-") ? args[6] : NULL,
+        .start_time = AV_NOPTS_VALUE,
+        .stop_time = AV_NOPTS_VALUE,
+    };
+    return run_job(&job, NULL) < 0;
 }
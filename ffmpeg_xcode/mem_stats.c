@@ -0,0 +1,352 @@
+//
+//  mem_stats.c
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem_stats.h"
+#include "libavutil/common.h"
+#include "libavutil/log.h"
+#include "libavutil/time.h"
+
+typedef struct StageSamples {
+    int64_t peak_heap;
+    int64_t total_heap;
+    int64_t peak_bytes;
+    int64_t peak_items;
+    int64_t total_bytes;
+    int64_t total_items;
+} StageSamples;
+
+static const char *const stage_names[NB_MEM_STAGES] = {
+    [MEM_STAGE_OTHER]   = "other",
+    [MEM_STAGE_DECODER] = "decoder",
+    [MEM_STAGE_FILTER]  = "filter",
+    [MEM_STAGE_ENCODER] = "encoder",
+    [MEM_STAGE_MUXER]   = "muxer",
+};
+
+static _Thread_local enum MemStage current_stage;
+
+/* only touched by the thread driving the transcode */
+static StageSamples samples[NB_MEM_STAGES];
+static uint64_t nb_samples;
+static int heap_sampled;
+static int64_t last_sample;
+
+enum MemStage mem_stats_enter(enum MemStage stage)
+{
+    enum MemStage prev = current_stage;
+    current_stage = stage;
+    return prev;
+}
+
+void mem_stats_leave(enum MemStage prev)
+{
+    current_stage = prev;
+}
+
+#if defined(__GLIBC__) && defined(MEM_STATS_INTERPOSE)
+#include <unistd.h>
+
+/*
+ * glibc exports its own allocator under these names, so defining malloc
+ * and friends here interposes them for the whole process, libav* included.
+ * Each block starts with a header naming the stage that allocated it, so
+ * its free is taken off that stage again.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+typedef struct BlockHeader {
+    uint32_t offset;        /* from the start of the libc block to the caller's pointer */
+    uint32_t stage;
+    uint64_t size;
+} BlockHeader;
+
+/* keeps the alignment of malloc() for the caller's pointer */
+#define HEADER_SIZE 16
+
+static atomic_llong heap_live;
+static atomic_llong heap_peak;
+static atomic_llong stage_allocs[NB_MEM_STAGES];
+static atomic_llong stage_alloc_bytes[NB_MEM_STAGES];
+static atomic_llong stage_live[NB_MEM_STAGES];
+
+static inline BlockHeader *block_header(void *ptr)
+{
+    return (BlockHeader *)((uint8_t *)ptr - sizeof(BlockHeader));
+}
+
+static void *account_alloc(void *block, uint32_t offset, size_t size)
+{
+    BlockHeader *h;
+    void *ptr;
+    long long live, peak;
+
+    if (!block)
+        return NULL;
+    ptr       = (uint8_t *)block + offset;
+    h         = block_header(ptr);
+    h->offset = offset;
+    h->stage  = current_stage;
+    h->size   = size;
+
+    live = atomic_fetch_add_explicit(&heap_live, size, memory_order_relaxed) + size;
+    peak = atomic_load_explicit(&heap_peak, memory_order_relaxed);
+    while (live > peak &&
+           !atomic_compare_exchange_weak_explicit(&heap_peak, &peak, live,
+                                                  memory_order_relaxed, memory_order_relaxed))
+        ;
+    atomic_fetch_add_explicit(&stage_live[h->stage], size, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stage_allocs[h->stage], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stage_alloc_bytes[h->stage], size, memory_order_relaxed);
+    return ptr;
+}
+
+static void account_free(uint32_t stage, uint64_t size)
+{
+    atomic_fetch_sub_explicit(&heap_live, size, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&stage_live[stage], size, memory_order_relaxed);
+}
+
+void *malloc(size_t size)
+{
+    if (size > SIZE_MAX - HEADER_SIZE) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return account_alloc(__libc_malloc(size + HEADER_SIZE), HEADER_SIZE, size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    if (size && nmemb > (SIZE_MAX - HEADER_SIZE) / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return account_alloc(__libc_calloc(nmemb * size + HEADER_SIZE, 1), HEADER_SIZE, nmemb * size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    if (alignment <= HEADER_SIZE)
+        return malloc(size);
+    if (alignment > UINT32_MAX || size > SIZE_MAX - alignment) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    /* the header goes at the end of the first alignment bytes */
+    return account_alloc(__libc_memalign(alignment, size + alignment), alignment, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    BlockHeader *h, old;
+    void *ret;
+
+    if (!ptr)
+        return malloc(size);
+    if (!size) {
+        free(ptr);
+        return NULL;
+    }
+    h = block_header(ptr);
+    if (h->offset != HEADER_SIZE) {
+        /* memalign()ed, the alignment is not kept by realloc() */
+        if ((ret = malloc(size)))
+            memcpy(ret, ptr, FFMIN(h->size, size));
+        free(ptr);
+        return ret;
+    }
+    if (size > SIZE_MAX - HEADER_SIZE) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    /* on failure ptr is still allocated and accounted */
+    old = *h;
+    if (!(ret = __libc_realloc((uint8_t *)ptr - HEADER_SIZE, size + HEADER_SIZE)))
+        return NULL;
+    account_free(old.stage, old.size);
+    return account_alloc(ret, HEADER_SIZE, size);
+}
+
+void *reallocarray(void *ptr, size_t nmemb, size_t size)
+{
+    if (size && nmemb > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(ptr, nmemb * size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+    void *p;
+
+    if (!alignment || alignment % sizeof(void *) || (alignment & (alignment - 1)))
+        return EINVAL;
+    if (!(p = memalign(alignment, size)))
+        return ENOMEM;
+    *ptr = p;
+    return 0;
+}
+
+void *valloc(size_t size)
+{
+    return memalign(sysconf(_SC_PAGESIZE), size);
+}
+
+void *pvalloc(size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    if (size > SIZE_MAX - page) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return memalign(page, FFALIGN(size, page));
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+    return ptr ? block_header(ptr)->size : 0;
+}
+
+void free(void *ptr)
+{
+    BlockHeader *h;
+
+    if (!ptr)
+        return;
+    h = block_header(ptr);
+    account_free(h->stage, h->size);
+    __libc_free((uint8_t *)ptr - h->offset);
+}
+
+int64_t mem_stats_nb_allocs(void)
+{
+    int64_t nb = 0;
+
+    for (int i = 0; i < NB_MEM_STAGES; i++)
+        nb += atomic_load_explicit(&stage_allocs[i], memory_order_relaxed);
+    return nb;
+}
+
+int64_t mem_stats_heap_live(void)
+{
+    return atomic_load_explicit(&heap_live, memory_order_relaxed);
+}
+
+static int sample_heap(int64_t live[NB_MEM_STAGES])
+{
+    for (int i = 0; i < NB_MEM_STAGES; i++)
+        live[i] = atomic_load_explicit(&stage_live[i], memory_order_relaxed);
+    return 1;
+}
+
+static void log_heap(int level)
+{
+    av_log(NULL, level, "heap: %.1f MiB live, %.1f MiB peak\n",
+           atomic_load(&heap_live) / 1048576.0, atomic_load(&heap_peak) / 1048576.0);
+    for (int i = 0; i < NB_MEM_STAGES; i++)
+        av_log(NULL, level, "  %-8s %10lld allocations, %10.1f MiB\n", stage_names[i],
+               (long long) atomic_load(&stage_allocs[i]), atomic_load(&stage_alloc_bytes[i]) / 1048576.0);
+}
+#else
+int64_t mem_stats_nb_allocs(void)
+{
+    return -1;
+}
+
+int64_t mem_stats_heap_live(void)
+{
+    return -1;
+}
+
+static int sample_heap(int64_t live[NB_MEM_STAGES])
+{
+    return 0;
+}
+
+static void log_heap(int level)
+{
+}
+#endif
+
+void mem_stats_reset(void)
+{
+    memset(samples, 0, sizeof(samples));
+    nb_samples   = 0;
+    heap_sampled = 0;
+    last_sample = av_gettime_relative();
+}
+
+int mem_stats_due(void)
+{
+    int64_t now = av_gettime_relative();
+
+    if (now - last_sample < MEM_STATS_SAMPLE_PERIOD)
+        return 0;
+    last_sample = now;
+    return 1;
+}
+
+void mem_stats_sample(const int64_t bytes[NB_MEM_STAGES], const int64_t items[NB_MEM_STAGES])
+{
+    int64_t heap[NB_MEM_STAGES] = { 0 };
+
+    heap_sampled = sample_heap(heap);
+    for (int i = 0; i < NB_MEM_STAGES; i++) {
+        StageSamples *s = &samples[i];
+
+        s->peak_heap    = FFMAX(s->peak_heap, heap[i]);
+        s->peak_bytes   = FFMAX(s->peak_bytes, bytes[i]);
+        s->peak_items   = FFMAX(s->peak_items, items[i]);
+        s->total_heap  += heap[i];
+        s->total_bytes += bytes[i];
+        s->total_items += items[i];
+    }
+    nb_samples++;
+}
+
+void mem_stats_log(int level)
+{
+    log_heap(level);
+    if (!nb_samples)
+        return;
+    if (heap_sampled) {
+        av_log(NULL, level, "heap allocated per stage over %"PRIu64" samples (peak / steady state):\n",
+               nb_samples);
+        for (int i = 0; i < NB_MEM_STAGES; i++) {
+            StageSamples *s = &samples[i];
+
+            av_log(NULL, level, "  %-8s %8.1f / %8.1f MiB\n", stage_names[i],
+                   s->peak_heap / 1048576.0, s->total_heap / 1048576.0 / nb_samples);
+        }
+    }
+    av_log(NULL, level, "queued per stage over %"PRIu64" samples (peak / steady state):\n", nb_samples);
+    for (int i = MEM_STAGE_DECODER; i < NB_MEM_STAGES; i++) {
+        StageSamples *s = &samples[i];
+
+        av_log(NULL, level, "  %-8s %8.1f / %8.1f MiB, %5"PRId64" / %7.1f frames or packets\n",
+               stage_names[i], s->peak_bytes / 1048576.0, s->total_bytes / 1048576.0 / nb_samples,
+               s->peak_items, (double) s->total_items / nb_samples);
+    }
+}
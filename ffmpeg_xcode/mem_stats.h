@@ -0,0 +1,72 @@
+//
+//  mem_stats.h
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#ifndef mem_stats_h
+#define mem_stats_h
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* microseconds between two samples of the memory held by each stage */
+#define MEM_STATS_SAMPLE_PERIOD 100000
+
+enum MemStage {
+    MEM_STAGE_OTHER,        /* setup, demuxing, everything not below */
+    MEM_STAGE_DECODER,
+    MEM_STAGE_FILTER,
+    MEM_STAGE_ENCODER,
+    MEM_STAGE_MUXER,
+    NB_MEM_STAGES,
+};
+
+/**
+ * Memory held by each stage of the transcode, for sizing the number of
+ * concurrent jobs per host.
+ *
+ * When built with MEM_STATS_INTERPOSE on glibc the allocator is
+ * interposed (av_malloc() ends up there too): the live heap of the
+ * process and its peak are tracked exactly, and every block is charged to
+ * the stage the allocating thread is in until it is freed, by whichever
+ * thread. This costs a header and a few atomics per allocation, so only
+ * the benchmarks build it; without it the heap figures are not available.
+ *
+ * What is queued in front of each stage is sampled by the caller: buffer
+ * pools, the frames or packets in the rings and the packets waiting for
+ * the muxer. The peak and the mean of the samples, i.e. the steady state,
+ * are reported.
+ */
+
+/* Tag the allocations of the calling thread; return the previous tag. */
+enum MemStage mem_stats_enter(enum MemStage stage);
+
+/* Restore the tag returned by mem_stats_enter(). */
+void mem_stats_leave(enum MemStage prev);
+
+/* Heap allocations so far, -1 when the allocator is not interposed. */
+int64_t mem_stats_nb_allocs(void);
+
+/* Bytes currently allocated on the heap, -1 when the allocator is not interposed. */
+int64_t mem_stats_heap_live(void);
+
+/* Forget the samples and peaks, e.g. at the start of a job. */
+void mem_stats_reset(void);
+
+/* Return 1 when the next sample is due. */
+int mem_stats_due(void);
+
+/**
+ * Record what each stage holds now, along with the heap charged to it.
+ *
+ * @param bytes bytes queued per stage
+ * @param items frames or packets queued per stage
+ */
+void mem_stats_sample(const int64_t bytes[NB_MEM_STAGES], const int64_t items[NB_MEM_STAGES]);
+
+void mem_stats_log(int level);
+
+#endif /* mem_stats_h */
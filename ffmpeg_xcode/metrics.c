@@ -0,0 +1,168 @@
+//
+//  metrics.c
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#include <errno.h>
+#include "metrics.h"
+#include "libavutil/avstring.h"
+
+void metrics_init(Metrics *m, const char *path, int64_t period)
+{
+    m->path       = path;
+    m->start      = av_gettime_relative();
+    m->last_write = m->start;
+    m->period     = period;
+}
+
+int metrics_due(Metrics *m)
+{
+    int64_t now;
+
+    if (!m->path || m->period <= 0)
+        return 0;
+    now = av_gettime_relative();
+    if (now - m->last_write < m->period)
+        return 0;
+    m->last_write = now;
+    return 1;
+}
+
+static unsigned ring_depth(FrameRing *ring)
+{
+    return ring ? frame_ring_occupancy(ring) : 0;
+}
+
+static void write_header(FILE *f, const char *name, const char *type, const char *help)
+{
+    fprintf(f, "# HELP ffmpeg_%s %s\n# TYPE ffmpeg_%s %s\n", name, help, name, type);
+}
+
+static void write_input_metrics(FILE *f)
+{
+    static const struct {
+        const char *name, *type, *help;
+    } metrics[] = {
+        { "input_packets_total", "counter", "Packets demuxed." },
+        { "input_frames_total",  "counter", "Frames decoded." },
+        { "input_queue_depth",   "gauge",   "Packets waiting for the decoder." },
+        { "filter_queue_depth",  "gauge",   "Decoded frames waiting for the filter graphs." },
+    };
+
+    for (int m = 0; m < FF_ARRAY_ELEMS(metrics); m++) {
+        write_header(f, metrics[m].name, metrics[m].type, metrics[m].help);
+        for (int i = 0; i < nb_input_streams; i++) {
+            InputStream *ist = input_streams[i];
+            uint64_t val;
+
+            if (ist->discard)
+                continue;
+            switch (m) {
+            case 0:  val = ist->nb_packets;                 break;
+            case 1:  val = ist->frames_decoded;             break;
+            case 2:  val = ring_depth(ist->pkt_ring);       break;
+            default:
+                val = 0;
+                for (int j = 0; j < ist->nb_filters; j++)
+                    val += ring_depth(ist->filters[j]->frame_ring);
+                break;
+            }
+            fprintf(f, "ffmpeg_%s{stream=\"%d:%d\",type=\"%s\"} %"PRIu64"\n", metrics[m].name,
+                    ist->file_index, ist->st->index,
+                    av_get_media_type_string(ist->st->codec->codec_type), val);
+        }
+    }
+}
+
+static void write_output_metrics(FILE *f, double elapsed)
+{
+    static const struct {
+        const char *name, *type, *help;
+    } metrics[] = {
+        { "output_frames_total",            "counter", "Frames encoded or packets copied." },
+        { "output_bytes_total",             "counter", "Payload bytes sent to the muxer." },
+        { "output_frames_dropped_total",    "counter", "Frames dropped before muxing." },
+        { "output_frames_duplicated_total", "counter", "Frames encoded more than once." },
+        { "output_queue_depth",             "gauge",   "Filtered frames waiting for the encoder." },
+        { "encode_fps",                     "gauge",   "Average frames per second since the start." },
+    };
+
+    for (int m = 0; m < FF_ARRAY_ELEMS(metrics); m++) {
+        write_header(f, metrics[m].name, metrics[m].type, metrics[m].help);
+        for (int i = 0; i < nb_output_streams; i++) {
+            OutputStream *ost = output_streams[i];
+            char val[32];
+
+            switch (m) {
+            case 0:  snprintf(val, sizeof(val), "%d", ost->frame_number);                   break;
+            case 1:  snprintf(val, sizeof(val), "%"PRIu64, ost->data_size);                 break;
+            case 2:  snprintf(val, sizeof(val), "%"PRIu64, ost->frames_dropped);            break;
+            case 3:  snprintf(val, sizeof(val), "%"PRIu64, ost->frames_duplicated);         break;
+            case 4:  snprintf(val, sizeof(val), "%u", ring_depth(ost->frame_ring));         break;
+            default: snprintf(val, sizeof(val), "%.2f", elapsed > 0 ? ost->frame_number / elapsed : 0); break;
+            }
+            fprintf(f, "ffmpeg_%s{stream=\"%d:%d\",type=\"%s\"} %s\n", metrics[m].name,
+                    ost->file_index, ost->index,
+                    av_get_media_type_string(ost->st->codec->codec_type), val);
+        }
+    }
+
+    write_header(f, "mux_queue_bytes", "gauge", "Payload bytes waiting for the muxer thread.");
+    for (int i = 0; i < nb_output_files; i++) {
+        size_t bytes = 0;
+
+        if (output_files[i]->mux_queue)
+            mux_queue_occupancy(output_files[i]->mux_queue, &bytes, NULL, NULL);
+        fprintf(f, "ffmpeg_mux_queue_bytes{file=\"%d\"} %zu\n", i, bytes);
+    }
+}
+
+int metrics_write(Metrics *m, int finished)
+{
+    double elapsed = (av_gettime_relative() - m->start) / 1000000.0;
+    int64_t media_time = AV_NOPTS_VALUE;
+    char *tmp;
+    FILE *f;
+    int ret = 0;
+
+    if (!m->path)
+        return 0;
+    if (!(tmp = av_asprintf("%s.tmp", m->path)))
+        return AVERROR(ENOMEM);
+    if (!(f = fopen(tmp, "w"))) {
+        ret = AVERROR(errno);
+        av_log(NULL, AV_LOG_ERROR, "Could not open %s: %s\n", tmp, av_err2str(ret));
+        goto end;
+    }
+
+    for (int i = 0; i < nb_output_streams; i++) {
+        OutputStream *ost = output_streams[i];
+
+        if (ost->last_mux_dts != AV_NOPTS_VALUE)
+            media_time = FFMAX(media_time, av_rescale_q(ost->last_mux_dts, ost->st->time_base,
+                                                        AV_TIME_BASE_Q));
+    }
+    write_header(f, "elapsed_seconds", "gauge", "Wall clock time since the job started.");
+    fprintf(f, "ffmpeg_elapsed_seconds %.3f\n", elapsed);
+    write_header(f, "output_time_seconds", "gauge", "Media time muxed so far.");
+    fprintf(f, "ffmpeg_output_time_seconds %.3f\n",
+            media_time != AV_NOPTS_VALUE ? media_time / (double)AV_TIME_BASE : 0.0);
+    write_header(f, "speed", "gauge", "Media time muxed per wall clock second, below 1 is slower than realtime.");
+    fprintf(f, "ffmpeg_speed %.3f\n",
+            media_time != AV_NOPTS_VALUE && elapsed > 0 ? media_time / (double)AV_TIME_BASE / elapsed : 0.0);
+    write_header(f, "finished", "gauge", "1 once the output files are complete.");
+    fprintf(f, "ffmpeg_finished %d\n", finished);
+    write_input_metrics(f);
+    write_output_metrics(f, elapsed);
+
+    if (fclose(f) || rename(tmp, m->path) < 0) {
+        ret = AVERROR(errno);
+        av_log(NULL, AV_LOG_ERROR, "Could not write %s: %s\n", m->path, av_err2str(ret));
+    }
+end:
+    av_free(tmp);
+    return ret;
+}
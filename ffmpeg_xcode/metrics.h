@@ -0,0 +1,45 @@
+//
+//  metrics.h
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#ifndef metrics_h
+#define metrics_h
+
+#include <stdio.h>
+#include "ffmpeg.h"
+
+#define METRICS_DEFAULT_PERIOD 10000000  /* microseconds between two snapshots */
+
+/**
+ * Periodic snapshot of the stream counters in the Prometheus text format,
+ * e.g. for the node_exporter textfile collector.
+ *
+ * The snapshot is written to "<path>.tmp" and renamed over path, so a
+ * scraper never reads a half written file. Counters updated by the
+ * pipeline threads are read without locking, a snapshot may mix values
+ * a few frames apart.
+ */
+typedef struct Metrics {
+    const char *path;       /* NULL disables the export */
+    int64_t start;          /* av_gettime_relative() when the job started */
+    int64_t last_write;
+    int64_t period;
+} Metrics;
+
+void metrics_init(Metrics *m, const char *path, int64_t period);
+
+/* Return 1 when the next snapshot is due. */
+int metrics_due(Metrics *m);
+
+/**
+ * Write the counters of all the input and output streams.
+ *
+ * @param finished 1 for the snapshot taken after the trailers are written
+ */
+int metrics_write(Metrics *m, int finished);
+
+#endif /* metrics_h */
@@ -0,0 +1,275 @@
+//
+//  mux_queue.c
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#include <pthread.h>
+
+#include "mux_queue.h"
+#include "trace.h"
+#include "mem_stats.h"
+#include "stage_probe.h"
+#include "libavutil/fifo.h"
+#include "libavutil/time.h"
+
+struct MuxQueue {
+    AVFormatContext *s;
+    AVFifoBuffer *fifo;
+    size_t max_bytes;
+    size_t bytes;
+    size_t peak_bytes;
+    int eof;
+    int error;
+
+    /* per stream of s, written by the muxer thread only */
+    StageStats **stats;
+    PerfStats **perf;
+
+    /*
+     * A reference to each packet handed to av_interleaved_write_frame(),
+     * dropped once lavf let go of the packet, i.e. wrote it. Muxer thread
+     * only, the totals are under lock.
+     */
+    int track_interleaved;
+    AVBufferRef **interleaved;
+    unsigned interleaved_alloc;
+    int nb_interleaved;
+    size_t interleaved_bytes;
+    unsigned interleaved_packets;
+
+    pthread_t thread;
+    int thread_started;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+/* Keep ref, if any, and drop the references nobody else holds any more. */
+static void update_interleaved(MuxQueue *mq, AVBufferRef *ref)
+{
+    AVBufferRef **refs;
+    size_t bytes = 0;
+    int i, nb = 0;
+
+    if (ref) {
+        refs = av_fast_realloc(mq->interleaved, &mq->interleaved_alloc,
+                               (mq->nb_interleaved + 1) * sizeof(*refs));
+        if (!refs)
+            av_buffer_unref(&ref);
+        else {
+            mq->interleaved = refs;
+            mq->interleaved[mq->nb_interleaved++] = ref;
+        }
+    }
+    for (i = 0; i < mq->nb_interleaved; i++) {
+        if (av_buffer_get_ref_count(mq->interleaved[i]) == 1) {
+            av_buffer_unref(&mq->interleaved[i]);
+            continue;
+        }
+        bytes += mq->interleaved[i]->size;
+        mq->interleaved[nb++] = mq->interleaved[i];
+    }
+    mq->nb_interleaved = nb;
+
+    pthread_mutex_lock(&mq->lock);
+    mq->interleaved_bytes   = bytes;
+    mq->interleaved_packets = nb;
+    pthread_mutex_unlock(&mq->lock);
+}
+
+static void *mux_thread(void *arg)
+{
+    MuxQueue *mq = arg;
+    AVPacket pkt;
+    AVBufferRef *ref;
+    StageProbe probe;
+    int64_t pts;
+    int stream_index, valid, ret;
+
+    trace_thread_name("muxer %s", mq->s->filename);
+    mem_stats_enter(MEM_STAGE_MUXER);
+    while (1) {
+        pthread_mutex_lock(&mq->lock);
+        while (!av_fifo_size(mq->fifo) && !mq->eof)
+            pthread_cond_wait(&mq->cond, &mq->lock);
+        if (!av_fifo_size(mq->fifo)) {
+            pthread_mutex_unlock(&mq->lock);
+            break;
+        }
+        av_fifo_generic_read(mq->fifo, &pkt, sizeof(pkt), NULL);
+        mq->bytes -= pkt.size;
+        pthread_cond_broadcast(&mq->cond);
+        pthread_mutex_unlock(&mq->lock);
+
+        /* keep draining after an error so the senders never block forever */
+        if (mq->error) {
+            av_packet_unref(&pkt);
+            continue;
+        }
+        /* the muxer takes the packet, keep what the trace needs */
+        stream_index = pkt.stream_index;
+        pts          = pkt.pts;
+        /* lavf copies a packet without a buffer, the copy is charged to the muxer */
+        ref = mq->track_interleaved && pkt.buf ? av_buffer_ref(pkt.buf) : NULL;
+        stage_probe_begin(&probe, MEM_STAGE_MUXER);
+        ret = av_interleaved_write_frame(mq->s, &pkt);
+        valid = stream_index >= 0 && stream_index < mq->s->nb_streams;
+        stage_probe_end(&probe, valid ? mq->stats[stream_index] : NULL,
+                        valid ? mq->perf[stream_index] : NULL, STAGE_MUX,
+                        "av_interleaved_write_frame", stream_index, pts);
+        av_packet_unref(&pkt);
+        if (mq->track_interleaved)
+            update_interleaved(mq, ref);
+        if (ret < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Error muxing a packet for %s: %s\n",
+                   mq->s->filename, av_err2str(ret));
+            pthread_mutex_lock(&mq->lock);
+            mq->error = ret;
+            pthread_mutex_unlock(&mq->lock);
+        }
+    }
+    return NULL;
+}
+
+int mux_queue_alloc(MuxQueue **pmq, AVFormatContext *s, size_t max_bytes)
+{
+    MuxQueue *mq;
+    int ret;
+
+    if (!(mq = av_mallocz(sizeof(*mq))))
+        return AVERROR(ENOMEM);
+    mq->s = s;
+    mq->max_bytes = max_bytes;
+    mq->stats = av_mallocz_array(FFMAX(s->nb_streams, 1), sizeof(*mq->stats));
+    mq->perf  = av_mallocz_array(FFMAX(s->nb_streams, 1), sizeof(*mq->perf));
+    if (!mq->stats || !mq->perf || !(mq->fifo = av_fifo_alloc(8 * sizeof(AVPacket)))) {
+        av_free(mq->stats);
+        av_free(mq->perf);
+        av_free(mq);
+        return AVERROR(ENOMEM);
+    }
+    pthread_mutex_init(&mq->lock, NULL);
+    pthread_cond_init(&mq->cond, NULL);
+
+    if ((ret = pthread_create(&mq->thread, NULL, mux_thread, mq))) {
+        av_log(NULL, AV_LOG_ERROR, "pthread_create failed: %s\n", strerror(ret));
+        mux_queue_free(&mq);
+        return AVERROR(ret);
+    }
+    mq->thread_started = 1;
+    *pmq = mq;
+    return 0;
+}
+
+void mux_queue_set_stats(MuxQueue *mq, int stream_index, StageStats *stats, PerfStats *perf)
+{
+    if (!mq || stream_index < 0 || stream_index >= mq->s->nb_streams)
+        return;
+    pthread_mutex_lock(&mq->lock);
+    mq->stats[stream_index] = stats;
+    mq->perf[stream_index]  = perf;
+    pthread_mutex_unlock(&mq->lock);
+}
+
+void mux_queue_track_interleaved(MuxQueue *mq)
+{
+    if (!mq)
+        return;
+    pthread_mutex_lock(&mq->lock);
+    mq->track_interleaved = 1;
+    pthread_mutex_unlock(&mq->lock);
+}
+
+int mux_queue_send(MuxQueue *mq, AVPacket *pkt)
+{
+    AVPacket tmp;
+    int ret;
+
+    pthread_mutex_lock(&mq->lock);
+    while (mq->bytes && mq->bytes + pkt->size > mq->max_bytes && !mq->error)
+        pthread_cond_wait(&mq->cond, &mq->lock);
+    if ((ret = mq->error) < 0) {
+        pthread_mutex_unlock(&mq->lock);
+        av_packet_unref(pkt);
+        return ret;
+    }
+    if (av_fifo_space(mq->fifo) < sizeof(tmp) &&
+        (ret = av_fifo_grow(mq->fifo, av_fifo_size(mq->fifo))) < 0) {
+        pthread_mutex_unlock(&mq->lock);
+        av_packet_unref(pkt);
+        return ret;
+    }
+    av_packet_move_ref(&tmp, pkt);
+    av_fifo_generic_write(mq->fifo, &tmp, sizeof(tmp), NULL);
+    mq->bytes += tmp.size;
+    mq->peak_bytes = FFMAX(mq->peak_bytes, mq->bytes);
+    pthread_cond_broadcast(&mq->cond);
+    pthread_mutex_unlock(&mq->lock);
+    return 0;
+}
+
+int mux_queue_finish(MuxQueue *mq)
+{
+    if (!mq)
+        return 0;
+    pthread_mutex_lock(&mq->lock);
+    mq->eof = 1;
+    pthread_cond_broadcast(&mq->cond);
+    pthread_mutex_unlock(&mq->lock);
+
+    if (mq->thread_started) {
+        pthread_join(mq->thread, NULL);
+        mq->thread_started = 0;
+    }
+    av_log(NULL, AV_LOG_VERBOSE, "Mux queue of %s peaked at %zu of %zu bytes\n",
+           mq->s->filename, mq->peak_bytes, mq->max_bytes);
+    return mq->error;
+}
+
+void mux_queue_occupancy(MuxQueue *mq, size_t *bytes, unsigned *nb_packets, size_t *peak_bytes)
+{
+    pthread_mutex_lock(&mq->lock);
+    if (bytes)
+        *bytes = mq->bytes;
+    if (nb_packets)
+        *nb_packets = av_fifo_size(mq->fifo) / sizeof(AVPacket);
+    if (peak_bytes)
+        *peak_bytes = mq->peak_bytes;
+    pthread_mutex_unlock(&mq->lock);
+}
+
+void mux_queue_interleaved(MuxQueue *mq, size_t *bytes, unsigned *nb_packets)
+{
+    pthread_mutex_lock(&mq->lock);
+    if (bytes)
+        *bytes = mq->interleaved_bytes;
+    if (nb_packets)
+        *nb_packets = mq->interleaved_packets;
+    pthread_mutex_unlock(&mq->lock);
+}
+
+void mux_queue_free(MuxQueue **pmq)
+{
+    MuxQueue *mq = *pmq;
+    AVPacket pkt;
+
+    if (!mq)
+        return;
+    if (mq->thread_started)
+        mux_queue_finish(mq);
+    while (av_fifo_size(mq->fifo) >= sizeof(pkt)) {
+        av_fifo_generic_read(mq->fifo, &pkt, sizeof(pkt), NULL);
+        av_packet_unref(&pkt);
+    }
+    av_fifo_freep(&mq->fifo);
+    for (int i = 0; i < mq->nb_interleaved; i++)
+        av_buffer_unref(&mq->interleaved[i]);
+    av_freep(&mq->interleaved);
+    av_freep(&mq->stats);
+    av_freep(&mq->perf);
+    pthread_mutex_destroy(&mq->lock);
+    pthread_cond_destroy(&mq->cond);
+    av_freep(pmq);
+}
@@ -0,0 +1,76 @@
+//
+//  mux_queue.h
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#ifndef mux_queue_h
+#define mux_queue_h
+
+#include <stdio.h>
+#include "libavformat/avformat.h"
+#include "stage_stats.h"
+#include "perf_counters.h"
+
+/* default byte cap of the packets waiting for one muxer */
+#define MUX_QUEUE_DEFAULT_SIZE (4 * 1024 * 1024)
+
+/**
+ * Packet queue in front of one AVFormatContext, drained by a dedicated
+ * muxer thread that is the only caller of av_interleaved_write_frame().
+ *
+ * Senders block while the queued packets hold more than max_bytes of
+ * payload (a single packet is always accepted into an empty queue), so a
+ * slow write stalls the encoders only once the cap is reached. Any number
+ * of threads may send. The trailer must be written after mux_queue_finish().
+ */
+typedef struct MuxQueue MuxQueue;
+
+int mux_queue_alloc(MuxQueue **mq, AVFormatContext *s, size_t max_bytes);
+
+/*
+ * Time the writes of the packets of stream_index into stats and perf
+ * under STAGE_MUX. Either may be NULL. Call before the first send; does
+ * nothing on a NULL mq.
+ */
+void mux_queue_set_stats(MuxQueue *mq, int stream_index, StageStats *stats, PerfStats *perf);
+
+/*
+ * Also follow the packets lavf keeps in its interleaving queue, see
+ * mux_queue_interleaved(). Costs a buffer reference per packet. Call
+ * before the first send; does nothing on a NULL mq.
+ */
+void mux_queue_track_interleaved(MuxQueue *mq);
+
+/* join the muxer thread if still running and free everything */
+void mux_queue_free(MuxQueue **mq);
+
+/**
+ * Move the reference out of pkt into the queue. pkt->stream_index must
+ * already be the output stream index.
+ *
+ * @return 0 on success, or the first error the muxer thread hit
+ */
+int mux_queue_send(MuxQueue *mq, AVPacket *pkt);
+
+/**
+ * Let the muxer thread write everything still queued and wait for it.
+ * Does nothing on a NULL mq.
+ *
+ * @return 0 on success, or the first error the muxer thread hit
+ */
+int mux_queue_finish(MuxQueue *mq);
+
+/* current and peak occupancy, any pointer may be NULL */
+void mux_queue_occupancy(MuxQueue *mq, size_t *bytes, unsigned *nb_packets, size_t *peak_bytes);
+
+/*
+ * Packets written but still held by the interleaving queue of lavf, as of
+ * the last write; 0 unless mux_queue_track_interleaved() was called.
+ * Any pointer may be NULL.
+ */
+void mux_queue_interleaved(MuxQueue *mq, size_t *bytes, unsigned *nb_packets);
+
+#endif /* mux_queue_h */
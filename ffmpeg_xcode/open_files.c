@@ -16,6 +16,8 @@ OutputFile *output_file = NULL;
 OutputStream **output_streams = NULL;
 int nb_output_streams = 0;
 
+const char *scaler_profile = NULL;
+
 void *grow_array(void *array, int elem_size, int *size, int new_size) {
     if (new_size >= INT_MAX / elem_size) {
         av_log(NULL, AV_LOG_ERROR, "Array to big.\n");
@@ -51,7 +53,7 @@ OutputStream *new_output_stream(AVFormatContext *oc, enum AVMediaType type, cons
     return ost;
 }
 
-int open_output_file(const char *output_filename, int new_width, int new_height) {
+int open_output_file(const char *output_filename, int new_width, int new_height, const char *video_codec) {
     int ret = 0;
     AVFormatContext *oc;
     ret = avformat_alloc_output_context2(&oc, NULL, NULL, output_filename);
@@ -65,15 +67,18 @@ int open_output_file(const char *output_filename, int new_width, int new_height)
         switch (ist->st->codec->codec_type) {
             case AVMEDIA_TYPE_VIDEO:
                 if (av_guess_codec(oc->oformat, NULL, output_filename, NULL, AVMEDIA_TYPE_VIDEO) != AV_CODEC_ID_NONE) {
-                    OutputStream *ost = new_output_stream(oc, AVMEDIA_TYPE_VIDEO, "libx264", i);
+                    OutputStream *ost = new_output_stream(oc, AVMEDIA_TYPE_VIDEO, video_codec ? video_codec : "libx264", i);
                     if (!ost) {
                         avformat_free_context(oc);
                     }
-                    char new_size[10];
-                    snprintf(new_size, sizeof(new_size), "%dx%d", new_width, new_height);
-                    ret = av_parse_video_size(&ost->enc_ctx->width, &ost->enc_ctx->height, new_size);
-                    if (ret < 0) {
-                        return AVERROR(ENOMEM);
+                    /* a size of 0x0 makes the scale filter keep the input size */
+                    if (new_width > 0 && new_height > 0) {
+                        char new_size[32];
+                        snprintf(new_size, sizeof(new_size), "%dx%d", new_width, new_height);
+                        ret = av_parse_video_size(&ost->enc_ctx->width, &ost->enc_ctx->height, new_size);
+                        if (ret < 0) {
+                            return AVERROR(ENOMEM);
+                        }
                     }
                     ost->st->sample_aspect_ratio = ost->enc_ctx->sample_aspect_ratio;
                     ost->avfilter = "null";
@@ -137,14 +142,14 @@ int open_input_file(const char *input_filename) {
     return ret;
 }
 
-enum ERROR open_files(const char *input_filename, const char *output_filename, int width, int height) {
+enum ERROR open_files(const char *input_filename, const char *output_filename, int width, int height, const char *video_codec) {
     av_register_all();
     avcodec_register_all();
     avfilter_register_all();
     if (open_input_file(input_filename) < 0) {
         return NOT_OPEN_INPUT_FILE;
     }
-    if (open_output_file(output_filename, width, height) < 0) {
+    if (open_output_file(output_filename, width, height, video_codec) < 0) {
         return NOT_OPEN_OUTPUT_FILE;
     }
     return NONE;
@@ -14,6 +14,8 @@
 #include "libavformat/avformat.h"
 #include "libavutil/parseutils.h"
 #include "libavfilter/avfilter.h"
+#include "frame_pool.h"
+#include "alloc_stats.h"
 
 enum ERROR {
     NONE,
@@ -41,6 +43,8 @@ typedef struct InputStream {
     int resample_sample_fmt;
     int resample_sample_rate;
     struct InputFilter *filter;
+    FramePool *frame_pool;
+    AVFrame *decoded_frame;     /* reused for every decoded frame */
 } InputStream;
 
 typedef struct OutputStream {
@@ -81,10 +85,12 @@ extern OutputFile *output_file;
 extern OutputStream **output_streams;
 extern int nb_output_streams;
 
+extern const char *scaler_profile;  /* see scaler_profile.h, NULL for the default */
+
 void *grow_array(void *array, int elem_size, int *size, int new_size);
 
 #define GROW_ARRAY(array, nb_elems)\
     array = grow_array(array, sizeof(*array), &nb_elems, nb_elems + 1);
 
-enum ERROR open_files(const char *input_filename, const char *output_filename, int width, int height);
+enum ERROR open_files(const char *input_filename, const char *output_filename, int width, int height, const char *video_codec);
 #endif /* open_files_h */
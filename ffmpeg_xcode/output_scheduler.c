@@ -0,0 +1,137 @@
+//
+//  output_scheduler.c
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#include "output_scheduler.h"
+
+typedef struct HeapEntry {
+    int64_t key;
+    OutputStream *ost;
+} HeapEntry;
+
+struct OutputScheduler {
+    HeapEntry *heap;
+    int nb_entries;
+    /* heap position of every output stream, by OutputStream.sched_index */
+    int *pos;
+    int nb_streams;
+};
+
+static int64_t stream_key(const OutputStream *ost)
+{
+    if (ost->last_mux_dts == AV_NOPTS_VALUE)
+        return INT64_MIN;
+    return av_rescale_q(ost->last_mux_dts, ost->st->time_base, AV_TIME_BASE_Q);
+}
+
+static void heap_swap(OutputScheduler *sched, int a, int b)
+{
+    HeapEntry tmp = sched->heap[a];
+
+    sched->heap[a] = sched->heap[b];
+    sched->heap[b] = tmp;
+    sched->pos[sched->heap[a].ost->sched_index] = a;
+    sched->pos[sched->heap[b].ost->sched_index] = b;
+}
+
+static void sift_up(OutputScheduler *sched, int i)
+{
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (sched->heap[parent].key <= sched->heap[i].key)
+            break;
+        heap_swap(sched, parent, i);
+        i = parent;
+    }
+}
+
+static void sift_down(OutputScheduler *sched, int i)
+{
+    while (1) {
+        int left = 2 * i + 1, right = left + 1, min = i;
+
+        if (left < sched->nb_entries && sched->heap[left].key < sched->heap[min].key)
+            min = left;
+        if (right < sched->nb_entries && sched->heap[right].key < sched->heap[min].key)
+            min = right;
+        if (min == i)
+            break;
+        heap_swap(sched, i, min);
+        i = min;
+    }
+}
+
+static void heap_remove(OutputScheduler *sched, int i)
+{
+    sched->pos[sched->heap[i].ost->sched_index] = -1;
+    if (i != --sched->nb_entries) {
+        sched->heap[i] = sched->heap[sched->nb_entries];
+        sched->pos[sched->heap[i].ost->sched_index] = i;
+        sift_down(sched, i);
+        sift_up(sched, i);
+    }
+}
+
+int output_scheduler_alloc(OutputScheduler **psched, OutputStream **streams, int nb_streams)
+{
+    OutputScheduler *sched = av_mallocz(sizeof(*sched));
+    int i;
+
+    if (!sched)
+        return AVERROR(ENOMEM);
+    sched->heap = av_mallocz_array(FFMAX(nb_streams, 1), sizeof(*sched->heap));
+    sched->pos  = av_mallocz_array(FFMAX(nb_streams, 1), sizeof(*sched->pos));
+    if (!sched->heap || !sched->pos) {
+        output_scheduler_free(&sched);
+        return AVERROR(ENOMEM);
+    }
+    sched->nb_streams = nb_streams;
+
+    for (i = 0; i < nb_streams; i++) {
+        OutputStream *ost = streams[i];
+
+        ost->sched_index = i;
+        sched->pos[i] = -1;
+        if (ost->finished)
+            continue;
+        sched->heap[sched->nb_entries] = (HeapEntry){ stream_key(ost), ost };
+        sched->pos[i] = sched->nb_entries;
+        sift_up(sched, sched->nb_entries++);
+    }
+    *psched = sched;
+    return 0;
+}
+
+void output_scheduler_free(OutputScheduler **psched)
+{
+    OutputScheduler *sched = *psched;
+
+    if (!sched)
+        return;
+    av_freep(&sched->heap);
+    av_freep(&sched->pos);
+    av_freep(psched);
+}
+
+OutputStream *output_scheduler_next(OutputScheduler *sched)
+{
+    while (sched->nb_entries && sched->heap[0].ost->finished)
+        heap_remove(sched, 0);
+    return sched->nb_entries ? sched->heap[0].ost : NULL;
+}
+
+void output_scheduler_update(OutputScheduler *sched, OutputStream *ost)
+{
+    int i;
+
+    if (ost->sched_index < 0 || ost->sched_index >= sched->nb_streams ||
+        (i = sched->pos[ost->sched_index]) < 0)
+        return;
+    sched->heap[i].key = stream_key(ost);
+    sift_down(sched, i);
+    sift_up(sched, i);
+}
@@ -0,0 +1,35 @@
+//
+//  output_scheduler.h
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#ifndef output_scheduler_h
+#define output_scheduler_h
+
+#include <stdio.h>
+#include "ffmpeg.h"
+
+/**
+ * Min-heap of the output streams keyed by the DTS of the last packet
+ * handed to the muxer, so the transcode loop can feed the stream that
+ * is furthest behind without scanning all of them.
+ *
+ * last_mux_dts is used instead of AVStream.cur_dts because the muxer
+ * runs on its own thread and updates cur_dts asynchronously. Finished
+ * streams are dropped lazily by output_scheduler_next(). Not thread safe.
+ */
+typedef struct OutputScheduler OutputScheduler;
+
+int output_scheduler_alloc(OutputScheduler **sched, OutputStream **streams, int nb_streams);
+void output_scheduler_free(OutputScheduler **sched);
+
+/* unfinished stream with the smallest muxed DTS, NULL when all are finished */
+OutputStream *output_scheduler_next(OutputScheduler *sched);
+
+/* ost->last_mux_dts changed */
+void output_scheduler_update(OutputScheduler *sched, OutputStream *ost);
+
+#endif /* output_scheduler_h */
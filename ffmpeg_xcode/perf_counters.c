@@ -0,0 +1,228 @@
+//
+//  perf_counters.c
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#include <errno.h>
+#include <string.h>
+
+#include "perf_counters.h"
+#include "libavutil/avutil.h"
+#include "libavutil/log.h"
+#include "libavutil/mem.h"
+
+static int enabled;
+
+static const char *const stage_names[NB_STAGES] = {
+    [STAGE_DEMUX]       = "demux",
+    [STAGE_DECODE]      = "decode",
+    [STAGE_FILTER_PUSH] = "filter push",
+    [STAGE_FILTER_PULL] = "filter pull",
+    [STAGE_ENCODE]      = "encode",
+    [STAGE_MUX]         = "mux",
+    [STAGE_MUX_WAIT]    = "mux wait",
+};
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} counters[NB_PERF_COUNTERS] = {
+    [PERF_CYCLES]        = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    [PERF_INSTRUCTIONS]  = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    [PERF_CACHE_MISSES]  = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    [PERF_BRANCH_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+/* counter group of one thread; a counter the CPU lacks stays at -1 and reads as 0 */
+typedef struct ThreadCounters {
+    int fd[NB_PERF_COUNTERS];
+    int slot[NB_PERF_COUNTERS];     /* position in the group read, -1 if not opened */
+    int nb_open;
+} ThreadCounters;
+
+static pthread_key_t counters_key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+
+static void close_counters(void *arg)
+{
+    ThreadCounters *tc = arg;
+
+    for (int i = 0; i < NB_PERF_COUNTERS; i++)
+        if (tc->fd[i] >= 0)
+            close(tc->fd[i]);
+    av_free(tc);
+}
+
+static void create_key(void)
+{
+    pthread_key_create(&counters_key, close_counters);
+}
+
+static int open_counter(int i, int group_fd)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size           = sizeof(attr);
+    attr.type           = counters[i].type;
+    attr.config         = counters[i].config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    attr.read_format    = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                          PERF_FORMAT_TOTAL_TIME_RUNNING;
+    /* pid 0, cpu -1: the calling thread on any CPU */
+    return syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+static ThreadCounters *open_thread_counters(void)
+{
+    ThreadCounters *tc = av_mallocz(sizeof(*tc));
+
+    if (!tc)
+        return NULL;
+    for (int i = 0; i < NB_PERF_COUNTERS; i++) {
+        int group_fd = i ? tc->fd[PERF_CYCLES] : -1;
+
+        tc->slot[i] = -1;
+        if ((tc->fd[i] = open_counter(i, group_fd)) >= 0)
+            tc->slot[i] = tc->nb_open++;
+        else if (!i)
+            break;      /* no group without the leader */
+    }
+    if (tc->fd[PERF_CYCLES] < 0) {
+        for (int i = 0; i < NB_PERF_COUNTERS; i++)
+            tc->fd[i] = -1;
+        tc->nb_open = 0;
+    }
+    return tc;
+}
+
+static ThreadCounters *get_thread_counters(void)
+{
+    ThreadCounters *tc;
+
+    pthread_once(&key_once, create_key);
+    if (!(tc = pthread_getspecific(counters_key))) {
+        if (!(tc = open_thread_counters()))
+            return NULL;
+        pthread_setspecific(counters_key, tc);
+    }
+    return tc;
+}
+
+static int read_counters(ThreadCounters *tc, PerfSample *s)
+{
+    uint64_t buf[3 + NB_PERF_COUNTERS];
+
+    if (!tc->nb_open || read(tc->fd[PERF_CYCLES], buf, sizeof(buf)) < (ssize_t)((3 + tc->nb_open) * 8))
+        return 0;
+    s->time_enabled = buf[1];
+    s->time_running = buf[2];
+    for (int i = 0; i < NB_PERF_COUNTERS; i++)
+        s->value[i] = tc->slot[i] >= 0 ? buf[3 + tc->slot[i]] : 0;
+    return 1;
+}
+
+int perf_counters_enable(void)
+{
+    ThreadCounters *tc = get_thread_counters();
+    PerfSample s;
+
+    if (!tc)
+        return AVERROR(ENOMEM);
+    if (!read_counters(tc, &s)) {
+        av_log(NULL, AV_LOG_ERROR, "Could not open the hardware counters: %s\n",
+               strerror(errno));
+        return AVERROR(errno ? errno : ENOSYS);
+    }
+    if (tc->nb_open < NB_PERF_COUNTERS)
+        av_log(NULL, AV_LOG_WARNING, "Only %d of %d hardware counters are available.\n",
+               tc->nb_open, NB_PERF_COUNTERS);
+    enabled = 1;
+    return 0;
+}
+
+int perf_counters_begin(PerfSample *start)
+{
+    ThreadCounters *tc;
+
+    /* read_counters() leaves start alone when it fails */
+    memset(start, 0, sizeof(*start));
+    if (!enabled || !(tc = get_thread_counters()))
+        return 0;
+    return read_counters(tc, start);
+}
+
+void perf_counters_end(PerfStats *stats, enum Stage stage, const PerfSample *start)
+{
+    ThreadCounters *tc;
+    PerfTotals *t;
+    PerfSample end;
+    double scale;
+
+    if (!stats || !(tc = get_thread_counters()) || !read_counters(tc, &end))
+        return;
+    /* the kernel multiplexes the counters when there are too many of them */
+    scale = end.time_running > start->time_running ?
+            (double)(end.time_enabled - start->time_enabled) / (end.time_running - start->time_running) : 1.0;
+    t = &stats->stage[stage];
+    t->count++;
+    for (int i = 0; i < NB_PERF_COUNTERS; i++)
+        t->value[i] += (end.value[i] - start->value[i]) * scale;
+}
+#else
+int perf_counters_enable(void)
+{
+    av_log(NULL, AV_LOG_ERROR, "Hardware counters are only supported on Linux.\n");
+    return AVERROR(ENOSYS);
+}
+
+int perf_counters_begin(PerfSample *start)
+{
+    memset(start, 0, sizeof(*start));
+    return 0;
+}
+
+void perf_counters_end(PerfStats *stats, enum Stage stage, const PerfSample *start)
+{
+}
+#endif
+
+PerfStats *perf_stats_alloc(void)
+{
+    return enabled ? av_mallocz(sizeof(PerfStats)) : NULL;
+}
+
+void perf_stats_free(PerfStats **stats)
+{
+    av_freep(stats);
+}
+
+void perf_stats_log(const PerfStats *stats, const char *name, int level)
+{
+    if (!stats)
+        return;
+    for (int i = 0; i < NB_STAGES; i++) {
+        const PerfTotals *t = &stats->stage[i];
+        double instructions = t->value[PERF_INSTRUCTIONS];
+
+        if (!t->count)
+            continue;
+        av_log(NULL, level, "%s %-11s %8.0f kcycles/call, IPC %.2f, %.2f cache misses/kinstr, "
+               "%.2f branch misses/kinstr\n", name, stage_names[i],
+               t->value[PERF_CYCLES] / t->count / 1000,
+               t->value[PERF_CYCLES] > 0 ? instructions / t->value[PERF_CYCLES] : 0.0,
+               instructions > 0 ? t->value[PERF_CACHE_MISSES] * 1000 / instructions : 0.0,
+               instructions > 0 ? t->value[PERF_BRANCH_MISSES] * 1000 / instructions : 0.0);
+    }
+}
@@ -0,0 +1,69 @@
+//
+//  perf_counters.h
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#ifndef perf_counters_h
+#define perf_counters_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include "stage_stats.h"
+
+enum PerfCounter {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_CACHE_MISSES,
+    PERF_BRANCH_MISSES,
+    NB_PERF_COUNTERS,
+};
+
+/* Counter values of the calling thread at one point in time. */
+typedef struct PerfSample {
+    uint64_t value[NB_PERF_COUNTERS];
+    uint64_t time_enabled;
+    uint64_t time_running;
+} PerfSample;
+
+typedef struct PerfTotals {
+    uint64_t count;                     /* number of recorded intervals */
+    double value[NB_PERF_COUNTERS];     /* scaled for counter multiplexing */
+} PerfTotals;
+
+/*
+ * Hardware counters of one stream per stage. As with StageStats, each
+ * stage may only be recorded by one thread at a time.
+ */
+typedef struct PerfStats {
+    PerfTotals stage[NB_STAGES];
+} PerfStats;
+
+/**
+ * Opt in: check that the counters can be opened (Linux perf_event_open(),
+ * see /proc/sys/kernel/perf_event_paranoid). Every thread opens its own
+ * counter group on first use, the counters only count that thread: work
+ * a codec or filter graph hands to its worker threads is not counted, so
+ * callers run them with one thread while the counters are on.
+ */
+int perf_counters_enable(void);
+
+/* NULL when the counters are disabled, so streams need no checks */
+PerfStats *perf_stats_alloc(void);
+void perf_stats_free(PerfStats **stats);
+
+/*
+ * Read the counters of the calling thread. Return 0, with start zeroed,
+ * if they are disabled or could not be read; skip perf_counters_end() then.
+ */
+int perf_counters_begin(PerfSample *start);
+
+/* Add what the calling thread counted since start to stage of stats. */
+void perf_counters_end(PerfStats *stats, enum Stage stage, const PerfSample *start);
+
+/* Print cycles, IPC, cache and branch misses per recorded stage. */
+void perf_stats_log(const PerfStats *stats, const char *name, int level);
+
+#endif /* perf_counters_h */
@@ -0,0 +1,67 @@
+//
+//  progress.c
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#include "progress.h"
+#include "libavutil/avutil.h"
+#include "libavutil/log.h"
+#include "libavutil/time.h"
+
+void progress_init(Progress *p, int64_t duration, int64_t period)
+{
+    p->start       = av_gettime_relative();
+    p->last_report = p->start;
+    p->period      = period;
+    p->duration    = duration;
+}
+
+int progress_due(Progress *p)
+{
+    int64_t now;
+
+    if (p->period <= 0)
+        return 0;
+    now = av_gettime_relative();
+    if (now - p->last_report < p->period)
+        return 0;
+    p->last_report = now;
+    return 1;
+}
+
+static void format_time(char *buf, size_t size, int64_t t)
+{
+    int64_t secs;
+
+    if (t == AV_NOPTS_VALUE || t < 0) {
+        snprintf(buf, size, "N/A");
+        return;
+    }
+    secs = t / AV_TIME_BASE;
+    snprintf(buf, size, "%02d:%02d:%02d.%02d", (int)(secs / 3600), (int)(secs / 60 % 60),
+             (int)(secs % 60), (int)(t % AV_TIME_BASE / (AV_TIME_BASE / 100)));
+}
+
+void progress_print(Progress *p, uint64_t frames, uint64_t bytes, int64_t media_time, int is_last)
+{
+    double elapsed = (av_gettime_relative() - p->start) / 1000000.0;
+    double media   = media_time != AV_NOPTS_VALUE && media_time > 0 ? media_time / (double)AV_TIME_BASE : 0;
+    double speed   = elapsed > 0 ? media / elapsed : 0;
+    int64_t eta    = AV_NOPTS_VALUE;
+    char time_str[32], eta_str[32];
+
+    if (p->period <= 0 && !is_last)
+        return;
+    if (!is_last && p->duration != AV_NOPTS_VALUE && speed > 0)
+        eta = (int64_t)(FFMAX(p->duration - media_time, 0) / speed);
+    format_time(time_str, sizeof(time_str), media_time);
+    format_time(eta_str, sizeof(eta_str), is_last ? 0 : eta);
+
+    av_log(NULL, AV_LOG_INFO,
+           "frame=%6"PRIu64" fps=%5.1f size=%8"PRIu64"kB time=%s bitrate=%7.1fkbits/s speed=%5.2fx eta=%s%c",
+           frames, elapsed > 0 ? frames / elapsed : 0.0, bytes / 1024, time_str,
+           media > 0 ? bytes * 8 / media / 1000 : 0.0, speed, eta_str, is_last ? '\n' : '\r');
+}
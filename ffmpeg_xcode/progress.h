@@ -0,0 +1,38 @@
+//
+//  progress.h
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#ifndef progress_h
+#define progress_h
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define PROGRESS_DEFAULT_PERIOD 500000  /* microseconds between two reports */
+
+/* Rate limited progress line: frames, fps, size, bitrate, speed and ETA. */
+typedef struct Progress {
+    int64_t start;          /* av_gettime_relative() when the job started */
+    int64_t last_report;
+    int64_t period;         /* microseconds between reports, <= 0 disables them */
+    int64_t duration;       /* expected media duration, AV_NOPTS_VALUE if unknown */
+} Progress;
+
+void progress_init(Progress *p, int64_t duration, int64_t period);
+
+/* Return 1 when the next report is due; cheap enough to call per packet. */
+int progress_due(Progress *p);
+
+/**
+ * Print a report; the last one ends the line and is printed even when
+ * reports are disabled.
+ *
+ * @param media_time output position in AV_TIME_BASE units
+ */
+void progress_print(Progress *p, uint64_t frames, uint64_t bytes, int64_t media_time, int is_last);
+
+#endif /* progress_h */
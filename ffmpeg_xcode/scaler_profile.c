@@ -0,0 +1,86 @@
+//
+//  scaler_profile.c
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#include <string.h>
+
+#include "scaler_profile.h"
+#include "libavutil/avstring.h"
+#include "libavutil/common.h"
+#include "libavutil/error.h"
+#include "libavutil/log.h"
+
+static const char *const algorithms[] = {
+    "auto", "fast_bilinear", "bilinear", "area", "bicubic", "lanczos",
+};
+
+static const char *const toggles[] = {
+    "accurate_rnd", "full_chroma_int",
+};
+
+/* Is the part of s up to the next '+' one of names? */
+static int match(const char *s, const char *const *names, int nb_names)
+{
+    size_t len = strcspn(s, "+");
+
+    for (int i = 0; i < nb_names; i++)
+        if (strlen(names[i]) == len && !strncmp(s, names[i], len))
+            return 1;
+    return 0;
+}
+
+int scaler_profile_check(const char *profile)
+{
+    const char *p = profile;
+
+    if (!match(p, algorithms, FF_ARRAY_ELEMS(algorithms)))
+        goto fail;
+    while ((p = strchr(p, '+')))
+        if (!match(++p, toggles, FF_ARRAY_ELEMS(toggles)))
+            goto fail;
+    return 0;
+
+fail:
+    av_log(NULL, AV_LOG_ERROR, "Invalid scaler profile '%s', expected one of auto, fast_bilinear, "
+           "bilinear, area, bicubic or lanczos, optionally followed by +accurate_rnd and "
+           "+full_chroma_int.\n", profile);
+    return AVERROR(EINVAL);
+}
+
+static const char *auto_algorithm(int in_w, int in_h, int out_w, int out_h)
+{
+    if (out_w == in_w && out_h == in_h)
+        return "bilinear";
+    if (out_w > in_w || out_h > in_h)
+        return "lanczos";
+    /* area averages every input pixel, the filters would alias at this ratio */
+    if (2 * out_w <= in_w && 2 * out_h <= in_h)
+        return "area";
+    return "bicubic";
+}
+
+char *scaler_profile_flags(const char *profile, int in_w, int in_h, int out_w, int out_h,
+                           char *buf, size_t size)
+{
+    const char *toggle;
+
+    if (!profile)
+        profile = SCALER_PROFILE_DEFAULT;
+    if (out_w <= 0 || out_h <= 0) {
+        out_w = in_w;
+        out_h = in_h;
+    }
+    if (!strncmp(profile, "auto", 4) && (!profile[4] || profile[4] == '+')) {
+        av_strlcpy(buf, auto_algorithm(in_w, in_h, out_w, out_h), size);
+        toggle = profile + 4;
+    } else {
+        toggle = profile + strcspn(profile, "+");
+        av_strlcpy(buf, profile, FFMIN(size, toggle - profile + 1));
+    }
+    av_strlcat(buf, toggle, size);
+    return buf;
+}
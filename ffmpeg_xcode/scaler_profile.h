@@ -0,0 +1,42 @@
+//
+//  scaler_profile.h
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#ifndef scaler_profile_h
+#define scaler_profile_h
+
+#include <stdio.h>
+
+/*
+ * A scaler profile picks the libswscale flags of a scale filter:
+ *
+ *     algorithm[+accurate_rnd][+full_chroma_int]
+ *
+ * algorithm is one of fast_bilinear, bilinear, area, bicubic, lanczos or
+ * auto, which chooses by the ratio of output to input size:
+ *
+ *     same size (format conversion only)   bilinear
+ *     downscale by 2 or more               area
+ *     downscale by less than 2             bicubic
+ *     upscale                              lanczos
+ */
+#define SCALER_PROFILE_DEFAULT "auto"
+
+/* Return 0 if profile is valid, AVERROR(EINVAL) and log otherwise. */
+int scaler_profile_check(const char *profile);
+
+/**
+ * Write the "flags" value of a scale filter scaling in_w x in_h to
+ * out_w x out_h with profile (NULL for the default) to buf.
+ * An output size <= 0 keeps the input size.
+ *
+ * @return buf
+ */
+char *scaler_profile_flags(const char *profile, int in_w, int in_h, int out_w, int out_h,
+                           char *buf, size_t size);
+
+#endif /* scaler_profile_h */
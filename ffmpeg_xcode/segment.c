@@ -0,0 +1,335 @@
+//
+//  segment.c
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#include <string.h>
+#include <unistd.h>
+
+#include "segment.h"
+#include "libavformat/avformat.h"
+#include "libavutil/avstring.h"
+#include "libavutil/mathematics.h"
+
+/* pts of the first video keyframe at or after ts, AV_NOPTS_VALUE at EOF */
+static int64_t next_keyframe(AVFormatContext *ic, int video_index, int64_t ts)
+{
+    AVStream *st = ic->streams[video_index];
+    AVPacket pkt;
+
+    if (avformat_seek_file(ic, -1, ts, ts, INT64_MAX, 0) < 0)
+        return AV_NOPTS_VALUE;
+    while (av_read_frame(ic, &pkt) >= 0) {
+        int64_t pts = pkt.pts != AV_NOPTS_VALUE ? pkt.pts : pkt.dts;
+        int key = pkt.stream_index == video_index && (pkt.flags & AV_PKT_FLAG_KEY);
+
+        av_packet_unref(&pkt);
+        if (key && pts != AV_NOPTS_VALUE &&
+            (pts = av_rescale_q(pts, st->time_base, AV_TIME_BASE_Q)) >= ts)
+            return pts;
+    }
+    return AV_NOPTS_VALUE;
+}
+
+int segment_split_points(const char *filename, int nb_segments,
+                         int64_t **ppoints, int *nb_points)
+{
+    AVFormatContext *ic = NULL;
+    int64_t *points, start;
+    int i, video_index, ret;
+
+    *ppoints = NULL;
+    *nb_points = 0;
+    if ((ret = avformat_open_input(&ic, filename, NULL, NULL)) < 0)
+        return ret;
+    if ((ret = avformat_find_stream_info(ic, NULL)) < 0)
+        goto end;
+    if ((ret = video_index = av_find_best_stream(ic, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "%s has no video stream to split at.\n", filename);
+        goto end;
+    }
+    if (ic->duration == AV_NOPTS_VALUE || ic->duration <= 0) {
+        av_log(NULL, AV_LOG_ERROR, "The duration of %s is unknown.\n", filename);
+        ret = AVERROR(EINVAL);
+        goto end;
+    }
+    if (!(points = av_malloc_array(FFMAX(nb_segments, 1), sizeof(*points)))) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    start = ic->start_time != AV_NOPTS_VALUE ? ic->start_time : 0;
+    points[(*nb_points)++] = AV_NOPTS_VALUE;
+    for (i = 1; i < nb_segments; i++) {
+        int64_t pts = next_keyframe(ic, video_index, start + av_rescale(ic->duration, i, nb_segments));
+
+        if (pts == AV_NOPTS_VALUE)
+            break;
+        /* long GOPs may put several targets on the same keyframe */
+        if (*nb_points > 1 && pts <= points[*nb_points - 1])
+            continue;
+        points[(*nb_points)++] = pts;
+    }
+    *ppoints = points;
+    ret = 0;
+
+end:
+    avformat_close_input(&ic);
+    return ret;
+}
+
+static int open_concat_output(AVFormatContext **poc, AVFormatContext *ic, const char *output)
+{
+    AVFormatContext *oc = NULL;
+    int i, ret;
+
+    if ((ret = avformat_alloc_output_context2(&oc, NULL, NULL, output)) < 0)
+        return ret;
+    *poc = oc;
+    for (i = 0; i < ic->nb_streams; i++) {
+        AVStream *ist = ic->streams[i];
+        AVStream *ost = avformat_new_stream(oc, NULL);
+
+        if (!ost)
+            return AVERROR(ENOMEM);
+        if ((ret = avcodec_copy_context(ost->codec, ist->codec)) < 0)
+            return ret;
+        ost->codec->codec_tag      = 0;
+        ost->time_base             = ist->time_base;
+        ost->avg_frame_rate        = ist->avg_frame_rate;
+        ost->sample_aspect_ratio   = ist->sample_aspect_ratio;
+        ost->disposition           = ist->disposition;
+        av_dict_copy(&ost->metadata, ist->metadata, 0);
+    }
+    av_dict_copy(&oc->metadata, ic->metadata, 0);
+
+    if (!(oc->oformat->flags & AVFMT_NOFILE) &&
+        (ret = avio_open(&oc->pb, output, AVIO_FLAG_WRITE)) < 0)
+        return ret;
+    return avformat_write_header(oc, NULL);
+}
+
+/* the segments were encoded apart, their headers must still agree */
+static int check_segment(AVFormatContext *oc, AVFormatContext *ic, const char *filename)
+{
+    int i;
+
+    if (ic->nb_streams != oc->nb_streams) {
+        av_log(NULL, AV_LOG_ERROR, "%s has %d streams instead of %d.\n",
+               filename, ic->nb_streams, oc->nb_streams);
+        return AVERROR(EINVAL);
+    }
+    for (i = 0; i < ic->nb_streams; i++) {
+        AVCodecContext *dec = ic->streams[i]->codec, *enc = oc->streams[i]->codec;
+
+        if (dec->codec_id != enc->codec_id) {
+            av_log(NULL, AV_LOG_ERROR, "Stream #%d of %s is %s instead of %s.\n", i, filename,
+                   avcodec_get_name(dec->codec_id), avcodec_get_name(enc->codec_id));
+            return AVERROR(EINVAL);
+        }
+        if (dec->extradata_size != enc->extradata_size ||
+            (dec->extradata_size && memcmp(dec->extradata, enc->extradata, dec->extradata_size)))
+            av_log(NULL, AV_LOG_WARNING, "Stream #%d of %s has different codec headers, "
+                   "the joined file may not decode.\n", i, filename);
+    }
+    return 0;
+}
+
+/* where each output stream stands while the segments are joined */
+typedef struct ConcatStream {
+    int64_t end;                /* end of what was written, output time base */
+    int64_t last_dts;
+    int64_t shift;              /* added to the timestamps of the current segment */
+    int started;                /* the shift of the current segment is known */
+} ConcatStream;
+
+/*
+ * Place pkt, in the output time base of stream s, after what stream s
+ * wrote so far. Return 0 when the packet is to be dropped: the encoder
+ * priming of a segment after the first, and the audio packets that would
+ * put the stream ahead of the video by half a packet or more, as each
+ * segment ends with the padding of a whole audio frame.
+ */
+static int place_packet(AVFormatContext *oc, ConcatStream *cs, int s, int segment,
+                        int64_t origin, int64_t video_start, int video_index, AVPacket *pkt)
+{
+    ConcatStream *c = &cs[s];
+    AVStream *st = oc->streams[s];
+
+    if (!c->started && segment) {
+        int64_t origin_s = av_rescale_q(origin, AV_TIME_BASE_Q, st->time_base);
+
+        if (st->codec->codec_type == AVMEDIA_TYPE_AUDIO && pkt->pts != AV_NOPTS_VALUE) {
+            /* where the packet belongs on the timeline of the video */
+            int64_t target = video_index >= 0 ?
+                             av_rescale_q(video_start, oc->streams[video_index]->time_base,
+                                          st->time_base) + pkt->pts - origin_s : c->end;
+
+            if (pkt->pts + pkt->duration <= origin_s ||
+                (pkt->duration > 0 && 2 * (c->end - target) >= pkt->duration))
+                return 0;
+            c->shift = c->end - pkt->pts;
+        } else {
+            c->shift = c->end - origin_s;
+        }
+    }
+    c->started = 1;
+
+    if (pkt->pts != AV_NOPTS_VALUE)
+        pkt->pts += c->shift;
+    if (pkt->dts != AV_NOPTS_VALUE)
+        pkt->dts += c->shift;
+    /* rounding of the shifts must not make the muxer see DTS going back */
+    if (pkt->dts != AV_NOPTS_VALUE && c->last_dts != AV_NOPTS_VALUE && pkt->dts <= c->last_dts) {
+        pkt->dts = c->last_dts + 1;
+        if (pkt->pts != AV_NOPTS_VALUE)
+            pkt->pts = FFMAX(pkt->pts, pkt->dts);
+    }
+    if (pkt->dts != AV_NOPTS_VALUE)
+        c->last_dts = pkt->dts;
+    if (pkt->pts != AV_NOPTS_VALUE)
+        c->end = FFMAX(c->end, pkt->pts + pkt->duration);
+    return 1;
+}
+
+int segment_concat(char * const *segments, int nb_segments, const char *output)
+{
+    AVFormatContext *oc = NULL, *ic = NULL;
+    ConcatStream *cs = NULL;
+    int i, j, video_index = -1, ret = 0;
+
+    for (i = 0; i < nb_segments; i++) {
+        int64_t origin = 0, video_start = 0;
+        AVPacket pkt;
+
+        if ((ret = avformat_open_input(&ic, segments[i], NULL, NULL)) < 0 ||
+            (ret = avformat_find_stream_info(ic, NULL)) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Could not open segment %s: %s\n", segments[i], av_err2str(ret));
+            goto end;
+        }
+        if (!oc) {
+            if ((ret = open_concat_output(&oc, ic, output)) < 0) {
+                av_log(NULL, AV_LOG_ERROR, "Could not open %s: %s\n", output, av_err2str(ret));
+                goto end;
+            }
+            if (!(cs = av_mallocz_array(oc->nb_streams, sizeof(*cs)))) {
+                ret = AVERROR(ENOMEM);
+                goto end;
+            }
+            for (j = 0; j < oc->nb_streams; j++)
+                cs[j].last_dts = AV_NOPTS_VALUE;
+            video_index = av_find_best_stream(ic, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+            if (video_index < 0)
+                video_index = -1;
+        } else if ((ret = check_segment(oc, ic, segments[i])) < 0) {
+            goto end;
+        }
+
+        /*
+         * Every stream of a segment continues from its own end. The segment
+         * starts at its first video keyframe; the priming of the audio
+         * encoder lies before it.
+         */
+        if (video_index >= 0 && ic->streams[video_index]->start_time != AV_NOPTS_VALUE) {
+            origin = av_rescale_q(ic->streams[video_index]->start_time,
+                                  ic->streams[video_index]->time_base, AV_TIME_BASE_Q);
+            video_start = cs[video_index].end;
+        } else if (ic->start_time != AV_NOPTS_VALUE) {
+            origin = FFMAX(ic->start_time, 0);
+        }
+        for (j = 0; j < oc->nb_streams; j++)
+            cs[j].started = 0;
+
+        while ((ret = av_read_frame(ic, &pkt)) >= 0) {
+            AVStream *ist = ic->streams[pkt.stream_index];
+            AVStream *ost = oc->streams[pkt.stream_index];
+
+            av_packet_rescale_ts(&pkt, ist->time_base, ost->time_base);
+            if (!place_packet(oc, cs, pkt.stream_index, i, origin, video_start, video_index, &pkt)) {
+                av_packet_unref(&pkt);
+                continue;
+            }
+            pkt.pos = -1;
+            if ((ret = av_interleaved_write_frame(oc, &pkt)) < 0) {
+                av_log(NULL, AV_LOG_ERROR, "Could not write a packet of %s: %s\n",
+                       segments[i], av_err2str(ret));
+                goto end;
+            }
+        }
+        if (ret != AVERROR_EOF)
+            goto end;
+        avformat_close_input(&ic);
+    }
+    ret = oc ? av_write_trailer(oc) : AVERROR(EINVAL);
+
+end:
+    avformat_close_input(&ic);
+    av_free(cs);
+    if (oc) {
+        if (!(oc->oformat->flags & AVFMT_NOFILE))
+            avio_closep(&oc->pb);
+        avformat_free_context(oc);
+    }
+    return ret;
+}
+
+int segment_run(const BatchJob *job, int nb_segments,
+                int (*run_job)(const BatchJob *job, void *opaque), void *opaque)
+{
+    const char *ext = strrchr(job->output, '.');
+    BatchJob *jobs = NULL;
+    int64_t *points = NULL;
+    int i, nb_points, ret;
+
+    if ((ret = segment_split_points(job->input, nb_segments, &points, &nb_points)) < 0)
+        return ret;
+    if (!(jobs = av_mallocz_array(nb_points, sizeof(*jobs)))) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    for (i = 0; i < nb_points; i++) {
+        jobs[i] = *job;
+        jobs[i].start_time = points[i];
+        jobs[i].stop_time  = i + 1 < nb_points ? points[i + 1] : AV_NOPTS_VALUE;
+        /* keep the extension, it selects the muxer of the segment */
+        if (!(jobs[i].output = av_asprintf("%s.part%d%s", job->output, i, ext ? ext : ""))) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+    }
+    av_log(NULL, AV_LOG_INFO, "Encoding %s in %d segments\n", job->input, nb_points);
+
+    if ((ret = batch_run(jobs, nb_points, nb_points, run_job, opaque)) != 0) {
+        av_log(NULL, AV_LOG_ERROR, "%d segments of %s failed.\n", ret, job->input);
+        if (ret > 0)
+            ret = AVERROR_EXTERNAL;
+        goto end;
+    }
+    {
+        char **outputs = av_malloc_array(nb_points, sizeof(*outputs));
+        if (!outputs) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        for (i = 0; i < nb_points; i++)
+            outputs[i] = jobs[i].output;
+        ret = segment_concat(outputs, nb_points, job->output);
+        av_free(outputs);
+    }
+
+end:
+    if (jobs) {
+        for (i = 0; i < nb_points; i++) {
+            if (!jobs[i].output)
+                continue;
+            unlink(jobs[i].output);
+            av_freep(&jobs[i].output);
+        }
+        av_free(jobs);
+    }
+    av_free(points);
+    return ret;
+}
@@ -0,0 +1,41 @@
+//
+//  segment.h
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#ifndef segment_h
+#define segment_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include "batch.h"
+
+/**
+ * Find up to nb_segments start times, in AV_TIME_BASE units, that split
+ * filename into ranges of about equal duration. Every start time but the
+ * first one, which is AV_NOPTS_VALUE, is the pts of a video keyframe.
+ */
+int segment_split_points(const char *filename, int nb_segments,
+                         int64_t **points, int *nb_points);
+
+/**
+ * Join segment files that have the same streams and codec parameters
+ * into output by stream copy. Every stream of a segment continues where
+ * the same stream of the previous one ended; the audio encoder priming of
+ * later segments is dropped and the audio is kept within half a packet
+ * of the video.
+ */
+int segment_concat(char * const *segments, int nb_segments, const char *output);
+
+/**
+ * Encode job in nb_segments keyframe aligned pieces, each in its own
+ * worker process running run_job, then concatenate the pieces into
+ * job->output. The segments assume closed GOPs in the input.
+ */
+int segment_run(const BatchJob *job, int nb_segments,
+                int (*run_job)(const BatchJob *job, void *opaque), void *opaque);
+
+#endif /* segment_h */
@@ -0,0 +1,37 @@
+//
+//  stage_probe.c
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#include "stage_probe.h"
+#include "trace.h"
+#include "libavutil/time.h"
+
+void stage_probe_begin(StageProbe *probe, enum MemStage mem_stage)
+{
+    probe->prev_mem_stage = mem_stats_enter(mem_stage);
+    probe->trace_start    = trace_begin();
+    probe->perf_started   = perf_counters_begin(&probe->perf_start);
+    probe->t0             = av_gettime_relative();
+}
+
+int64_t stage_probe_end(StageProbe *probe, StageStats *stats, PerfStats *perf,
+                        enum Stage stage, const char *name, int idx, int64_t pts)
+{
+    int64_t elapsed = av_gettime_relative() - probe->t0;
+
+    if (probe->perf_started)
+        perf_counters_end(perf, stage, &probe->perf_start);
+    mem_stats_leave(probe->prev_mem_stage);
+    trace_end(name, idx, probe->trace_start, pts);
+    stage_stats_add(stats, stage, elapsed);
+    return elapsed;
+}
+
+void stage_probe_cancel(StageProbe *probe)
+{
+    mem_stats_leave(probe->prev_mem_stage);
+}
@@ -0,0 +1,45 @@
+//
+//  stage_probe.h
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#ifndef stage_probe_h
+#define stage_probe_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include "mem_stats.h"
+#include "perf_counters.h"
+#include "stage_stats.h"
+
+/**
+ * One timed call into a stage: tags the allocations of the calling thread
+ * with the memory stage, and records the wall time, the hardware counters
+ * and a trace event when it ends.
+ */
+typedef struct StageProbe {
+    enum MemStage prev_mem_stage;
+    int64_t trace_start;
+    int64_t t0;
+    int perf_started;
+    PerfSample perf_start;
+} StageProbe;
+
+void stage_probe_begin(StageProbe *probe, enum MemStage mem_stage);
+
+/**
+ * Record the call under stage of stats and perf, either may be NULL, and
+ * as the trace event name of stream idx.
+ *
+ * @return the wall time of the call in microseconds
+ */
+int64_t stage_probe_end(StageProbe *probe, StageStats *stats, PerfStats *perf,
+                        enum Stage stage, const char *name, int idx, int64_t pts);
+
+/* End the call without recording it, e.g. when it produced nothing. */
+void stage_probe_cancel(StageProbe *probe);
+
+#endif /* stage_probe_h */
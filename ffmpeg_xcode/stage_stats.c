@@ -0,0 +1,115 @@
+//
+//  stage_stats.c
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#include "stage_stats.h"
+#include "libavutil/common.h"
+#include "libavutil/log.h"
+#include "libavutil/mem.h"
+
+static const char *const stage_names[NB_STAGES] = {
+    [STAGE_DEMUX]       = "demux",
+    [STAGE_DECODE]      = "decode",
+    [STAGE_FILTER_PUSH] = "filter push",
+    [STAGE_FILTER_PULL] = "filter pull",
+    [STAGE_ENCODE]      = "encode",
+    [STAGE_MUX]         = "mux",
+    [STAGE_MUX_WAIT]    = "mux wait",
+};
+
+static int log2_64(uint64_t v)
+{
+    return v >> 32 ? av_log2(v >> 32) + 32 : av_log2(v);
+}
+
+static int bucket_index(int64_t usec)
+{
+    int exp;
+
+    if (usec < (1 << STAGE_HIST_SUB_BITS))
+        return usec;
+    usec = FFMIN(usec, (INT64_C(1) << STAGE_HIST_MAX_BITS) - 1);
+    exp  = log2_64(usec);
+    return ((exp - STAGE_HIST_SUB_BITS + 1) << STAGE_HIST_SUB_BITS) +
+           ((usec >> (exp - STAGE_HIST_SUB_BITS)) & ((1 << STAGE_HIST_SUB_BITS) - 1));
+}
+
+/* largest duration that falls into bucket i */
+static int64_t bucket_upper_bound(int i)
+{
+    int shift = (i >> STAGE_HIST_SUB_BITS) - 1;
+    int sub   = i & ((1 << STAGE_HIST_SUB_BITS) - 1);
+
+    if (shift < 0)
+        return i;
+    return ((int64_t)((1 << STAGE_HIST_SUB_BITS) + sub + 1) << shift) - 1;
+}
+
+StageStats *stage_stats_alloc(void)
+{
+    return av_mallocz(sizeof(StageStats));
+}
+
+void stage_stats_free(StageStats **stats)
+{
+    av_freep(stats);
+}
+
+void stage_stats_add(StageStats *stats, enum Stage stage, int64_t usec)
+{
+    StageHistogram *hist;
+
+    if (!stats)
+        return;
+    hist = &stats->stage[stage];
+    usec = FFMAX(usec, 0);
+    hist->count++;
+    hist->total += usec;
+    hist->max    = FFMAX(hist->max, usec);
+    hist->buckets[bucket_index(usec)]++;
+}
+
+int64_t stage_stats_percentile(const StageHistogram *hist, double percent)
+{
+    uint64_t target = (uint64_t)(hist->count * percent / 100.0 + 0.5), seen = 0;
+    int i;
+
+    if (!hist->count)
+        return 0;
+    target = FFMAX(target, 1);
+    for (i = 0; i < STAGE_HIST_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= target)
+            return FFMIN(bucket_upper_bound(i), hist->max);
+    }
+    return hist->max;
+}
+
+void stage_stats_log(const StageStats *stats, const char *name, int level)
+{
+    int i, slowest = -1;
+
+    if (!stats)
+        return;
+    for (i = 0; i < NB_STAGES; i++) {
+        const StageHistogram *hist = &stats->stage[i];
+
+        if (!hist->count)
+            continue;
+        av_log(NULL, level, "%s %-11s %8"PRIu64" calls %10.3f s %7.1f/s  "
+               "mean %6"PRId64" p50 %6"PRId64" p90 %6"PRId64" p99 %6"PRId64" max %7"PRId64" us\n",
+               name, stage_names[i], hist->count, hist->total / 1000000.0,
+               hist->total ? hist->count * 1000000.0 / hist->total : 0.0,
+               hist->total / (int64_t)hist->count,
+               stage_stats_percentile(hist, 50), stage_stats_percentile(hist, 90),
+               stage_stats_percentile(hist, 99), hist->max);
+        if (slowest < 0 || hist->total > stats->stage[slowest].total)
+            slowest = i;
+    }
+    if (slowest >= 0)
+        av_log(NULL, level, "%s spends most time in %s\n", name, stage_names[slowest]);
+}
@@ -0,0 +1,59 @@
+//
+//  stage_stats.h
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#ifndef stage_stats_h
+#define stage_stats_h
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Pipeline stages timed per packet or frame. */
+enum Stage {
+    STAGE_DEMUX,
+    STAGE_DECODE,
+    STAGE_FILTER_PUSH,      /* av_buffersrc_add_frame */
+    STAGE_FILTER_PULL,      /* av_buffersink_get_frame */
+    STAGE_ENCODE,
+    STAGE_MUX,              /* av_interleaved_write_frame, on the muxer thread with a mux queue */
+    STAGE_MUX_WAIT,         /* handing the packet to a full mux queue */
+    NB_STAGES,
+};
+
+/*
+ * Durations in microseconds go to log-linear buckets: exact below 8,
+ * then 8 buckets per power of two, i.e. at most 12.5% error.
+ */
+#define STAGE_HIST_SUB_BITS 3
+#define STAGE_HIST_MAX_BITS 40
+#define STAGE_HIST_BUCKETS  ((STAGE_HIST_MAX_BITS - STAGE_HIST_SUB_BITS + 1) << STAGE_HIST_SUB_BITS)
+
+typedef struct StageHistogram {
+    uint64_t count;
+    int64_t total;
+    int64_t max;
+    uint64_t buckets[STAGE_HIST_BUCKETS];
+} StageHistogram;
+
+/* Histograms of one stream. Each stage may only be recorded by one thread at a time. */
+typedef struct StageStats {
+    StageHistogram stage[NB_STAGES];
+} StageStats;
+
+StageStats *stage_stats_alloc(void);
+void stage_stats_free(StageStats **stats);
+
+/* NULL stats are ignored, so uninstrumented streams need no checks */
+void stage_stats_add(StageStats *stats, enum Stage stage, int64_t usec);
+
+/* Value below which the given percentage of the recorded durations fall. */
+int64_t stage_stats_percentile(const StageHistogram *hist, double percent);
+
+/* Print one line per recorded stage of stats, and the stage with the most time. */
+void stage_stats_log(const StageStats *stats, const char *name, int level);
+
+#endif /* stage_stats_h */
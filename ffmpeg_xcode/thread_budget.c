@@ -0,0 +1,154 @@
+//
+//  thread_budget.c
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "thread_budget.h"
+#include "libavutil/avstring.h"
+#include "libavutil/common.h"
+#include "libavutil/cpu.h"
+#include "libavutil/log.h"
+#include "libavutil/mem.h"
+
+struct ThreadShare {
+    char name[64];
+    int64_t cost;
+    atomic_int_least64_t busy_usec;
+    struct ThreadShare *next;
+};
+
+static pthread_mutex_t budget_lock = PTHREAD_MUTEX_INITIALIZER;
+static ThreadShare *shares;
+static int budget_cores;
+
+void thread_budget_set_cores(int nb_cores)
+{
+    pthread_mutex_lock(&budget_lock);
+    budget_cores = nb_cores > 0 ? nb_cores : av_cpu_count();
+    pthread_mutex_unlock(&budget_lock);
+}
+
+int thread_budget_cores(void)
+{
+    int nb_cores;
+
+    pthread_mutex_lock(&budget_lock);
+    if (!budget_cores)
+        budget_cores = av_cpu_count();
+    nb_cores = budget_cores;
+    pthread_mutex_unlock(&budget_lock);
+    return nb_cores;
+}
+
+int64_t thread_budget_video_cost(int width, int height, int weight)
+{
+    return (int64_t) FFMAX(width, 16) * FFMAX(height, 16) * weight;
+}
+
+ThreadShare *thread_budget_acquire(const char *name, int64_t cost)
+{
+    ThreadShare *share = av_mallocz(sizeof(*share));
+
+    if (!share)
+        return NULL;
+    av_strlcpy(share->name, name, sizeof(share->name));
+    share->cost = FFMAX(cost, 1);
+    atomic_init(&share->busy_usec, 0);
+
+    pthread_mutex_lock(&budget_lock);
+    share->next = shares;
+    shares = share;
+    pthread_mutex_unlock(&budget_lock);
+    return share;
+}
+
+void thread_budget_release(ThreadShare **pshare)
+{
+    ThreadShare **p;
+
+    if (!*pshare)
+        return;
+    pthread_mutex_lock(&budget_lock);
+    for (p = &shares; *p; p = &(*p)->next) {
+        if (*p == *pshare) {
+            *p = (*pshare)->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&budget_lock);
+    av_freep(pshare);
+}
+
+/*
+ * Weight of a share, called with the lock held. Measured shares split
+ * the estimated cost of all measured shares in proportion to their busy
+ * time, so they stay comparable with shares that have no time yet.
+ */
+static double share_weight(const ThreadShare *share, int64_t measured_cost, int64_t measured_usec)
+{
+    int64_t busy = atomic_load_explicit(&share->busy_usec, memory_order_relaxed);
+
+    if (!busy || !measured_usec)
+        return share->cost;
+    return (double) measured_cost * busy / measured_usec;
+}
+
+/* called with the lock held */
+static int share_count(const ThreadShare *share)
+{
+    const ThreadShare *s;
+    int64_t measured_cost = 0, measured_usec = 0;
+    double total = 0;
+    int nb_threads;
+
+    for (s = shares; s; s = s->next) {
+        int64_t busy = atomic_load_explicit(&s->busy_usec, memory_order_relaxed);
+        if (busy) {
+            measured_cost += s->cost;
+            measured_usec += busy;
+        }
+    }
+    for (s = shares; s; s = s->next)
+        total += share_weight(s, measured_cost, measured_usec);
+    nb_threads = total > 0 ? budget_cores * share_weight(share, measured_cost, measured_usec) / total : 1;
+    return av_clip(nb_threads, 1, budget_cores);
+}
+
+int thread_share_count(ThreadShare *share)
+{
+    int nb_threads;
+
+    if (!share)
+        return 1;
+    thread_budget_cores();
+
+    pthread_mutex_lock(&budget_lock);
+    nb_threads = share_count(share);
+    pthread_mutex_unlock(&budget_lock);
+    return nb_threads;
+}
+
+void thread_share_add_time(ThreadShare *share, int64_t usec)
+{
+    if (share)
+        atomic_fetch_add_explicit(&share->busy_usec, usec, memory_order_relaxed);
+}
+
+void thread_budget_log(int level)
+{
+    ThreadShare *s;
+
+    av_log(NULL, level, "Thread budget: %d cores\n", thread_budget_cores());
+    pthread_mutex_lock(&budget_lock);
+    for (s = shares; s; s = s->next)
+        av_log(NULL, level, "  %-24s %2d threads, %"PRId64" us busy\n", s->name,
+               share_count(s), (int64_t) atomic_load(&s->busy_usec));
+    pthread_mutex_unlock(&budget_lock);
+}
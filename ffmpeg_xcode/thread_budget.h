@@ -0,0 +1,58 @@
+//
+//  thread_budget.h
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#ifndef thread_budget_h
+#define thread_budget_h
+
+#include <stdio.h>
+#include <stdint.h>
+
+/**
+ * Process-wide split of a fixed number of cores between the decoders,
+ * filter graphs and encoders, instead of letting each of them start
+ * "auto" threads.
+ *
+ * Every user holds a ThreadShare weighted by an estimated cost; once
+ * time spent in the user has been reported, the measured times replace
+ * the estimates. A share is only read when a codec or graph is opened,
+ * as libavcodec cannot resize the thread pool of an open codec, so the
+ * cores released by finished streams go to whatever is opened or
+ * reconfigured afterwards.
+ */
+typedef struct ThreadShare ThreadShare;
+
+/* number of cores to split, <= 0 for one per CPU */
+void thread_budget_set_cores(int nb_cores);
+int thread_budget_cores(void);
+
+/* relative weights of the stages of one video stream */
+#define THREAD_BUDGET_DECODER_WEIGHT 2
+#define THREAD_BUDGET_FILTER_WEIGHT  1
+#define THREAD_BUDGET_ENCODER_WEIGHT 4
+
+/* audio stages rarely gain from more than one thread */
+#define THREAD_BUDGET_AUDIO_COST (64 * 64)
+
+/* cost estimate of a video stage, in pixels per frame scaled by weight */
+int64_t thread_budget_video_cost(int width, int height, int weight);
+
+ThreadShare *thread_budget_acquire(const char *name, int64_t cost);
+
+/* give the share's cores back to the other users */
+void thread_budget_release(ThreadShare **share);
+
+/* threads the holder should use if it opened now, at least 1 */
+int thread_share_count(ThreadShare *share);
+
+/* report time spent working for the holder of share */
+void thread_share_add_time(ThreadShare *share, int64_t usec);
+
+/* log the current split */
+void thread_budget_log(int level);
+
+#endif /* thread_budget_h */
@@ -0,0 +1,160 @@
+//
+//  trace.c
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+
+#include "trace.h"
+#include "libavutil/avutil.h"
+#include "libavutil/mem.h"
+
+#define TRACE_MAX_THREADS 256
+
+typedef struct TraceEvent {
+    const char *name;
+    int64_t start;
+    int64_t duration;
+    int64_t pts;
+    int stream;
+    int tid;
+} TraceEvent;
+
+int trace_enabled = 0;
+
+static char *trace_path;
+static int64_t trace_start;
+static TraceEvent *events;
+static unsigned max_events;
+static atomic_uint nb_events;
+static atomic_int nb_threads;
+static char thread_names[TRACE_MAX_THREADS][32];
+static _Thread_local int thread_id;     /* 0 until the thread records something */
+
+int trace_open(const char *path, unsigned nb_max)
+{
+    if (!(events = av_malloc_array(nb_max, sizeof(*events))) ||
+        !(trace_path = av_strdup(path))) {
+        av_freep(&events);
+        return AVERROR(ENOMEM);
+    }
+    max_events    = nb_max;
+    trace_start   = av_gettime_relative();
+    atomic_init(&nb_events, 0);
+    atomic_init(&nb_threads, 0);
+    trace_enabled = 1;
+    return 0;
+}
+
+static int get_thread_id(void)
+{
+    if (!thread_id)
+        thread_id = atomic_fetch_add(&nb_threads, 1) + 1;
+    return thread_id;
+}
+
+void trace_thread_name(const char *fmt, ...)
+{
+    va_list vl;
+    int tid;
+
+    if (!trace_enabled)
+        return;
+    tid = get_thread_id();
+    if (tid >= TRACE_MAX_THREADS)
+        return;
+    va_start(vl, fmt);
+    vsnprintf(thread_names[tid], sizeof(thread_names[tid]), fmt, vl);
+    va_end(vl);
+}
+
+void trace_end(const char *name, int stream, int64_t start, int64_t pts)
+{
+    int64_t end = av_gettime_relative();
+    unsigned i;
+    TraceEvent *e;
+
+    if (!start || !trace_enabled)
+        return;
+    i = atomic_fetch_add_explicit(&nb_events, 1, memory_order_relaxed);
+    if (i >= max_events)
+        return;
+    e = &events[i];
+    e->name     = name;
+    e->start    = start - trace_start;
+    e->duration = end - start;
+    e->pts      = pts;
+    e->stream   = stream;
+    e->tid      = get_thread_id();
+}
+
+/* thread names carry file names, which may hold quotes and backslashes */
+static void write_json_string(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+        unsigned char c = *s;
+
+        if (c == '"' || c == '\\')
+            fprintf(f, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(f, "\\u%04x", c);
+        else
+            fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+int trace_close(void)
+{
+    unsigned nb = atomic_load(&nb_events);
+    int threads = FFMIN(atomic_load(&nb_threads), TRACE_MAX_THREADS - 1);
+    FILE *f;
+    int ret = 0;
+
+    if (!trace_enabled)
+        return 0;
+    trace_enabled = 0;
+    if (nb > max_events) {
+        av_log(NULL, AV_LOG_WARNING, "Trace buffer full, %u events dropped.\n", nb - max_events);
+        nb = max_events;
+    }
+    if (!(f = fopen(trace_path, "w"))) {
+        ret = AVERROR(errno);
+        av_log(NULL, AV_LOG_ERROR, "Could not open %s: %s\n", trace_path, av_err2str(ret));
+        goto end;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"ffmpeg\"}}");
+    for (int tid = 1; tid <= threads; tid++) {
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", tid);
+        write_json_string(f, thread_names[tid][0] ? thread_names[tid] : "unnamed");
+        fprintf(f, "}}");
+    }
+    for (unsigned i = 0; i < nb; i++) {
+        TraceEvent *e = &events[i];
+
+        fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%"PRId64",\"dur\":%"PRId64
+                ",\"args\":{\"stream\":%d", e->name, e->tid, e->start, e->duration, e->stream);
+        if (e->pts != AV_NOPTS_VALUE)
+            fprintf(f, ",\"pts\":%"PRId64, e->pts);
+        fprintf(f, "}}");
+    }
+    fprintf(f, "\n]}\n");
+    if (fclose(f)) {
+        ret = AVERROR(errno);
+        av_log(NULL, AV_LOG_ERROR, "Could not write %s: %s\n", trace_path, av_err2str(ret));
+    } else {
+        av_log(NULL, AV_LOG_INFO, "Wrote %u trace events to %s.\n", nb, trace_path);
+    }
+end:
+    av_freep(&events);
+    av_freep(&trace_path);
+    return ret;
+}
@@ -0,0 +1,54 @@
+//
+//  trace.h
+//  ffmpeg_xcode
+//
+//  Created by wlanjie on 16/5/3.
+//  Copyright © 2016年 com.wlanjie.ffmpeg. All rights reserved.
+//
+
+#ifndef trace_h
+#define trace_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include "libavutil/time.h"
+
+#define TRACE_DEFAULT_EVENTS (1 << 20)  /* about 40 MB of events */
+
+/**
+ * Opt-in frame lifecycle tracing in the Chrome trace event format, to be
+ * opened in chrome://tracing or ui.perfetto.dev.
+ *
+ * Events go to a buffer preallocated by trace_open(): a slot is claimed
+ * with one atomic increment, so recording takes no lock and never
+ * allocates. Events past the capacity are counted and dropped. The file
+ * is only written by trace_close(), once every thread has stopped.
+ */
+extern int trace_enabled;
+
+/* Start recording; the trace is written to path by trace_close(). */
+int trace_open(const char *path, unsigned max_events);
+
+/* Write the trace file and free the buffer. Does nothing if not open. */
+int trace_close(void);
+
+/* Name the calling thread in the trace viewer; call once per thread. */
+void trace_thread_name(const char *fmt, ...);
+
+/* Start time of an event, 0 when tracing is disabled. */
+static inline int64_t trace_begin(void)
+{
+    return trace_enabled ? av_gettime_relative() : 0;
+}
+
+/**
+ * Record an event that lasted from start until now on the calling thread.
+ * Does nothing when start is 0.
+ *
+ * @param name   static string, not copied
+ * @param stream stream index the packet or frame belongs to
+ * @param pts    in the time base of that stream, AV_NOPTS_VALUE if none
+ */
+void trace_end(const char *name, int stream, int64_t start, int64_t pts);
+
+#endif /* trace_h */
@@ -7,6 +7,12 @@
 //
 
 #include "transcode.h"
+#include "alloc_stats.h"
+#include "thread_budget.h"
+#include "output_scheduler.h"
+#include "stage_stats.h"
+#include "progress.h"
+#include "metrics.h"
 
 static int init_input_stream(int ist_index) {
     int ret;
@@ -22,7 +28,14 @@ static int init_input_stream(int ist_index) {
         ist->dec_ctx->thread_safe_callbacks = 1;
         av_opt_set_int(ist->dec_ctx, "refcounted_frames", 1, 0);
         if (!av_dict_get(ist->decoder_opts, "threads", NULL, 0)) {
-            av_dict_set(&ist->decoder_opts, "threads", "auto", 0);
+            char name[32];
+            snprintf(name, sizeof(name), "decoder #%d:%d", ist->file_index, ist->st->index);
+            if (!ist->thread_share) {
+                ist->thread_share = thread_budget_acquire(name, ist->dec_ctx->codec_type == AVMEDIA_TYPE_VIDEO ?
+                                                          thread_budget_video_cost(ist->dec_ctx->width, ist->dec_ctx->height, THREAD_BUDGET_DECODER_WEIGHT) :
+                                                          THREAD_BUDGET_AUDIO_COST);
+            }
+            av_dict_set_int(&ist->decoder_opts, "threads", thread_share_count(ist->thread_share), 0);
         }
         if ((ret = avcodec_open2(ist->dec_ctx, codec, &ist->decoder_opts)) < 0) {
             av_err2str(ret);
@@ -50,7 +63,14 @@ static int init_output_stream(int ost_index) {
             return AVERROR(ENOMEM);
         }
         if (!av_dict_get(ost->encoder_opts, "threads", NULL, 0)) {
-            av_dict_set(&ost->encoder_opts, "threads", "auto", 0);
+            char name[32];
+            snprintf(name, sizeof(name), "encoder #%d:%d", ost->file_index, ost->index);
+            if (!ost->thread_share) {
+                ost->thread_share = thread_budget_acquire(name, ost->enc_ctx->codec_type == AVMEDIA_TYPE_VIDEO ?
+                                                          thread_budget_video_cost(ist->dec_ctx->width, ist->dec_ctx->height, THREAD_BUDGET_ENCODER_WEIGHT) :
+                                                          THREAD_BUDGET_AUDIO_COST);
+            }
+            av_dict_set_int(&ost->encoder_opts, "threads", thread_share_count(ost->thread_share), 0);
         }
         if ((ret = avcodec_open2(ost->enc_ctx, codec, &ost->encoder_opts)) < 0) {
             av_err2str(ret);
@@ -168,29 +188,21 @@ int transcode_init(void) {
             av_err2str(ret);
             return ret;
         }
+        size_t mux_queue_size = output_files[i]->mux_queue_size;
+        if ((ret = mux_queue_alloc(&output_files[i]->mux_queue, oc,
+                                   mux_queue_size ? mux_queue_size : MUX_QUEUE_DEFAULT_SIZE)) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Could not start the muxer thread.\n");
+            return ret;
+        }
     }
     return ret;
 }
 
-static OutputStream *choose_output(void) {
-    int i;
-    int64_t opts_min = INT64_MAX;
-    OutputStream *ost_min = NULL;
-
-    for (i = 0; i < nb_output_streams; i++) {
-        OutputStream *ost = output_streams[i];
-        int64_t opts = ost->st->cur_dts == AV_NOPTS_VALUE ? INT64_MIN :
-        av_rescale_q(ost->st->cur_dts, ost->st->time_base,
-                     AV_TIME_BASE_Q);
-        if (ost->st->cur_dts == AV_NOPTS_VALUE)
-            av_log(NULL, AV_LOG_DEBUG, "cur_dts is invalid (this is harmless if it occurs once at the start per stream)\n");
+/* output streams by the DTS last handed to the muxer */
+static OutputScheduler *output_sched;
 
-        if (!ost->finished && opts < opts_min) {
-            opts_min = opts;
-            ost_min  = ost;
-        }
-    }
-    return ost_min;
+static OutputStream *choose_output(void) {
+    return output_scheduler_next(output_sched);
 }
 
 static int write_frame(AVFormatContext *s, AVPacket *pkt, OutputStream *ost) {
@@ -198,18 +210,30 @@ static int write_frame(AVFormatContext *s, AVPacket *pkt, OutputStream *ost) {
     AVCodecContext *avctx = ost->encoding_needed ? ost->enc_ctx : ost->st->codec;
     if (!(avctx->codec_type == AVMEDIA_TYPE_VIDEO && avctx->codec)) {
         if (ost->frame_number >= ost->max_frames) {
+            ost->frames_dropped++;
             av_packet_unref(pkt);
         }
         ost->frame_number++;
     }
     ost->data_size += pkt->size;
     ost->last_mux_dts = pkt->dts;
+    if (output_sched) {
+        output_scheduler_update(output_sched, ost);
+    }
     pkt->stream_index = ost->index;
     if ((ret = av_apply_bitstream_filters(avctx, pkt, ost->bitstream_filters)) < 0) {
         av_err2str(ret);
         return ret;
     }
+    int64_t t0 = av_gettime_relative();
+    if (output_files[ost->file_index]->mux_queue) {
+        ret = mux_queue_send(output_files[ost->file_index]->mux_queue, pkt);
+        /* the muxer thread times the write itself */
+        stage_stats_add(ost->stats, STAGE_MUX_WAIT, av_gettime_relative() - t0);
+        return ret;
+    }
     ret = av_interleaved_write_frame(s, pkt);
+    stage_stats_add(ost->stats, STAGE_MUX, av_gettime_relative() - t0);
     if (ret < 0) {
         av_err2str(ret);
         return ret;
@@ -241,7 +265,9 @@ static int do_video_out(AVFormatContext *s, OutputStream *ost, AVFrame *next_pic
     in_picture->pict_type = 0;
     ost->frame_encoded++;
 
+    int64_t t0 = av_gettime_relative();
     ret = avcodec_encode_video2(enc, &pkt, in_picture, &got_packet);
+    stage_stats_add(ost->stats, STAGE_ENCODE, av_gettime_relative() - t0);
     if (ret < 0) {
         av_err2str(ret);
         return ret;
@@ -292,14 +318,18 @@ static int reap_filters(int flush) {
             continue;
         }
         filter = ost->filter->filter;
-        if (!ost->filtered_frame && !(ost->filtered_frame = av_frame_alloc())) {
+        if (!ost->filtered_frame && !(ost->filtered_frame = alloc_stats_frame_alloc())) {
             av_log(NULL, AV_LOG_ERROR, "Could not alloc filtered frame.\n");
             return AVERROR(ENOMEM);
         }
         filtered_frame = ost->filtered_frame;
         while (1) {
             double float_pts = AV_NOPTS_VALUE;
+            int64_t t0 = av_gettime_relative();
             ret = av_buffersink_get_frame_flags(filter, filtered_frame, AV_BUFFERSINK_FLAG_NO_REQUEST);
+            if (ret >= 0) {
+                stage_stats_add(ost->stats, STAGE_FILTER_PULL, av_gettime_relative() - t0);
+            }
             if (ret < 0) {
                 av_err2str(ret);
                 char error[255] = {0};
@@ -379,22 +409,27 @@ static int decode_audio(InputStream *ist, AVPacket *pkt, int *got_output) {
     int ret, err = 0;
     AVFrame *decoded_frame;
     AVCodecContext *avctx = ist->dec_ctx;
-    if (!ist->decoded_frame && !(ist->decoded_frame = av_frame_alloc())) {
+    if (!ist->decoded_frame && !(ist->decoded_frame = alloc_stats_frame_alloc())) {
         av_log(NULL, AV_LOG_ERROR, "Could not audio alloc frame.\n");
         return AVERROR(ENOMEM);
     }
-    if (!ist->filter_frame && !(ist->filter_frame = av_frame_alloc())) {
+    if (!ist->filter_frame && !(ist->filter_frame = alloc_stats_frame_alloc())) {
         av_log(NULL, AV_LOG_ERROR, "Could not audio alloc filter frame.\n");
         return AVERROR(ENOMEM);
     }
     decoded_frame = ist->decoded_frame;
+    int64_t t0 = av_gettime_relative();
     ret = avcodec_decode_audio4(avctx, decoded_frame, got_output, pkt);
+    stage_stats_add(ist->stats, STAGE_DECODE, av_gettime_relative() - t0);
     if (!*got_output || ret < 0) {
         av_err2str(ret);
         return ret;
     }
+    ist->frames_decoded++;
     for (int i = 0; i < ist->nb_filters; i++) {
+        t0 = av_gettime_relative();
         err = av_buffersrc_add_frame_flags(ist->filters[i]->filter, decoded_frame, AV_BUFFERSRC_FLAG_PUSH);
+        stage_stats_add(ist->stats, STAGE_FILTER_PUSH, av_gettime_relative() - t0);
         if (err == AVERROR_EOF) {
             err = 0;
         }
@@ -412,23 +447,27 @@ static int decode_audio(InputStream *ist, AVPacket *pkt, int *got_output) {
 static int decode_video(InputStream *ist, AVPacket *pkt , int *got_output) {
     int ret, err = 0;
     AVFrame *decoded_frame, *f;
-    if (!ist->decoded_frame && !(ist->decoded_frame = av_frame_alloc())) {
+    if (!ist->decoded_frame && !(ist->decoded_frame = alloc_stats_frame_alloc())) {
         av_log(NULL, AV_LOG_ERROR, "Could not video alloc frame.\n");
         return AVERROR(ENOMEM);
     }
-    if (!ist->filter_frame && !(ist->filter_frame = av_frame_alloc())) {
+    if (!ist->filter_frame && !(ist->filter_frame = alloc_stats_frame_alloc())) {
         av_log(NULL, AV_LOG_ERROR, "Could not video filter frame.\n");
         return AVERROR(ENOMEM);
     }
     decoded_frame = ist->decoded_frame;
     pkt->dts = av_rescale_q(ist->dts, AV_TIME_BASE_Q, ist->st->time_base);
-    if ((ret = avcodec_decode_video2(ist->dec_ctx, decoded_frame, got_output, pkt) < 0)) {
+    int64_t t0 = av_gettime_relative();
+    ret = avcodec_decode_video2(ist->dec_ctx, decoded_frame, got_output, pkt);
+    stage_stats_add(ist->stats, STAGE_DECODE, av_gettime_relative() - t0);
+    if (ret < 0) {
         av_err2str(ret);
         return ret;
     }
     if (!*got_output || ret < 0) {
         return ret;
     }
+    ist->frames_decoded++;
     int64_t best_effort_timestamp = av_frame_get_best_effort_timestamp(decoded_frame);
     if (best_effort_timestamp != AV_NOPTS_VALUE) {
         int64_t ts = av_rescale_q(decoded_frame->pts = best_effort_timestamp, ist->st->time_base, AV_TIME_BASE_Q);
@@ -452,7 +491,9 @@ static int decode_video(InputStream *ist, AVPacket *pkt , int *got_output) {
         } else {
             f = decoded_frame;
         }
+        t0 = av_gettime_relative();
         ret = av_buffersrc_add_frame_flags(ist->filters[i]->filter, f, AV_BUFFERSRC_FLAG_PUSH);
+        stage_stats_add(ist->stats, STAGE_FILTER_PUSH, av_gettime_relative() - t0);
         if (ret == AVERROR_EOF) {
             ret = 0;
         } else if (ret < 0) {
@@ -538,6 +579,7 @@ static int process_input(int file_index) {
     int ret;
     InputFile *ifile = input_files[file_index];
     AVPacket pkt;
+    int64_t t0 = av_gettime_relative();
     ret = av_read_frame(ifile->ctx, &pkt);
     if (ret < 0) {
 //        for (int i = 0; i < nb_output_streams; i++) {
@@ -553,9 +595,12 @@ static int process_input(int file_index) {
         }
         return AVERROR(EAGAIN);
     }
-    av_pkt_dump_log2(NULL, AV_LOG_ERROR, &pkt, 0, ifile->ctx->streams[pkt.stream_index]);
+    if (do_pkt_dump) {
+        av_pkt_dump_log2(NULL, AV_LOG_INFO, &pkt, 0, ifile->ctx->streams[pkt.stream_index]);
+    }
     InputStream *ist = input_streams[ifile->ist_index + pkt.stream_index];
-    ist->data_size = pkt.size;
+    stage_stats_add(ist->stats, STAGE_DEMUX, av_gettime_relative() - t0);
+    ist->data_size += pkt.size;
     ist->nb_packets++;
     if (ist->discard) {
         av_packet_unref(&pkt);
@@ -568,6 +613,9 @@ static int transcode_step(void) {
     int ret;
     OutputStream *ost = choose_output();
     InputStream *ist;
+    if (!ost) {
+        return AVERROR_EOF;
+    }
     if (ost->filter) {
         if ((ret = transcode_from_filter(ost->filter->graph, &ist)) < 0) {
             av_log(NULL, AV_LOG_ERROR, "Could not transcode from filter.\n");
@@ -586,6 +634,25 @@ static int transcode_step(void) {
     return reap_filters(0);
 }
 
+static Progress progress;
+static Metrics metrics;
+
+static void print_report(int is_last) {
+    uint64_t frames = 0, bytes = 0;
+    int64_t media_time = AV_NOPTS_VALUE;
+    for (int i = 0; i < nb_output_streams; i++) {
+        OutputStream *ost = output_streams[i];
+        if (ost->st->codec->codec_type == AVMEDIA_TYPE_VIDEO) {
+            frames += ost->frame_number;
+        }
+        bytes += ost->data_size;
+        if (ost->last_mux_dts != AV_NOPTS_VALUE) {
+            media_time = FFMAX(media_time, av_rescale_q(ost->last_mux_dts, ost->st->time_base, AV_TIME_BASE_Q));
+        }
+    }
+    progress_print(&progress, frames, bytes, media_time, is_last);
+}
+
 static int need_output(void) {
     for (int i = 0; i < nb_output_streams; i++) {
         OutputStream *ost = output_streams[i];
@@ -603,7 +670,23 @@ int transcode(void) {
     if (ret < 0) {
 
     }
-    static int volatile decoded_num = 0;
+    if ((ret = output_scheduler_alloc(&output_sched, output_streams, nb_output_streams)) < 0) {
+        return ret;
+    }
+    for (int i = 0; i < nb_input_streams; i++) {
+        if (!(input_streams[i]->stats = stage_stats_alloc())) {
+            return AVERROR(ENOMEM);
+        }
+    }
+    for (int i = 0; i < nb_output_streams; i++) {
+        if (!(output_streams[i]->stats = stage_stats_alloc())) {
+            return AVERROR(ENOMEM);
+        }
+        mux_queue_set_stats(output_files[output_streams[i]->file_index]->mux_queue,
+                            output_streams[i]->index, output_streams[i]->stats, NULL);
+    }
+    progress_init(&progress, nb_input_files ? input_files[0]->ctx->duration : AV_NOPTS_VALUE, stats_period);
+    metrics_init(&metrics, metrics_path, metrics_period);
     while (1) {
 
         ret = need_output();
@@ -611,11 +694,14 @@ int transcode(void) {
             break;
         }
         ret = transcode_step();
-
-        av_log(NULL, AV_LOG_ERROR, "decoded_num = %d ret = %d\n", decoded_num, ret);
-        decoded_num++;
+        if (progress_due(&progress)) {
+            print_report(0);
+        }
+        if (metrics_due(&metrics)) {
+            metrics_write(&metrics, 0);
+        }
     }
-    av_log(NULL, AV_LOG_ERROR, "transcode done.\n");
+    output_scheduler_free(&output_sched);
     for (int i = 0; i < nb_input_streams; i++) {
         InputStream *ist = input_streams[i];
         if (ist->decoding_needed) {
@@ -624,11 +710,23 @@ int transcode(void) {
     }
 //    flush_encoders();
 //    flush_encoders();
+    /* keep the first muxing error, an output missing packets or its
+     * trailer is broken even if the other outputs were fine */
+    int err = 0;
     for (int i = 0; i < nb_output_files; i++) {
         AVFormatContext *os = output_files[i]->ctx;
+        if ((ret = mux_queue_finish(output_files[i]->mux_queue)) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Error muxing %s: %s\n", os->filename, av_err2str(ret));
+            if (!err) {
+                err = ret;
+            }
+        }
+        mux_queue_free(&output_files[i]->mux_queue);
         if ((ret = av_write_trailer(os)) < 0) {
-            av_err2str(ret);
-            return ret;
+            av_log(NULL, AV_LOG_ERROR, "Error writing trailer of %s: %s\n", os->filename, av_err2str(ret));
+            if (!err) {
+                err = ret;
+            }
         }
     }
     for (int i = 0; i < nb_output_streams; i++) {
@@ -644,8 +742,22 @@ int transcode(void) {
         }
     }
 
+    print_report(1);
+    metrics_write(&metrics, 1);
+    thread_budget_log(AV_LOG_VERBOSE);
+    for (int i = 0; i < nb_input_streams; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "input #%d:%d", input_streams[i]->file_index, input_streams[i]->st->index);
+        stage_stats_log(input_streams[i]->stats, name, AV_LOG_INFO);
+    }
+    for (int i = 0; i < nb_output_streams; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "output #%d:%d", output_streams[i]->file_index, output_streams[i]->index);
+        stage_stats_log(output_streams[i]->stats, name, AV_LOG_INFO);
+    }
     for (int i = 0; i < nb_filtergraphs; i++) {
         FilterGraph *fg = filtergraphs[i];
+        thread_budget_release(&fg->thread_share);
         avfilter_graph_free(&fg->graph);
         for (int j = 0; j < fg->nb_inputs; j++) {
             av_freep(&fg->inputs[j]->name);
@@ -671,12 +783,24 @@ int transcode(void) {
             bsfc = next;
         }
         ost->bitstream_filters = NULL;
+        thread_budget_release(&ost->thread_share);
+        stage_stats_free(&ost->stats);
         av_frame_free(&ost->filtered_frame);
 //        av_freep(&ost->avfilter);
         avcodec_free_context(&ost->enc_ctx);
         av_dict_free(&ost->encoder_opts);
         av_freep(&output_streams[i]);
     }
+    uint64_t nb_decoded = 0;
+    for (int i = 0; i < nb_input_streams; i++) {
+        InputStream *ist = input_streams[i];
+        thread_budget_release(&ist->thread_share);
+        stage_stats_free(&ist->stats);
+        nb_decoded += ist->frames_decoded;
+        av_frame_free(&ist->decoded_frame);
+        av_frame_free(&ist->filter_frame);
+    }
+    alloc_stats_log(AV_LOG_DEBUG, nb_decoded);
     for (int i = 0; i < nb_input_files; i++) {
         avformat_close_input(&input_files[i]->ctx);
         av_freep(&input_files[i]);
@@ -685,5 +809,5 @@ int transcode(void) {
     av_freep(&input_files);
     av_freep(&output_streams);
     av_freep(&output_files);
-    return ret;
+    return err;
 }
@@ -7,6 +7,7 @@
 //
 
 #include "video_filter.h"
+#include "scaler_profile.h"
 
 int configure_input_video_filter(FilterGraph *fg, AVFilterInOut *in) {
     int ret = 0;
@@ -103,9 +104,14 @@ int configure_output_video_filter(FilterGraph *fg, AVFilterInOut *out) {
     char scale_name[255];
     snprintf(scale_name, sizeof(scale_name), "video scale output stream %d", fg->output->ost->st->index);
 
+    AVCodecContext *dec_ctx = fg->input->ist->dec_ctx;
+    AVCodecContext *enc_ctx = fg->output->ost->enc_ctx;
+    char flags[64];
     AVBPrint scale_args;
     av_bprint_init(&scale_args, 0, AV_BPRINT_SIZE_AUTOMATIC);
-    av_bprintf(&scale_args, "%d:%d", fg->output->ost->enc_ctx->width, fg->output->ost->enc_ctx->height);
+    av_bprintf(&scale_args, "%d:%d:flags=%s", enc_ctx->width, enc_ctx->height,
+               scaler_profile_flags(scaler_profile, dec_ctx->width, dec_ctx->height,
+                                    enc_ctx->width, enc_ctx->height, flags, sizeof(flags)));
     ret = avfilter_graph_create_filter(&scale_context, scale, scale_name, scale_args.str, NULL, fg->graph);
     if (ret < 0) {
         return ret;
@@ -21,6 +21,8 @@
 #include <stdint.h>
 
 #include "ffmpeg.h"
+#include "ffmpeg_opt.h"
+#include "scaler_profile.h"
 
 #include "libavfilter/avfilter.h"
 #include "libavfilter/buffersink.h"
@@ -228,6 +230,122 @@ FilterGraph *init_simple_filtergraph(InputStream *ist, OutputStream *ost)
     return fg;
 }
 
+static int compare_area(const void *a, const void *b)
+{
+    const AVCodecContext *ca = (*(OutputStream * const *)a)->enc_ctx;
+    const AVCodecContext *cb = (*(OutputStream * const *)b)->enc_ctx;
+
+    return cb->width * cb->height - ca->width * ca->height;
+}
+
+/*
+ * scale=<first>,split=2[out<i>][c0];[c0]scale=<second>,split=2[out<j>][c1];...
+ * from the largest rendition down, each split feeds its rendition and the
+ * next smaller scaler.
+ */
+static char *cascade_graph_desc(InputStream *ist, OutputStream **osts, int nb_osts)
+{
+    OutputStream *order[LADDER_MAX_RENDITIONS];
+    int w = ist->resample_width, h = ist->resample_height;
+    char flags[64], *desc = NULL;
+    AVBPrint bp;
+
+    if (nb_osts > FF_ARRAY_ELEMS(order))
+        return NULL;
+    memcpy(order, osts, nb_osts * sizeof(*osts));
+    qsort(order, nb_osts, sizeof(*order), compare_area);
+
+    av_bprint_init(&bp, 0, AV_BPRINT_SIZE_UNLIMITED);
+    for (int i = 0; i < nb_osts; i++) {
+        AVCodecContext *enc = order[i]->enc_ctx;
+
+        if (i)
+            av_bprintf(&bp, "[c%d]", i - 1);
+        av_bprintf(&bp, "scale=%d:%d:flags=%s", enc->width, enc->height,
+                   scaler_profile_flags(order[i]->scaler_profile, w, h, enc->width, enc->height,
+                                        flags, sizeof(flags)));
+        /* the outputs are matched by label, the parser does not keep their order */
+        if (i < nb_osts - 1)
+            av_bprintf(&bp, ",split=2[out%d][c%d];", order[i]->filter_index, i);
+        else
+            av_bprintf(&bp, "[out%d]", order[i]->filter_index);
+        w = enc->width;
+        h = enc->height;
+    }
+    if (av_bprint_is_complete(&bp))
+        av_bprint_finalize(&bp, &desc);
+    else
+        av_bprint_finalize(&bp, NULL);
+    return desc;
+}
+
+FilterGraph *init_ladder_filtergraph(InputStream *ist, OutputStream **osts, int nb_osts,
+                                     int cascade)
+{
+    FilterGraph *fg = av_mallocz(sizeof(*fg));
+    char *graph_desc;
+
+    if (!fg)
+        return NULL;
+    for (int i = 0; i < nb_osts; i++)
+        osts[i]->filter_index = i;
+    /* split: configure_output_video_filter() adds the scaler of each rendition */
+    graph_desc = cascade ? cascade_graph_desc(ist, osts, nb_osts) : av_asprintf("split=%d", nb_osts);
+    if (!graph_desc) {
+        av_free(fg);
+        return NULL;
+    }
+    if (cascade) {
+        /* the graph already scales, no scaler in front of the buffersinks */
+        for (int i = 0; i < nb_osts; i++)
+            osts[i]->enc_ctx->width = osts[i]->enc_ctx->height = 0;
+    }
+    av_log(NULL, AV_LOG_VERBOSE, "Ladder graph: %s\n", graph_desc);
+    fg->graph_desc = graph_desc;
+    fg->index = nb_filtergraphs;
+
+    for (int i = 0; i < nb_osts; i++) {
+        GROW_ARRAY(fg->outputs, fg->nb_outputs);
+        if (!fg->outputs || !(fg->outputs[i] = av_mallocz(sizeof(*fg->outputs[i]))))
+            goto fail;
+        fg->outputs[i]->ost   = osts[i];
+        fg->outputs[i]->graph = fg;
+        fg->outputs[i]->type  = AVMEDIA_TYPE_VIDEO;
+        osts[i]->filter = fg->outputs[i];
+    }
+
+    GROW_ARRAY(fg->inputs, fg->nb_inputs);
+    if (!fg->inputs || !(fg->inputs[0] = av_mallocz(sizeof(*fg->inputs[0]))))
+        goto fail;
+    fg->inputs[0]->ist   = ist;
+    fg->inputs[0]->graph = fg;
+
+    GROW_ARRAY(ist->filters, ist->nb_filters);
+    if (!ist->filters)
+        goto fail;
+    ist->decoding_needed |= DECODING_FOR_FILTER;
+    ist->filters[ist->nb_filters - 1] = fg->inputs[0];
+
+    GROW_ARRAY(filtergraphs, nb_filtergraphs);
+    filtergraphs[nb_filtergraphs - 1] = fg;
+
+    return fg;
+
+fail:
+    /* leave the renditions without a graph rather than pointing into freed memory */
+    for (int i = 0; i < nb_osts; i++)
+        osts[i]->filter = NULL;
+    for (int i = 0; fg->outputs && i < fg->nb_outputs; i++)
+        av_freep(&fg->outputs[i]);
+    av_freep(&fg->outputs);
+    if (fg->inputs)
+        av_freep(&fg->inputs[0]);
+    av_freep(&fg->inputs);
+    av_freep(&fg->graph_desc);
+    av_free(fg);
+    return NULL;
+}
+
 static void init_input_filter(FilterGraph *fg, AVFilterInOut *in)
 {
     InputStream *ist = NULL;
@@ -433,13 +551,18 @@ static int configure_output_video_filter(FilterGraph *fg, OutputFilter *ofilter,
         return ret;
 
     if (codec->width || codec->height) {
-        char args[255];
+        char args[255], flags[64];
         AVFilterContext *filter;
         AVDictionaryEntry *e = NULL;
+        InputStream *ist = ost->source_index >= 0 ? input_streams[ost->source_index] : NULL;
 
-        snprintf(args, sizeof(args), "%d:%d",
+        snprintf(args, sizeof(args), "%d:%d:flags=%s",
                  codec->width,
-                 codec->height);
+                 codec->height,
+                 scaler_profile_flags(ost->scaler_profile,
+                                      ist ? ist->resample_width : codec->width,
+                                      ist ? ist->resample_height : codec->height,
+                                      codec->width, codec->height, flags, sizeof(flags)));
 
         snprintf(name, sizeof(name), "scaler for output stream %d:%d",
                  ost->file_index, ost->index);
@@ -649,16 +772,17 @@ static int configure_input_audio_filter(FilterGraph *fg, InputFilter *ifilter,
         return AVERROR(EINVAL);
     }
 
+    /* the resample_* fields are what ifilter_push_frame() compares frames with */
     av_bprint_init(&args, 0, AV_BPRINT_SIZE_AUTOMATIC);
     av_bprintf(&args, "time_base=%d/%d:sample_rate=%d:sample_fmt=%s",
-               1, ist->dec_ctx->sample_rate,
-               ist->dec_ctx->sample_rate,
-               av_get_sample_fmt_name(ist->dec_ctx->sample_fmt));
-    if (ist->dec_ctx->channel_layout)
+               1, ist->resample_sample_rate,
+               ist->resample_sample_rate,
+               av_get_sample_fmt_name(ist->resample_sample_fmt));
+    if (ist->resample_channel_layout)
         av_bprintf(&args, ":channel_layout=0x%"PRIx64,
-                   ist->dec_ctx->channel_layout);
+                   ist->resample_channel_layout);
     else
-        av_bprintf(&args, ":channels=%d", ist->dec_ctx->channels);
+        av_bprintf(&args, ":channels=%d", ist->resample_channels);
     snprintf(name, sizeof(name), "graph %d input from stream %d:%d", fg->index,
              ist->file_index, ist->st->index);
 
@@ -707,7 +831,7 @@ static int configure_input_video_filter(FilterGraph *fg, InputFilter *ifilter,
     AVRational fr = av_guess_frame_rate(input_files[ist->file_index]->ctx, ist->st, NULL);
     AVRational sar;
     AVBPrint args;
-    char name[255];
+    char name[255], flags[64];
     int ret, pad_idx = 0;
     int64_t tsoffset = 0;
 
@@ -724,13 +848,16 @@ static int configure_input_video_filter(FilterGraph *fg, InputFilter *ifilter,
     ist->dec_ctx->sample_aspect_ratio;
     if(!sar.den)
         sar = (AVRational){0,1};
+    /* sws_param goes to the scalers lavfi inserts for format conversions */
+    scaler_profile_flags(fg->nb_outputs == 1 ? fg->outputs[0]->ost->scaler_profile : NULL,
+                         ist->resample_width, ist->resample_height, 0, 0, flags, sizeof(flags));
     av_bprint_init(&args, 0, 1);
     av_bprintf(&args,
                "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:"
-               "pixel_aspect=%d/%d:sws_param=flags=%d", ist->resample_width,
+               "pixel_aspect=%d/%d:sws_param=flags=%s%s", ist->resample_width,
                ist->resample_height, ist->resample_pix_fmt,
-               tb.num, tb.den, sar.num, sar.den,
-               SWS_BILINEAR + ((ist->dec_ctx->flags&AV_CODEC_FLAG_BITEXACT) ? SWS_BITEXACT:0));
+               tb.num, tb.den, sar.num, sar.den, flags,
+               (ist->dec_ctx->flags & AV_CODEC_FLAG_BITEXACT) ? "+bitexact" : "");
     if (fr.num && fr.den)
         av_bprintf(&args, ":frame_rate=%d/%d", fr.num, fr.den);
     snprintf(name, sizeof(name), "graph %d input from stream %d:%d", fg->index,
@@ -769,6 +896,39 @@ static int configure_input_filter(FilterGraph *fg, InputFilter *ifilter,
     }
 }
 
+/*
+ * Does the configured graph fg hand its only input to its only output
+ * unchanged? It may hold nothing but the buffer source and sink, null and
+ * format filters, and the negotiated output must be the input format.
+ */
+static int graph_is_passthrough(FilterGraph *fg)
+{
+    static const char * const passthrough[] = {
+        "buffer", "abuffer", "buffersink", "abuffersink", "null", "anull", "format", "aformat",
+    };
+    AVFilterLink *in, *out;
+    int i, j;
+
+    if (fg->nb_inputs != 1 || fg->nb_outputs != 1)
+        return 0;
+    for (i = 0; i < fg->graph->nb_filters; i++) {
+        for (j = 0; j < FF_ARRAY_ELEMS(passthrough); j++)
+            if (!strcmp(fg->graph->filters[i]->filter->name, passthrough[j]))
+                break;
+        if (j == FF_ARRAY_ELEMS(passthrough))
+            return 0;
+    }
+
+    in  = fg->inputs[0]->filter->outputs[0];
+    out = fg->outputs[0]->filter->inputs[0];
+    if (in->type == AVMEDIA_TYPE_VIDEO)
+        return in->format == out->format && in->w == out->w && in->h == out->h &&
+               !av_cmp_q(in->sample_aspect_ratio, out->sample_aspect_ratio);
+    return in->format == out->format && in->sample_rate == out->sample_rate &&
+           in->channel_layout == out->channel_layout &&
+           avfilter_link_get_channels(in) == avfilter_link_get_channels(out);
+}
+
 int configure_filtergraph(FilterGraph *fg)
 {
     AVFilterInOut *inputs, *outputs, *cur;
@@ -780,14 +940,34 @@ int configure_filtergraph(FilterGraph *fg)
     if (!(fg->graph = avfilter_graph_alloc()))
         return AVERROR(ENOMEM);
 
-    if (simple) {
+    if (simple && av_dict_get(fg->outputs[0]->ost->encoder_opts, "threads", NULL, 0)) {
         OutputStream *ost = fg->outputs[0]->ost;
-        char args[512];
         AVDictionaryEntry *e = NULL;
 
         e = av_dict_get(ost->encoder_opts, "threads", NULL, 0);
         if (e)
             av_opt_set(fg->graph, "threads", e->value, 0);
+    } else {
+        /* take the graph's cores from the process-wide budget, reconfiguring
+         * picks up whatever finished streams gave back */
+        if (!fg->thread_share) {
+            int64_t cost = 0;
+            char name[32];
+
+            for (i = 0; i < fg->nb_outputs; i++) {
+                OutputStream *ost = fg->outputs[i]->ost;
+                InputStream *ist = ost->source_index >= 0 ? input_streams[ost->source_index] : NULL;
+
+                if (ost->enc_ctx->codec_type == AVMEDIA_TYPE_VIDEO && ist)
+                    cost += thread_budget_video_cost(ist->dec_ctx->width, ist->dec_ctx->height,
+                                                     THREAD_BUDGET_FILTER_WEIGHT);
+                else
+                    cost += THREAD_BUDGET_AUDIO_COST;
+            }
+            snprintf(name, sizeof(name), "filter graph #%d", fg->index);
+            fg->thread_share = thread_budget_acquire(name, cost);
+        }
+        av_opt_set_int(fg->graph, "threads", thread_share_count(fg->thread_share), 0);
     }
 
     if ((ret = avfilter_graph_parse2(fg->graph, graph_desc, &inputs, &outputs)) < 0)
@@ -826,13 +1006,25 @@ int configure_filtergraph(FilterGraph *fg)
         }
     avfilter_inout_free(&inputs);
 
-    for (cur = outputs, i = 0; cur; cur = cur->next, i++)
-        configure_output_filter(fg, fg->outputs[i], cur);
+    for (cur = outputs, i = 0; cur; cur = cur->next, i++) {
+        /* an output labeled [out<n>] belongs to fg->outputs[n] */
+        int idx = cur->name && !strncmp(cur->name, "out", 3) ? atoi(cur->name + 3) : i;
+
+        if (idx < 0 || idx >= fg->nb_outputs) {
+            avfilter_inout_free(&outputs);
+            return AVERROR(EINVAL);
+        }
+        configure_output_filter(fg, fg->outputs[idx], cur);
+    }
     avfilter_inout_free(&outputs);
 
     if ((ret = avfilter_graph_config(fg->graph, NULL)) < 0)
         return ret;
 
+    if ((fg->bypass = graph_is_passthrough(fg)))
+        av_log(NULL, AV_LOG_VERBOSE, "Filter graph #%d leaves the frames unchanged, bypassing it.\n",
+               fg->index);
+
     for (i = 0; i < fg->nb_outputs; i++) {
         OutputStream *ost = fg->outputs[i]->ost;
         if (!ost->enc) {
@@ -851,6 +1043,228 @@ int configure_filtergraph(FilterGraph *fg)
     return 0;
 }
 
+/* an unset layout matches any layout with the same channel count */
+static int channel_layouts_match(uint64_t a, uint64_t b)
+{
+    return a == b || !a || !b;
+}
+
+/* Does frame have the format the graph input of ifilter was configured with? */
+static int frame_matches_graph(InputFilter *ifilter, const AVFrame *frame)
+{
+    InputStream *ist = ifilter->ist;
+
+    if (ist->dec_ctx->codec_type == AVMEDIA_TYPE_VIDEO)
+        return frame->width  == ist->resample_width  &&
+               frame->height == ist->resample_height &&
+               frame->format == ist->resample_pix_fmt;
+    return frame->format         == ist->resample_sample_fmt  &&
+           frame->sample_rate    == ist->resample_sample_rate &&
+           av_frame_get_channels(frame) == ist->resample_channels &&
+           channel_layouts_match(frame->channel_layout, ist->resample_channel_layout);
+}
+
+static int frame_matches_adapter(InputFilter *ifilter, const AVFrame *frame)
+{
+    if (ifilter->ist->dec_ctx->codec_type == AVMEDIA_TYPE_VIDEO)
+        return frame->width  == ifilter->adapter_width  &&
+               frame->height == ifilter->adapter_height &&
+               frame->format == ifilter->adapter_format;
+    return frame->format         == ifilter->adapter_format      &&
+           frame->sample_rate    == ifilter->adapter_sample_rate &&
+           av_frame_get_channels(frame) == ifilter->adapter_channels &&
+           channel_layouts_match(frame->channel_layout, ifilter->adapter_channel_layout);
+}
+
+/* Move everything the adapter has converted so far into the graph. */
+static int push_adapted_frames(InputFilter *ifilter)
+{
+    int ret;
+
+    while ((ret = av_buffersink_get_frame(ifilter->adapter_sink, ifilter->adapter_frame)) >= 0) {
+        ret = av_buffersrc_add_frame_flags(ifilter->filter, ifilter->adapter_frame,
+                                           AV_BUFFERSRC_FLAG_PUSH);
+        av_frame_unref(ifilter->adapter_frame);
+        if (ret < 0)
+            return ret;
+    }
+    return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret;
+}
+
+/* Flush the frames buffered in the adapter into the graph and free it. */
+static int close_adapter(InputFilter *ifilter)
+{
+    int ret;
+
+    if (!ifilter->adapter)
+        return 0;
+    if ((ret = av_buffersrc_add_frame(ifilter->adapter_src, NULL)) >= 0)
+        ret = push_adapted_frames(ifilter);
+    avfilter_graph_free(&ifilter->adapter);
+    av_frame_free(&ifilter->adapter_frame);
+    ifilter->adapter_src  = NULL;
+    ifilter->adapter_sink = NULL;
+    return ret;
+}
+
+/*
+ * Build buffer -> scale -> format -> buffersink (abuffer -> aformat ->
+ * abuffersink for audio, lavfi inserts the resampler) converting frames
+ * like frame to the resample_* format of the stream.
+ */
+static int open_adapter(InputFilter *ifilter, const AVFrame *frame)
+{
+    InputStream *ist = ifilter->ist;
+    FilterGraph *fg = ifilter->graph;
+    int video = ist->dec_ctx->codec_type == AVMEDIA_TYPE_VIDEO;
+    AVFilterContext *last_filter;
+    char args[256], name[255], flags[64];
+    int ret, pad_idx = 0;
+
+    if (!(ifilter->adapter = avfilter_graph_alloc()) ||
+        !(ifilter->adapter_frame = av_frame_alloc()))
+        return AVERROR(ENOMEM);
+    /* the adapter runs on the thread of the graph it feeds */
+    av_opt_set_int(ifilter->adapter, "threads", 1, 0);
+
+    snprintf(name, sizeof(name), "adapter input from stream %d:%d",
+             ist->file_index, ist->st->index);
+    if (video) {
+        AVRational sar = frame->sample_aspect_ratio.den ? frame->sample_aspect_ratio : (AVRational){ 0, 1 };
+
+        snprintf(args, sizeof(args), "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d",
+                 frame->width, frame->height, frame->format,
+                 ist->st->time_base.num, ist->st->time_base.den, sar.num, sar.den);
+        ret = avfilter_graph_create_filter(&ifilter->adapter_src, avfilter_get_by_name("buffer"),
+                                           name, args, NULL, ifilter->adapter);
+    } else {
+        /* the pts are in the time base of the graph input */
+        snprintf(args, sizeof(args), "time_base=1/%d:sample_rate=%d:sample_fmt=%s",
+                 ist->resample_sample_rate, frame->sample_rate,
+                 av_get_sample_fmt_name(frame->format));
+        if (frame->channel_layout)
+            av_strlcatf(args, sizeof(args), ":channel_layout=0x%"PRIx64, frame->channel_layout);
+        else
+            av_strlcatf(args, sizeof(args), ":channels=%d", av_frame_get_channels(frame));
+        ret = avfilter_graph_create_filter(&ifilter->adapter_src, avfilter_get_by_name("abuffer"),
+                                           name, args, NULL, ifilter->adapter);
+    }
+    if (ret < 0)
+        return ret;
+    last_filter = ifilter->adapter_src;
+
+    if (video) {
+        /* scale with the profile the graph input uses, see configure_input_video_filter() */
+        snprintf(args, sizeof(args), "%d:%d:flags=%s", ist->resample_width, ist->resample_height,
+                 scaler_profile_flags(fg->nb_outputs == 1 ? fg->outputs[0]->ost->scaler_profile : NULL,
+                                      frame->width, frame->height,
+                                      ist->resample_width, ist->resample_height, flags, sizeof(flags)));
+        if ((ret = insert_filter(&last_filter, &pad_idx, "scale", args)) < 0)
+            return ret;
+        snprintf(args, sizeof(args), "pix_fmts=%s", av_get_pix_fmt_name(ist->resample_pix_fmt));
+        if ((ret = insert_filter(&last_filter, &pad_idx, "format", args)) < 0)
+            return ret;
+    } else {
+        snprintf(args, sizeof(args), "sample_fmts=%s:sample_rates=%d",
+                 av_get_sample_fmt_name(ist->resample_sample_fmt), ist->resample_sample_rate);
+        if (ist->resample_channel_layout)
+            av_strlcatf(args, sizeof(args), ":channel_layouts=0x%"PRIx64, ist->resample_channel_layout);
+        if ((ret = insert_filter(&last_filter, &pad_idx, "aformat", args)) < 0)
+            return ret;
+    }
+
+    snprintf(name, sizeof(name), "adapter output for stream %d:%d",
+             ist->file_index, ist->st->index);
+    if ((ret = avfilter_graph_create_filter(&ifilter->adapter_sink,
+                                            avfilter_get_by_name(video ? "buffersink" : "abuffersink"),
+                                            name, NULL, NULL, ifilter->adapter)) < 0 ||
+        (ret = avfilter_link(last_filter, pad_idx, ifilter->adapter_sink, 0)) < 0 ||
+        (ret = avfilter_graph_config(ifilter->adapter, NULL)) < 0)
+        return ret;
+
+    ifilter->adapter_format         = frame->format;
+    ifilter->adapter_width          = frame->width;
+    ifilter->adapter_height         = frame->height;
+    ifilter->adapter_sample_rate    = frame->sample_rate;
+    ifilter->adapter_channels       = av_frame_get_channels(frame);
+    ifilter->adapter_channel_layout = frame->channel_layout;
+    return 0;
+}
+
+int ifilter_push_frame(InputFilter *ifilter, AVFrame *frame)
+{
+    InputStream *ist = ifilter->ist;
+    int ret;
+
+    if (frame_matches_graph(ifilter, frame)) {
+        /* back to the configured format, what the adapter still holds goes first */
+        if (ifilter->adapter) {
+            av_log(NULL, AV_LOG_INFO, "Input stream #%d:%d is back to its initial format.\n",
+                   ist->file_index, ist->st->index);
+            if ((ret = close_adapter(ifilter)) < 0)
+                return ret;
+        }
+        return av_buffersrc_add_frame_flags(ifilter->filter, frame, AV_BUFFERSRC_FLAG_PUSH);
+    }
+
+    if (!ifilter->adapter || !frame_matches_adapter(ifilter, frame)) {
+        if ((ret = close_adapter(ifilter)) < 0)
+            return ret;
+        if (ist->dec_ctx->codec_type == AVMEDIA_TYPE_VIDEO)
+            av_log(NULL, AV_LOG_INFO, "Input stream #%d:%d changed to %dx%d %s, "
+                   "converting to %dx%d %s.\n", ist->file_index, ist->st->index,
+                   frame->width, frame->height, av_get_pix_fmt_name(frame->format),
+                   ist->resample_width, ist->resample_height,
+                   av_get_pix_fmt_name(ist->resample_pix_fmt));
+        else
+            av_log(NULL, AV_LOG_INFO, "Input stream #%d:%d changed to %d Hz %s %d channels, "
+                   "converting to %d Hz %s %d channels.\n", ist->file_index, ist->st->index,
+                   frame->sample_rate, av_get_sample_fmt_name(frame->format),
+                   av_frame_get_channels(frame), ist->resample_sample_rate,
+                   av_get_sample_fmt_name(ist->resample_sample_fmt), ist->resample_channels);
+        if ((ret = open_adapter(ifilter, frame)) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Could not convert the frames of input stream #%d:%d: %s\n",
+                   ist->file_index, ist->st->index, av_err2str(ret));
+            close_adapter(ifilter);
+            av_frame_unref(frame);
+            return ret;
+        }
+    }
+    if ((ret = av_buffersrc_add_frame(ifilter->adapter_src, frame)) < 0)
+        return ret;
+    return push_adapted_frames(ifilter);
+}
+
+int ifilter_push_eof(InputFilter *ifilter)
+{
+    int ret = close_adapter(ifilter);
+
+    if (ret < 0)
+        av_log(NULL, AV_LOG_ERROR, "Error draining the frames of input stream #%d:%d: %s\n",
+               ifilter->ist->file_index, ifilter->ist->st->index, av_err2str(ret));
+    return av_buffersrc_add_frame(ifilter->filter, NULL);
+}
+
+int ifilter_bypass(InputFilter *ifilter, const AVFrame *frame)
+{
+    FilterGraph *fg = ifilter->graph;
+    OutputStream *ost;
+
+    if (!fg->bypass)
+        return 0;
+    ost = fg->outputs[0]->ost;
+    /* the buffersink cuts audio into the frame size of the encoder, the decoder does not */
+    if (frame_matches_graph(ifilter, frame) &&
+        (ost->enc_ctx->codec_type != AVMEDIA_TYPE_AUDIO ||
+         (ost->enc->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE) ||
+         !ost->enc_ctx->frame_size || frame->nb_samples == ost->enc_ctx->frame_size))
+        return 1;
+    av_log(NULL, AV_LOG_VERBOSE, "Output stream #%d:%d is filtered from now on.\n",
+           ost->file_index, ost->index);
+    fg->bypass = 0;
+    return 0;
+}
+
 int ist_in_filtergraph(FilterGraph *fg, InputStream *ist)
 {
     int i;
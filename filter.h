@@ -13,5 +13,36 @@
 #include "ffmpeg.h"
 
 struct FilterGraph *init_simple_filtergraph(InputStream *ist, OutputStream *ost);
+
+/*
+ * One graph feeding the frames of ist to every stream of osts at the
+ * width and height of its encoder context, so the input is decoded once
+ * however many renditions there are. With cascade each rendition is
+ * scaled from the next larger one instead of from the input, which costs
+ * about the area ratio less per step.
+ */
+struct FilterGraph *init_ladder_filtergraph(InputStream *ist, OutputStream **osts, int nb_osts,
+                                            int cascade);
 int configure_filtergraph(FilterGraph *fg);
+
+/*
+ * Push a decoded frame into the graph of ifilter, the reference is moved.
+ * Frames whose size or format differs from the one the graph was
+ * configured with are converted to it by an adapter graph in front of the
+ * buffer source, so the graph itself is never rebuilt.
+ */
+int ifilter_push_frame(InputFilter *ifilter, AVFrame *frame);
+
+/* Drain the adapter, if any, and signal EOF to the graph of ifilter. */
+int ifilter_push_eof(InputFilter *ifilter);
+
+/*
+ * Should frame skip the graph of ifilter and go straight to the encoder of
+ * its only output? Configuring a simple graph that passes frames on as they
+ * are ("null" and format filters the input already satisfies) turns the
+ * bypass on; the first frame the encoder cannot take as is turns it off for
+ * good, so no frame overtakes another through the graph. Call it from the
+ * thread that would push the frame.
+ */
+int ifilter_bypass(InputFilter *ifilter, const AVFrame *frame);
 #endif /* filter_h */
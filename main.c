@@ -7,331 +7,43 @@
 //
 
 #include <stdio.h>
-#include <pthread.h>
-#include "ffmpeg.h"
-
-#define INPUT_FILE_NAME "/Users/wlanjie/Desktop/sintel.mp4"
-#define OUTPUT_FILE_NAME "/Users/wlanjie/Desktop/ffmpeg.mp4"
-
-InputStream **input_streams = NULL;
-int        nb_input_streams = 0;
-InputFile   **input_files   = NULL;
-int        nb_input_files   = 0;
-
-OutputStream **output_streams = NULL;
-int         nb_output_streams = 0;
-OutputFile   **output_files   = NULL;
-int         nb_output_files   = 0;
-
-FilterGraph **filtergraphs = NULL;
-int        nb_filtergraphs = 0;
-
-void *grow_array(void *array, int elem_size, int *size, int new_size)
-{
-    if (new_size >= INT_MAX / elem_size) {
-        av_log(NULL, AV_LOG_ERROR, "Array too big.\n");
-        return NULL;
-    }
-    if (*size < new_size) {
-        uint8_t *tmp = av_realloc_array(array, new_size, elem_size);
-        if (!tmp) {
-            av_log(NULL, AV_LOG_ERROR, "Could not alloc buffer.\n");
-            return NULL;
-        }
-        memset(tmp + *size*elem_size, 0, (new_size-*size) * elem_size);
-        *size = new_size;
-        return tmp;
-    }
-    return array;
-}
-
-static int add_input_streams(AVFormatContext *ic) {
-    int ret = 0;
-    for (int i =0 ; i < ic->nb_streams; i++) {
-        AVStream *st = ic->streams[i];
-        AVCodecContext *dec = st->codec;
-        InputStream *ist = av_mallocz(sizeof(*ist));
-        if (!ist) {
-            av_log(NULL, AV_LOG_ERROR, "Could not alloc input stream.\n");
-            return AVERROR(ENOMEM);
-        }
-        GROW_ARRAY(input_streams, nb_input_streams);
-        input_streams[nb_input_streams - 1] = ist;
-        ist->st = st;
-        ist->file_index = nb_input_files;
-        ist->dec = avcodec_find_decoder(st->codec->codec_id);
-        ist->dec_ctx = avcodec_alloc_context3(ist->dec);
-        ret = avcodec_copy_context(ist->dec_ctx, dec);
-        if (ret < 0) {
-            av_err2str(ret);
-            return ret;
-        }
-//        ist->user_set_discard = AVDISCARD_NONE;
-        if (!ist->dec_ctx) {
-            av_log(NULL, AV_LOG_ERROR, "Could not alloc input AVCodecContext.\n");
-            av_free(ist);
-            avcodec_close(ist->dec_ctx);
-            return AVERROR(ENOMEM);
-        }
-        switch (dec->codec_type) {
-            case AVMEDIA_TYPE_VIDEO:
-                if (!ist->dec) {
-                    ist->dec = avcodec_find_decoder(dec->codec_id);
-                }
-                ist->resample_height = ist->dec_ctx->height;
-                ist->resample_width= ist->dec_ctx->width;
-                ist->resample_pix_fmt = ist->dec_ctx->pix_fmt;
-                break;
-
-            case AVMEDIA_TYPE_AUDIO:
-                ist->resample_sample_fmt = ist->dec_ctx->sample_fmt;
-                ist->resample_sample_rate = ist->dec_ctx->sample_rate;
-                ist->resample_channels = ist->dec_ctx->channels;
-                ist->resample_channel_layout = ist->dec_ctx->channel_layout;
-                break;
-            default:
-                break;
-        }
-    }
-    return ret;
-}
-
-static int decode_interrupt_cb(void *ctx) {
-    return received_nb_signals > transcode_init_done;
-}
-
-const AVIOInterruptCB int_cb_1 = { decode_interrupt_cb, NULL };
-
-static int open_input_file(const char *filename) {
-    int ret;
-    AVInputFormat *file_iformat = NULL;
-    AVFormatContext *ic = avformat_alloc_context();
-    if (!ic) {
-        av_log(NULL, AV_LOG_ERROR, "Could not alloc input format context.\n");
-        return AVERROR(ENOMEM);
-    }
-    ic->flags |= AVFMT_FLAG_NONBLOCK;
-    ic->interrupt_callback = int_cb_1;
-
-    ret = avformat_open_input(&ic, filename, file_iformat, NULL);
-    if (ret < 0) {
-        av_err2str(ret);
-        if (ic->nb_streams == 0) {
-            avformat_close_input(&ic);
-        }
-        avformat_free_context(ic);
-        return ret;
-    }
-
-    ret = avformat_find_stream_info(ic, NULL);
-    if (ret < 0) {
-        av_err2str(ret);
-        if (ic->nb_streams == 0) {
-            avformat_close_input(&ic);
-            avformat_free_context(ic);
-            return ret;
-        }
-    }
-
-    add_input_streams(ic);
-
-    av_dump_format(ic, nb_input_files, filename, 0);
-    GROW_ARRAY(input_files, nb_input_files);
-    InputFile *f = av_mallocz(sizeof(*f));
-    if (!f) {
-        av_log(NULL, AV_LOG_ERROR, "Could not alloc InputFile.\n");
-        avformat_close_input(&ic);
-        avformat_free_context(ic);
-        return AVERROR(ENOMEM);
-    }
-    input_files[nb_input_files - 1] = f;
-    f->ctx = ic;
-//    f->ist_index = nb_input_streams - ic->nb_streams;
-//    f->ts_offset = 0;
-//    f->duration = 0;
-    f->nb_streams = ic->nb_streams;
-    f->thread_queue_size = 8;
-    f->time_base = (AVRational) { 1, 1 };
-    return ret;
-}
-
-static OutputStream *new_output_stream(AVFormatContext *oc, enum AVMediaType type, char *codec_name, int source_index) {
-    OutputStream *ost;
-    AVStream *st = avformat_new_stream(oc, NULL);
-    int idx = oc->nb_streams - 1;
-    if (!st) {
-        av_log(NULL, AV_LOG_ERROR, "Could not new Output Stream.\n");
-        return NULL;
-    }
-    GROW_ARRAY(output_streams, nb_output_streams);
-    if (!(ost = av_mallocz(sizeof(*ost)))) {
-        av_log(NULL, AV_LOG_ERROR, "Could not alloc OutputStream.\n");
-        return NULL;
-    }
-    output_streams[nb_output_streams - 1] = ost;
-    ost->file_index = nb_output_files - 1;
-    ost->index = idx;
-    ost->st = st;
-    st->codec->codec_type = type;
-    ost->enc = avcodec_find_encoder_by_name(codec_name);
-    if (!ost->enc) {
-        av_log(NULL, AV_LOG_ERROR, "Could not find encoder by name %s.\n", codec_name);
-        return NULL;
-    }
-    ost->enc_ctx = avcodec_alloc_context3(ost->enc);
-    if (!ost->enc_ctx) {
-        av_log(NULL, AV_LOG_ERROR, "Could not alloc Output AVCodecContext.\n");
-        return NULL;
-    }
-    ost->enc_ctx->codec_type = type;
-    int ret = av_dict_set(&ost->encoder_opts, "strict", "-2", 0);
-    if (ret < 0) {
-        av_log(NULL, AV_LOG_ERROR, "Could not dict set strict value -2.\n");
-        return NULL;
-    }
-    ost->max_frames = INT64_MAX;
-    if (oc->oformat->flags & AVFMT_GLOBALHEADER) {
-        ost->enc_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
-    }
-    ost->source_index = source_index;
-    if (source_index >= 0) {
-        ost->sync_list = input_streams[source_index];
-        input_streams[source_index]->discard = 0;
-        input_streams[source_index]->st->discard = input_streams[source_index]->user_set_discard;
-    }
-    ost->last_mux_dts = AV_NOPTS_VALUE;
-    return ost;
-}
-
-static int new_video_stream(AVFormatContext *oc, int source_index) {
-    int ret;
-    OutputStream *ost = new_output_stream(oc, AVMEDIA_TYPE_VIDEO, "libx264", source_index);
-    if (ost == NULL) {
-        return AVERROR(ENOMEM);
-    }
-
-    AVStream *st = ost->st;
-    AVCodecContext *video_enc = ost->enc_ctx;
-//    if (av_parse_video_size(&video_enc->width, &video_enc->height, "640x320") < 0) {
-//        av_log(NULL, AV_LOG_ERROR, "Could not parse video size %s.\n", "640x320");
-//        av_err2str(ret);
-//        return ret;
-//    }
-    st->sample_aspect_ratio = video_enc->sample_aspect_ratio;
-    ost->avfilter = st->codec->codec_type == AVMEDIA_TYPE_VIDEO ? "null" : "anull";
-    return ret;
-}
-
-static int new_audio_stream(AVFormatContext *oc, int source_index) {
-    int ret;
-    OutputStream *ost = new_output_stream(oc, AVMEDIA_TYPE_AUDIO, "aac", source_index);
-    if (ost == NULL) {
-        return AVERROR(ENOMEM);
-    }
-    AVStream *st = ost->st;
-    AVCodecContext *audio_enc = ost->enc_ctx;
-    audio_enc->codec_type = AVMEDIA_TYPE_AUDIO;
-    ost->avfilter = st->codec->codec_type == AVMEDIA_TYPE_VIDEO ? "null" : "anull";
-    return ret;
-}
-
-static int open_output_file(const char *filename) {
-    int ret;
-    GROW_ARRAY(output_files, nb_output_files);
-    OutputFile *of = av_mallocz(sizeof(*of));
-    if (!of) {
-        av_log(NULL, AV_LOG_ERROR, "Could not alloc OutputFile.\n");
-        return AVERROR(ENOMEM);
-    }
-    of->ost_index = nb_output_streams;
-    of->recording_time = INT64_MAX;
-    of->start_time = INT64_MIN;
-    of->limit_filesize = UINT64_MAX;
-    of->shortest = 0;
-    ret = av_dict_set(&of->opts, "strict", "-2", 0);
-    if (ret < 0) {
-        av_log(NULL, AV_LOG_ERROR, "Could not set dict.\n");
-        av_free(of);
-        return AVERROR(ENOMEM);
-    }
-    AVFormatContext *oc = avformat_alloc_context();
-    ret = avformat_alloc_output_context2(&oc, NULL, NULL, filename);
-    if (ret < 0) {
-        av_err2str(ret);
-        avformat_free_context(oc);
-        return ret;
-    }
-    of->ctx = oc;
-    output_files[nb_output_files - 1] = of;
-    InputStream *ist;
-    AVOutputFormat *file_oformat = oc->oformat;
-    if (av_guess_codec(file_oformat, NULL, filename, NULL, AVMEDIA_TYPE_VIDEO) != AV_CODEC_ID_NONE) {
-        int area = 0, idx = -1;
-        int qcr = avformat_query_codec(oc->oformat, oc->oformat->video_codec, 0);
-        for (int i = 0; i < nb_input_streams; i++) {
-            int new_area;
-            ist = input_streams[i];
-            new_area = ist->st->codec->width * ist->st->codec->height + 100000000*!!ist->st->codec_info_nb_frames;
-            if((qcr!=MKTAG('A', 'P', 'I', 'C')) && (ist->st->disposition & AV_DISPOSITION_ATTACHED_PIC))
-                new_area = 1;
-            if (ist->st->codec->codec_type == AVMEDIA_TYPE_VIDEO &&
-                new_area > area) {
-                if((qcr==MKTAG('A', 'P', 'I', 'C')) && !(ist->st->disposition & AV_DISPOSITION_ATTACHED_PIC))
-                    continue;
-                area = new_area;
-                idx = i;
-            }
-        }
-        if (idx >= 0)
-            new_video_stream(oc, idx);
-    }
-    if (av_guess_codec(file_oformat, NULL, filename, NULL, AVMEDIA_TYPE_AUDIO) != AV_CODEC_ID_NONE) {
-        int best_score = 0, idx = -1;
-        for (int i = 0; i < nb_input_streams; i++) {
-            int score;
-            ist = input_streams[i];
-            score = ist->st->codec->channels + 100000000*!!ist->st->codec_info_nb_frames;
-            if (ist->st->codec->codec_type == AVMEDIA_TYPE_AUDIO &&
-                score > best_score) {
-                best_score = score;
-                idx = i;
-            }
-        }
-        if (idx >= 0)
-            new_audio_stream(oc, idx);
-    }
-    for (int i = of->ost_index; i < nb_output_streams; i++) {
-        OutputStream *ost = output_streams[i];
-        ost->encoding_needed = 1;
-        InputStream *ist = input_streams[ost->source_index];
-        ist->decoding_needed |= DECODING_FOR_OST;
-    }
-    if (!(oc->oformat->flags & AVFMT_NOFILE)) {
-        if ((ret = avio_open2(&oc->pb, filename, AVIO_FLAG_WRITE, &oc->interrupt_callback, &of->opts)) < 0) {
-            av_err2str(ret);
-            return ret;
-        }
-    }
-//    oc->max_delay = (int) (0.7 * AV_TIME_BASE);
-    if (nb_input_files) {
-        av_dict_copy(&oc->metadata, input_files[0]->ctx->metadata, AV_DICT_DONT_OVERWRITE);
-        av_dict_set(&oc->metadata, "creation_time", NULL, 0);
-    }
-
-    for (int i = of->ost_index; i < nb_output_streams; i++) {
-        InputStream *ist;
-        if (output_streams[i]->source_index < 0) {
-            continue;
-        }
-        ist = input_streams[output_streams[i]->source_index];
-        av_dict_copy(&output_streams[i]->st->metadata, ist->st->metadata, AV_DICT_DONT_OVERWRITE);
-        av_dict_set(&output_streams[i]->st->metadata, "encoder", NULL, 0);
-    }
-    return ret;
-}
-
-static int open_files(const char *filename, int (*open_file)(const char*)) {
-    return open_file(filename);
+#include <stdlib.h>
+#include <string.h>
+#include "ffmpeg_opt.h"
+#include "segment.h"
+#include "trace.h"
+#include "async_log.h"
+#include "perf_counters.h"
+#include "scaler_profile.h"
+
+static void show_usage(const char *program_name) {
+    av_log(NULL, AV_LOG_INFO,
+           "usage: %s [-pipeline] [-mux_queue_size bytes] [-threads n] [-acodec codec] [-autocopy]\n"
+           "          [-scaler profile] [-segments n | -ladder heights [-ladder_split]] input output [width height [codec]]\n"
+           "       %s [-pipeline] [-mux_queue_size bytes] [-jobs n] [-acodec codec] [-autocopy]\n"
+           "          [-scaler profile] [-ladder heights [-ladder_split]] -batch manifest\n"
+           "codec may be \"copy\" to remux without re-encoding, or \"auto\" to copy when the\n"
+           "output container accepts the input codec; -autocopy makes \"auto\" the default.\n"
+           "-scaler picks the scaling algorithm: auto (by the scaling ratio), fast_bilinear,\n"
+           "bilinear, area, bicubic or lanczos, optionally followed by +accurate_rnd and\n"
+           "+full_chroma_int; the sixth field of a manifest line overrides it per job.\n"
+           "-ladder 1080,720,480,360 decodes the input once and encodes one output file per\n"
+           "height (or WxH), named output_<height>p.ext or by a %%d in the output name. Each\n"
+           "rendition is scaled from the next larger one; -ladder_split scales them all from\n"
+           "the input, slower but without compounding the scaling losses.\n"
+           "-segments encodes n keyframe aligned pieces of the input in parallel and joins them.\n"
+           "-stats_period ms sets the interval of the progress line, -nostats disables it;\n"
+           "-dump logs every demuxed packet.\n"
+           "-metrics file writes Prometheus text format counters every -metrics_period ms\n"
+           "(10000 by default), for single jobs only.\n"
+           "-trace file records every packet and frame through the pipeline as a Chrome trace,\n"
+           "for single jobs only.\n"
+           "-perf reads the CPU cycles, instructions, cache and branch misses of every stage\n"
+           "of every stream (Linux only), for single jobs only; it runs the codecs and filter\n"
+           "graphs single-threaded so that no work escapes the counters.\n"
+           "Log lines are written by a background thread, -sync_log writes them in place;\n"
+           "-log_time prefixes them with the seconds since the start.\n",
+           program_name, program_name);
 }
 
 int main(int argc, char **argv) {
@@ -339,20 +51,108 @@ int main(int argc, char **argv) {
     avcodec_register_all();
     avfilter_register_all();
     int ret;
-    ret = open_files(INPUT_FILE_NAME, open_input_file);
-    if (ret < 0) {
-        av_log(NULL, AV_LOG_ERROR, "Could not open input file.\n");
-        return ret;
-    }
-    ret = open_files(OUTPUT_FILE_NAME, open_output_file);
-    if (ret < 0) {
-        av_log(NULL, AV_LOG_ERROR, "Could not open output file.\n");
-        return ret;
-    }
-//    ret = transcode();
-    if (ret < 0) {
-        av_log(NULL, AV_LOG_ERROR, "Could not transcode.\n");
-        return ret;
-    }
-    return 0;
+    const char *manifest = NULL;
+    const char *args[5] = { NULL };
+    const char *trace_path = NULL;
+    int nb_args = 0, max_jobs = 0, nb_segments = 1, sync_log = 0, log_flags = 0, perf = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-pipeline"))
+            pipeline_mode = 1;
+        else if (!strcmp(argv[i], "-mux_queue_size") && i + 1 < argc)
+            mux_queue_size = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-batch") && i + 1 < argc)
+            manifest = argv[++i];
+        else if (!strcmp(argv[i], "-jobs") && i + 1 < argc)
+            max_jobs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-threads") && i + 1 < argc)
+            thread_budget_set_cores(atoi(argv[++i]));
+        else if (!strcmp(argv[i], "-acodec") && i + 1 < argc)
+            audio_codec_opt = argv[++i];
+        else if (!strcmp(argv[i], "-scaler") && i + 1 < argc)
+            scaler_opt = argv[++i];
+        else if (!strcmp(argv[i], "-ladder") && i + 1 < argc)
+            ladder_opt = argv[++i];
+        else if (!strcmp(argv[i], "-ladder_split"))
+            ladder_split = 1;
+        else if (!strcmp(argv[i], "-autocopy"))
+            auto_copy = 1;
+        else if (!strcmp(argv[i], "-segments") && i + 1 < argc)
+            nb_segments = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-stats_period") && i + 1 < argc)
+            stats_period = strtoll(argv[++i], NULL, 10) * 1000;
+        else if (!strcmp(argv[i], "-nostats"))
+            stats_period = 0;
+        else if (!strcmp(argv[i], "-dump"))
+            do_pkt_dump = 1;
+        else if (!strcmp(argv[i], "-metrics") && i + 1 < argc)
+            metrics_path = argv[++i];
+        else if (!strcmp(argv[i], "-metrics_period") && i + 1 < argc)
+            metrics_period = strtoll(argv[++i], NULL, 10) * 1000;
+        else if (!strcmp(argv[i], "-trace") && i + 1 < argc)
+            trace_path = argv[++i];
+        else if (!strcmp(argv[i], "-perf"))
+            perf = 1;
+        else if (!strcmp(argv[i], "-sync_log"))
+            sync_log = 1;
+        else if (!strcmp(argv[i], "-log_time"))
+            log_flags |= ASYNC_LOG_TIMESTAMPS;
+        else if (nb_args < 5)
+            args[nb_args++] = argv[i];
+    }
+
+    if (scaler_opt && scaler_profile_check(scaler_opt) < 0)
+        return 1;
+    if (ladder_opt && nb_segments > 1) {
+        av_log(NULL, AV_LOG_ERROR, "-ladder cannot be combined with -segments.\n");
+        return 1;
+    }
+    if (!sync_log && async_log_start(ASYNC_LOG_DEFAULT_SLOTS, log_flags) < 0)
+        return 1;
+    if ((metrics_path || trace_path || perf) && (manifest || nb_segments > 1)) {
+        av_log(NULL, AV_LOG_WARNING, "-metrics, -trace and -perf are ignored with -batch and -segments, "
+               "the jobs run in separate processes.\n");
+        metrics_path = NULL;
+        trace_path   = NULL;
+        perf         = 0;
+    }
+    if (perf) {
+        if (perf_counters_enable() < 0)
+            return 1;
+        /* the counters only see the thread that opened them, so keep the
+         * codecs and filter graphs from handing work to their own threads */
+        if (thread_budget_cores() != 1)
+            av_log(NULL, AV_LOG_WARNING, "-perf runs the codecs and filter graphs single-threaded.\n");
+        thread_budget_set_cores(1);
+    }
+    if (trace_path && trace_open(trace_path, TRACE_DEFAULT_EVENTS) < 0)
+        return 1;
+    if (manifest) {
+        BatchJob *jobs;
+        int nb_jobs;
+        if ((ret = batch_read_manifest(manifest, &jobs, &nb_jobs)) < 0)
+            return 1;
+        ret = batch_run(jobs, nb_jobs, max_jobs, ffmpeg_run_job, NULL);
+        batch_free_jobs(&jobs, &nb_jobs);
+        return ret != 0;
+    }
+
+    if (nb_args != 2 && nb_args < 4) {
+        show_usage(argv[0]);
+        return 1;
+    }
+    BatchJob job = {
+        .input       = (char *) args[0],
+        .output      = (char *) args[1],
+        .width       = nb_args > 3 ? atoi(args[2]) : 0,
+        .height      = nb_args > 3 ? atoi(args[3]) : 0,
+        .video_codec = args[4] && strcmp(args[4], "-") ? (char *) args[4] : NULL,
+        .start_time  = AV_NOPTS_VALUE,
+        .stop_time   = AV_NOPTS_VALUE,
+    };
+    if (nb_segments > 1)
+        ret = segment_run(&job, nb_segments, ffmpeg_run_job, NULL);
+    else
+        ret = ffmpeg_run_job(&job, NULL);
+    trace_close();
+    return ret < 0;
 }